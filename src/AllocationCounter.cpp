@@ -0,0 +1,39 @@
+#include "AllocationCounter.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Constant-initialized, so it is usable by the allocations made before main
+static std::atomic<uint64_t> allocations{0};
+
+uint64_t AllocationCounter::count(void) {
+    return allocations.load(std::memory_order_relaxed);
+}
+
+// The library's operator new[] and nothrow forms all end up in these two
+void *operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    auto align = static_cast<std::size_t>(alignment);
+    // aligned_alloc wants a non-zero multiple of the alignment
+    auto rounded = ((size ? size : 1) + align - 1) / align * align;
+    if (void *ptr = std::aligned_alloc(align, rounded)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::align_val_t) noexcept {
+    std::free(ptr);
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+ * Counts the heap allocations of the process: AllocationCounter.cpp replaces the global operator new, so
+ * linking it in is enough. Used by --check-allocs to prove the emulation loop never allocates after load().
+ */
+class AllocationCounter {
+public:
+    // Number of operator new calls since the start of the process, from every thread
+    static uint64_t count(void);
+};
@@ -0,0 +1,152 @@
+#include "BatchRunner.hpp"
+#include "Chip8Lockstep.hpp"
+#include "NullDisplay.hpp"
+#include "NullKeyboard.hpp"
+#include "WorkStealingPool.hpp"
+
+#include <iomanip>
+#include <sstream>
+
+BatchRunner::BatchRunner(Chip8::Engine engine, const Chip8::Timing &timing, uint64_t max_instructions,
+                         uint64_t max_frames, size_t threads, bool lockstep) :
+    engine_(engine),
+    timing_(timing),
+    max_instructions_(max_instructions),
+    max_frames_(max_frames),
+    threads_(threads),
+    lockstep_(lockstep),
+    failed_(0) {
+    if (lockstep_ && !timing_.unitCosts()) {
+        throw Chip8::Chip8Exception("Lockstep lanes take one cycle per instruction, --costs does not apply");
+    }
+}
+
+std::vector<BatchRunner::Job> BatchRunner::makeJobs(const std::vector<std::string> &paths, uint32_t seeds) {
+    std::vector<Job> jobs;
+    uint64_t id = 0;
+
+    for (const auto &path : paths) {
+        for (uint32_t seed = 0; seed < seeds; ++seed) {
+            jobs.push_back({id++, path, seed});
+        }
+    }
+    return jobs;
+}
+
+uint64_t BatchRunner::run(const std::vector<Job> &jobs, std::ostream &out) {
+    // Read every rom up front: the workers only share read-only copies
+    std::map<std::string, std::vector<uint8_t>> roms;
+    for (const auto &job : jobs) {
+        if (roms.find(job.path) == roms.end()) {
+            roms.emplace(job.path, Chip8::readRom(job.path));
+        }
+    }
+
+    failed_ = 0;
+    {
+        WorkStealingPool pool(threads_);
+        if (lockstep_) {
+            // One task per group of up to kLanes jobs of the same rom
+            std::map<std::string, std::vector<const Job *>> groups;
+            for (const auto &job : jobs) {
+                auto &group = groups[job.path];
+                group.push_back(&job);
+                if (group.size() == Chip8Lockstep::kLanes) {
+                    const auto &rom = roms.at(job.path);
+                    pool.submit([this, group, &rom, &out]() { runLockstepJobs(group, rom, out); });
+                    group.clear();
+                }
+            }
+            for (const auto &group : groups) {
+                if (!group.second.empty()) {
+                    const auto &rom = roms.at(group.first);
+                    pool.submit([this, jobs = group.second, &rom, &out]() { runLockstepJobs(jobs, rom, out); });
+                }
+            }
+        } else {
+            for (const auto &job : jobs) {
+                const auto &rom = roms.at(job.path);
+                pool.submit([this, &job, &rom, &out]() { runJob(job, rom, out); });
+            }
+        }
+        pool.wait();
+    }
+
+    return failed_;
+}
+
+void BatchRunner::runJob(const Job &job, const std::vector<uint8_t> &rom, std::ostream &out) {
+    std::ostringstream line;
+    line << "job=" << job.id << " rom=" << job.path << " seed=" << job.seed;
+
+    bool ok = true;
+    try {
+        std::shared_ptr<IDisplay> display = std::make_shared<NullDisplay>();
+        std::shared_ptr<IKeyboard> keyboard = std::make_shared<NullKeyboard>();
+        // Chip8 holds the memory and the decoded cache (~40 KB), keep it off the worker stack
+        auto chip8 = std::make_unique<Chip8>(display, keyboard);
+        chip8->loadRom(rom);
+        chip8->seed(job.seed);
+        chip8->setEngine(engine_);
+        chip8->setTiming(timing_);
+        auto stats = chip8->runHeadless(max_instructions_, max_frames_);
+
+        line << " instructions=" << stats.instructions << " wait_cycles=" << stats.wait_cycles
+             << " frames=" << stats.frames << " frame_hash=" << std::hex << std::setfill('0') << std::setw(16)
+             << chip8->frameHash() << std::dec << " ";
+        chip8->dumpRegisters(line);
+    } catch (const std::exception &err) {
+        line << " error=" << err.what();
+        ok = false;
+    }
+    line << "\n";
+
+    writeResult(line.str(), ok, out);
+}
+
+void BatchRunner::runLockstepJobs(const std::vector<const Job *> &jobs, const std::vector<uint8_t> &rom,
+                                  std::ostream &out) {
+    std::vector<std::ostringstream> lines(jobs.size());
+    for (size_t lane = 0; lane < jobs.size(); ++lane) {
+        lines[lane] << "job=" << jobs[lane]->id << " rom=" << jobs[lane]->path << " seed=" << jobs[lane]->seed;
+    }
+
+    bool ok = true;
+    try {
+        // Several hundred KB of lane state, keep it off the worker stack
+        auto lockstep = std::make_unique<Chip8Lockstep>(jobs.size());
+        // Lanes never skip idle loops, which leaves the same results
+        lockstep->setCyclesPerFrame(timing_.cycles_per_frame);
+        lockstep->loadRom(rom);
+        for (size_t lane = 0; lane < jobs.size(); ++lane) {
+            lockstep->seed(lane, jobs[lane]->seed);
+        }
+        lockstep->run(max_instructions_, max_frames_);
+
+        for (size_t lane = 0; lane < jobs.size(); ++lane) {
+            auto stats = lockstep->laneStats(lane);
+            lines[lane] << " instructions=" << stats.instructions << " wait_cycles=" << stats.wait_cycles
+                        << " frames=" << stats.frames << " frame_hash=" << std::hex << std::setfill('0')
+                        << std::setw(16) << lockstep->frameHash(lane) << std::dec << " ";
+            lockstep->dumpRegisters(lane, lines[lane]);
+        }
+    } catch (const std::exception &err) {
+        for (auto &line : lines) {
+            line << " error=" << err.what();
+        }
+        ok = false;
+    }
+
+    for (auto &line : lines) {
+        line << "\n";
+        writeResult(line.str(), ok, out);
+    }
+}
+
+void BatchRunner::writeResult(const std::string &line, bool ok, std::ostream &out) {
+    std::lock_guard<std::mutex> lock(out_mutex_);
+    if (!ok) {
+        ++failed_;
+    }
+    out << line << std::flush;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "Chip8.hpp"
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*
+ * Runs many headless Chip8 instances on a work-stealing thread pool.
+ *
+ * Each job is one rom with one seed, run until the instruction or frame budget is reached. Every rom
+ * is read once and shared by its jobs. A result line is written as soon as its job finishes, so the
+ * lines come out in completion order (the job id tells them apart).
+ *
+ * In lockstep mode, the jobs of a rom are run Chip8Lockstep::kLanes at a time by a Chip8Lockstep
+ * instead of one Chip8 each. The results are the same.
+ */
+class BatchRunner {
+public:
+    struct Job {
+        uint64_t id;
+        std::string path;
+        uint32_t seed;
+    };
+
+    /**
+     * @param engine execution engine of every instance
+     * @param timing clock of every instance. Lockstep lanes take one cycle per instruction: only
+     *               timing.cycles_per_frame applies to them (throws Chip8::Chip8Exception on other costs)
+     * @param max_instructions per job instruction budget (0 = no limit)
+     * @param max_frames per job frame budget (0 = no limit)
+     * @param threads number of workers (0 = one per hardware thread)
+     * @param lockstep runs the jobs on Chip8Lockstep lanes (engine is then ignored)
+     */
+    BatchRunner(Chip8::Engine engine, const Chip8::Timing &timing, uint64_t max_instructions, uint64_t max_frames,
+                size_t threads, bool lockstep = false);
+    virtual ~BatchRunner() {}
+
+    // Builds one job per rom and seed (seeds 0 to seeds - 1)
+    static std::vector<Job> makeJobs(const std::vector<std::string> &paths, uint32_t seeds);
+
+    /** Runs every job and streams one result line per job to out
+     *
+     * Returns the number of failed jobs. Throws Chip8::Chip8Exception if a rom cannot be read.
+     */
+    uint64_t run(const std::vector<Job> &jobs, std::ostream &out);
+
+private:
+    void runJob(const Job &job, const std::vector<uint8_t> &rom, std::ostream &out);
+    void runLockstepJobs(const std::vector<const Job *> &jobs, const std::vector<uint8_t> &rom, std::ostream &out);
+    void writeResult(const std::string &line, bool ok, std::ostream &out);
+
+    Chip8::Engine engine_;
+    Chip8::Timing timing_;
+    uint64_t max_instructions_;
+    uint64_t max_frames_;
+    size_t threads_;
+    bool lockstep_;
+    // Serializes the result lines
+    std::mutex out_mutex_;
+    uint64_t failed_;
+};
@@ -1,79 +1,126 @@
 #include "Chip8.hpp"
+#include "Chip8Jit.hpp"
+#include "Chip8Quirks.hpp"
 
 #include <cstring>
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <fstream>
 #include <filesystem>
+#include <iomanip>
 #include <iostream>
 #include <thread>
 #include <random>
+#include <type_traits>
 #include <SDL2/SDL.h>
 
 using namespace std::chrono_literals;
 
-static const std::map<char, uint8_t> keyboardToChip8Map = {
-    {'1', 0x01},
-    {'2', 0x02},
-    {'3', 0x03},
-    {'4', 0x0C},
-    {'Q', 0x04},
-    {'W', 0x05},
-    {'E', 0x06},
-    {'R', 0x0D},
-    {'A', 0x07},
-    {'S', 0x08},
-    {'D', 0x09},
-    {'F', 0x0E},
-    {'Z', 0x0A},
-    {'X', 0x00},
-    {'C', 0x0B},
-    {'V', 0x0F}
-};
+static_assert(std::is_trivially_copyable<Xoshiro256>::value, "Save states copy the generator as bytes");
+
+/*
+ * Hex sprites (0 - F). Programs may use these sprites as their font.
+ * However, in practice, most games implement their own font.
+ * They must be stored in the first 512 bytes of the memory.
+ */
+const uint8_t Chip8::kHexSprites[] = {0xF0, 0x90, 0x90, 0x90, 0xF0,    // 0
+                                      0x20, 0x60, 0x20, 0x20, 0x70,    // 1
+                                      0xF0, 0x10, 0xF0, 0x80, 0xF0,    // 2
+                                      0xF0, 0x10, 0xF0, 0x10, 0xF0,    // 3
+                                      0x90, 0x90, 0xF0, 0x10, 0x10,    // 4
+                                      0xF0, 0x80, 0xF0, 0x10, 0xF0,    // 5
+                                      0xF0, 0x80, 0xF0, 0x90, 0xF0,    // 6
+                                      0xF0, 0x10, 0x20, 0x40, 0x40,    // 7
+                                      0xF0, 0x90, 0xF0, 0x90, 0xF0,    // 8
+                                      0xF0, 0x90, 0xF0, 0x10, 0xF0,    // 9
+                                      0xF0, 0x90, 0xF0, 0x90, 0x90,    // A
+                                      0xE0, 0x90, 0xE0, 0x90, 0xE0,    // B
+                                      0xF0, 0x80, 0x80, 0x80, 0xF0,    // C
+                                      0xE0, 0x90, 0x90, 0x90, 0xE0,    // D
+                                      0xF0, 0x80, 0xF0, 0x80, 0xF0,    // E
+                                      0xF0, 0x80, 0xF0, 0x80, 0x80};   // F
+
+// Big hex sprites (0 - F) of SUPER-CHIP (digits only) and XO-CHIP, 8 x 10 pixels
+const uint8_t Chip8::kBigHexSprites[] = {0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF,    // 0
+                                         0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF,    // 1
+                                         0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF,    // 2
+                                         0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF,    // 3
+                                         0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03,    // 4
+                                         0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF,    // 5
+                                         0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF,    // 6
+                                         0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18,    // 7
+                                         0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF,    // 8
+                                         0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF,    // 9
+                                         0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3,    // A
+                                         0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC,    // B
+                                         0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C,    // C
+                                         0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC,    // D
+                                         0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF,    // E
+                                         0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0};   // F
 
 Chip8::Chip8(size_t memory_start_offset, const std::shared_ptr<IDisplay> &display, const std::shared_ptr<IKeyboard> &keyboard) : 
+    mode_(Mode::kChip8),
+    quirks_(Quirks::kModern),
+    memory_mask_(kMemorySize - 1),
+    engine_(Engine::kSwitch),
+    cycles_per_frame_(kInstructionsPerFrame),
+    unit_costs_(true),
+    idle_loop_skip_(true),
+    waiting_for_key_(false),
+    wait_key_register_(0),
+    halted_(false),
+    instructions_(0),
+    rom_hash_(0),
+    keys_(0),
+    key_events_head_(0),
+    key_events_count_(0),
+    recording_(nullptr),
+    profiler_(nullptr),
+    trace_(nullptr),
     memory_start_offset_(memory_start_offset),
     display_(display),
     keyboard_(keyboard) {
-    std::memset(memory_, 0, kMemorySize * sizeof(uint8_t));
-    /*
-     * Hex sprites (0 - F). Programs may use these sprites as their font.
-     * However, in practice, most games implement their own font.
-     * They must be stored in the first 512 bytes of the memory.
-     */ 
-const uint8_t hex_sprites[] = {0xF0, 0x90, 0x90, 0x90, 0xF0,    // 0
-                               0x20, 0x60, 0x20, 0x20, 0x70,    // 1
-                               0xF0, 0x10, 0xF0, 0x80, 0xF0,    // 2
-                               0xF0, 0x10, 0xF0, 0x10, 0xF0,    // 3
-                               0x90, 0x90, 0xF0, 0x10, 0x10,    // 4
-                               0xF0, 0x80, 0xF0, 0x10, 0xF0,    // 5
-                               0xF0, 0x80, 0xF0, 0x90, 0xF0,    // 6
-                               0xF0, 0x10, 0x20, 0x40, 0x40,    // 7
-                               0xF0, 0x90, 0xF0, 0x90, 0xF0,    // 8
-                               0xF0, 0x90, 0xF0, 0x10, 0xF0,    // 9
-                               0xF0, 0x90, 0xF0, 0x90, 0x90,    // A
-                               0xE0, 0x90, 0xE0, 0x90, 0xE0,    // B
-                               0xF0, 0x80, 0x80, 0x80, 0xF0,    // C
-                               0xE0, 0x90, 0x90, 0x90, 0xE0,    // D
-                               0xF0, 0x80, 0xF0, 0x80, 0xF0,    // E
-                               0xF0, 0x80, 0xF0, 0x80, 0x80};   // F
-    // Data initialization                                   
-    std::memcpy(&memory_[kSpritesMemLocation], hex_sprites, sizeof(hex_sprites));
+    std::memset(memory_, 0, sizeof(memory_));
+    // Data initialization
+    std::memcpy(&memory_[kSpritesMemLocation], kHexSprites, sizeof(kHexSprites));
+    std::memset(decoded_, 0, sizeof(decoded_));
+    dirty_pages_.set();
     std::memset(screen_buffer_, 0, sizeof(screen_buffer_));
+    // The first frame is always rendered in full
+    dirty_rows_ = ~0ULL;
+    hires_ = false;
+    planes_ = 0x01;
+    std::memset(flags_, 0, sizeof(flags_));
+    std::memset(audio_pattern_, 0, sizeof(audio_pattern_));
+    pitch_ = 64;
     std::memset(&reg_.V[0], 0, sizeof(reg_.V));
     reg_.I = 0;
     reg_.PC = 0;
     reg_.SP = 0;
+    std::memset(reg_.stack, 0, sizeof(reg_.stack));
     reg_.DT = 0;
     reg_.ST = 0;
+    cycle_costs_.fill(1);
+
+    std::random_device device;
+    seed((static_cast<uint64_t>(device()) << 32) | device());
 }
 
 Chip8::Chip8(const std::shared_ptr<IDisplay> &display, const std::shared_ptr<IKeyboard> &keyboard) : 
     Chip8(kMemoryStartOffsetDefault, display, keyboard) {}
 
+Chip8::~Chip8() {}
+
 void Chip8::load(const std::string &path) {
     std::cout << "Loading " << path << "\n";
+    auto rom = readRom(path);
+    loadRom(rom);
+    std::cout << rom.size() << " bytes loaded successfully\n";
+}
 
+std::vector<uint8_t> Chip8::readRom(const std::string &path) {
     std::ifstream f;
     f.open(path.c_str(), (std::ios::in | std::ios::binary));
 
@@ -85,38 +132,1152 @@ void Chip8::load(const std::string &path) {
     std::filesystem::path file_path = path;
     auto file_size = std::filesystem::file_size(file_path);
 
-    if (file_size > kMemorySize - kMemoryStartOffsetDefault) {
+    // The largest memory: loadRom() checks the size against the memory of the mode
+    if (file_size > kXoMemorySize - kMemoryStartOffsetDefault) {
         throw Chip8Exception("File too large: " + std::to_string(file_size) +  " bytes");
     }
 
-    reg_.PC = memory_start_offset_;
-    f.read((char*)&memory_[memory_start_offset_], file_size);
-    std::cout << file_size << " bytes loaded successfully\n";
+    std::vector<uint8_t> rom(file_size);
+    f.read(reinterpret_cast<char*>(rom.data()), file_size);
     f.close();
+
+    return rom;
+}
+
+void Chip8::loadRom(const std::vector<uint8_t> &rom) {
+    if (rom.size() > memory_mask_ + 1u - memory_start_offset_) {
+        throw Chip8Exception("File too large: " + std::to_string(rom.size()) +  " bytes");
+    }
+
+    reg_.PC = memory_start_offset_;
+    std::memcpy(&memory_[memory_start_offset_], rom.data(), rom.size());
+    dirty_pages_.set();
+    instructions_ = 0;
+    halted_ = false;
+    // FNV-1a, so a movie can tell which rom it was recorded on
+    rom_hash_ = 0xCBF29CE484222325ULL;
+    for (auto byte : rom) {
+        rom_hash_ ^= byte;
+        rom_hash_ *= 0x100000001B3ULL;
+    }
+    // Drop every predecoded instruction: the whole program changed
+    std::memset(decoded_, 0, sizeof(decoded_));
+    if (jit_) {
+        jit_->flush();
+    }
+}
+
+void Chip8::setMode(Mode mode) {
+    mode_ = mode;
+    memory_mask_ = static_cast<uint16_t>((mode_ == Mode::kXoChip ? kXoMemorySize : kMemorySize) - 1);
+    if (mode_ == Mode::kChip8) {
+        std::memset(&memory_[kBigSpritesMemLocation], 0, sizeof(kBigHexSprites));
+    } else {
+        std::memcpy(&memory_[kBigSpritesMemLocation], kBigHexSprites, sizeof(kBigHexSprites));
+    }
+    dirty_pages_.set();
+    quirks_ = defaultQuirks(mode_);
+    // Addresses of the profile and the trace follow the memory size
+    if (profiler_) {
+        profiler_->setMemorySize(memory_mask_ + 1u);
+    }
+    if (trace_) {
+        trace_->setAddressMask(memory_mask_);
+    }
+    // Decoding depends on the mode and the quirks
+    std::memset(decoded_, 0, sizeof(decoded_));
+    if (jit_) {
+        jit_->flush();
+    }
+
+    hires_ = false;
+    planes_ = 0x01;
+    std::memset(screen_buffer_, 0, sizeof(screen_buffer_));
+    dirty_rows_ = ~0ULL;
+    publishAudioPattern();
+}
+
+Chip8::Mode Chip8::mode(void) const {
+    return mode_;
+}
+
+void Chip8::setQuirks(Quirks quirks) {
+    quirks_ = quirks;
+    std::memset(decoded_, 0, sizeof(decoded_));
+    if (jit_) {
+        jit_->flush();
+    }
+}
+
+Chip8::Quirks Chip8::quirks(void) const {
+    return quirks_;
+}
+
+Chip8::Quirks Chip8::defaultQuirks(Mode mode) {
+    return mode == Mode::kSuperChip ? Quirks::kSuperChip : Quirks::kModern;
+}
+
+const char *Chip8::name(Mode mode) {
+    switch (mode) {
+        case Mode::kSuperChip:
+            return "schip";
+        case Mode::kXoChip:
+            return "xochip";
+        case Mode::kChip8:
+        default:
+            return "chip8";
+    }
+}
+
+const char *Chip8::name(Quirks quirks) {
+    switch (quirks) {
+        case Quirks::kCosmacVip:
+            return "vip";
+        case Quirks::kSuperChip:
+            return "schip";
+        case Quirks::kModern:
+        default:
+            return "modern";
+    }
+}
+
+uint32_t Chip8::displayWidth(void) const {
+    return hires_ ? kHiresWidth : kDisplayWidth;
+}
+
+uint32_t Chip8::displayHeight(void) const {
+    return hires_ ? kHiresHeight : kDisplayHeight;
+}
+
+uint32_t Chip8::rowWords(void) const {
+    return displayWidth() / 64;
+}
+
+uint32_t Chip8::planeWords(void) const {
+    return rowWords() * displayHeight();
+}
+
+void Chip8::seed(uint64_t value) {
+    seed_ = value;
+    rng_.seed(value);
+}
+
+uint64_t Chip8::frameHash(void) const {
+    // Only the planes the mode can draw on, so a lo-res CHIP-8 frame hashes as on the other cores
+    return hashFrame(screen_buffer_, planeWords() * (mode_ == Mode::kXoChip ? kPlanes : 1));
+}
+
+uint64_t Chip8::instructionCount(void) const {
+    return instructions_;
+}
+
+bool Chip8::halted(void) const {
+    return halted_;
+}
+
+uint64_t Chip8::hashFrame(const uint64_t *screen_rows) {
+    return hashFrame(screen_rows, kDisplayHeight);
+}
+
+uint64_t Chip8::hashFrame(const uint64_t *words, size_t count) {
+    // FNV-1a over the packed rows
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < count; ++i) {
+        for (size_t byte = 0; byte < sizeof(uint64_t); ++byte) {
+            hash ^= (words[i] >> (byte * 8)) & 0xFF;
+            hash *= 0x100000001B3ULL;
+        }
+    }
+    return hash;
+}
+
+Chip8::Snapshot Chip8::snapshot(void) {
+    // Only the pages written since the last snapshot / restore need a new copy
+    size_t page_count = (memory_mask_ + 1u) / kPageSize;
+    for (size_t page = 0; page < page_count; ++page) {
+        if (dirty_pages_.test(page)) {
+            auto copy = std::make_shared<Page>();
+            std::memcpy(copy->data(), &memory_[page * kPageSize], kPageSize);
+            pages_[page] = std::move(copy);
+        }
+    }
+    dirty_pages_.reset();
+
+    Snapshot state;
+    state.reg_ = reg_;
+    state.pages_ = pages_;
+    std::memcpy(state.screen_buffer_, screen_buffer_, sizeof(screen_buffer_));
+    state.hires_ = hires_;
+    state.planes_ = planes_;
+    std::memcpy(state.flags_, flags_, sizeof(flags_));
+    std::memcpy(state.audio_pattern_, audio_pattern_, sizeof(audio_pattern_));
+    state.pitch_ = pitch_;
+    state.waiting_for_key_ = waiting_for_key_;
+    state.wait_key_register_ = wait_key_register_;
+    state.halted_ = halted_;
+    state.rng_ = rng_;
+    return state;
+}
+
+void Chip8::restore(const Snapshot &state) {
+    size_t page_count = (memory_mask_ + 1u) / kPageSize;
+    for (size_t page = 0; page < page_count; ++page) {
+        // Same page and not written since: memory_ already holds it
+        if (pages_[page] == state.pages_[page] && !dirty_pages_.test(page)) {
+            continue;
+        }
+        restoreMemory(static_cast<uint16_t>(page * kPageSize), state.pages_[page]->data(), kPageSize);
+        pages_[page] = state.pages_[page];
+    }
+    // memory_ now matches the pages of the snapshot
+    dirty_pages_.reset();
+
+    reg_ = state.reg_;
+    restoreScreen(state.screen_buffer_, state.hires_);
+    planes_ = state.planes_;
+    std::memcpy(flags_, state.flags_, sizeof(flags_));
+    std::memcpy(audio_pattern_, state.audio_pattern_, sizeof(audio_pattern_));
+    pitch_ = state.pitch_;
+    publishAudioPattern();
+    waiting_for_key_ = state.waiting_for_key_;
+    wait_key_register_ = state.wait_key_register_;
+    halted_ = state.halted_;
+    rng_ = state.rng_;
+}
+
+void Chip8::restoreMemory(uint16_t address, const uint8_t *source, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        if (memory_[address + i] != source[i]) {
+            // Also drops the decoded instruction and JIT block, and marks the page dirty
+            writeMemory(static_cast<uint16_t>(address + i), source[i]);
+        }
+    }
+}
+
+void Chip8::restoreScreen(const uint64_t *screen_words, bool hires) {
+    if (hires != hires_) {
+        // Another resolution, every row is new
+        hires_ = hires;
+        dirty_rows_ = ~0ULL;
+    } else {
+        auto row_words = rowWords();
+        auto plane_words = planeWords();
+        for (size_t i = 0; i < kPlanes * plane_words; ++i) {
+            if (screen_buffer_[i] != screen_words[i]) {
+                dirty_rows_ |= 1ULL << ((i % plane_words) / row_words);
+            }
+        }
+    }
+    std::memcpy(screen_buffer_, screen_words, sizeof(screen_buffer_));
+}
+
+void Chip8::saveState(std::vector<uint8_t> *state) const {
+    auto put = [state](const void *data, size_t size) {
+        auto bytes = static_cast<const uint8_t *>(data);
+        state->insert(state->end(), bytes, bytes + size);
+    };
+    state->clear();
+    put(memory_, memory_mask_ + 1u);
+    put(screen_buffer_, sizeof(screen_buffer_));
+    put(&hires_, sizeof(hires_));
+    put(&planes_, sizeof(planes_));
+    put(flags_, sizeof(flags_));
+    put(audio_pattern_, sizeof(audio_pattern_));
+    put(&pitch_, sizeof(pitch_));
+    put(reg_.V, sizeof(reg_.V));
+    put(&reg_.I, sizeof(reg_.I));
+    put(&reg_.PC, sizeof(reg_.PC));
+    put(&reg_.SP, sizeof(reg_.SP));
+    put(&reg_.DT, sizeof(reg_.DT));
+    put(&reg_.ST, sizeof(reg_.ST));
+    put(&waiting_for_key_, sizeof(waiting_for_key_));
+    put(&wait_key_register_, sizeof(wait_key_register_));
+    put(&halted_, sizeof(halted_));
+    put(&rng_, sizeof(rng_));
+    put(reg_.stack, sizeof(reg_.stack));
+}
+
+void Chip8::loadState(const std::vector<uint8_t> &state) {
+    // Only the memory of the mode is saved
+    constexpr size_t kFixedSize = sizeof(screen_buffer_) + sizeof(hires_) + sizeof(planes_) + sizeof(flags_) +
+                                  sizeof(audio_pattern_) + sizeof(pitch_) + sizeof(reg_.V) + sizeof(reg_.I) +
+                                  sizeof(reg_.PC) + sizeof(reg_.SP) + sizeof(reg_.DT) + sizeof(reg_.ST) +
+                                  sizeof(waiting_for_key_) + sizeof(wait_key_register_) + sizeof(halted_) +
+                                  sizeof(rng_) + sizeof(reg_.stack);
+    size_t memory_size = memory_mask_ + 1u;
+    if (state.size() != memory_size + kFixedSize) {
+        throw Chip8Exception("Invalid save state: " + std::to_string(state.size()) + " bytes");
+    }
+
+    const uint8_t *data = state.data();
+    auto get = [&data](void *out, size_t size) {
+        std::memcpy(out, data, size);
+        data += size;
+    };
+    // The pages that did not change still match the last snapshot
+    restoreMemory(0, data, memory_size);
+    data += memory_size;
+    uint64_t screen_words[kPlanes * kPlaneWords];
+    get(screen_words, sizeof(screen_words));
+    bool hires;
+    get(&hires, sizeof(hires));
+    restoreScreen(screen_words, hires);
+    get(&planes_, sizeof(planes_));
+    get(flags_, sizeof(flags_));
+    get(audio_pattern_, sizeof(audio_pattern_));
+    get(&pitch_, sizeof(pitch_));
+    publishAudioPattern();
+    get(reg_.V, sizeof(reg_.V));
+    get(&reg_.I, sizeof(reg_.I));
+    get(&reg_.PC, sizeof(reg_.PC));
+    get(&reg_.SP, sizeof(reg_.SP));
+    get(&reg_.DT, sizeof(reg_.DT));
+    get(&reg_.ST, sizeof(reg_.ST));
+    get(&waiting_for_key_, sizeof(waiting_for_key_));
+    get(&wait_key_register_, sizeof(wait_key_register_));
+    get(&halted_, sizeof(halted_));
+    get(&rng_, sizeof(rng_));
+    get(reg_.stack, sizeof(reg_.stack));
+}
+
+void Chip8::enableRewind(size_t capacity_bytes) {
+    rewind_ = std::make_unique<RewindBuffer>(capacity_bytes);
+}
+
+const RewindBuffer *Chip8::rewindBuffer(void) const {
+    return rewind_.get();
+}
+
+bool Chip8::rewind(size_t frames) {
+    if (!rewind_ || !rewind_->rewind(frames, &rewind_state_)) {
+        return false;
+    }
+    loadState(rewind_state_);
+    render();
+    return true;
+}
+
+void Chip8::record(Movie *movie) {
+    if (instructions_) {
+        throw Chip8Exception("Recording must start right after the rom is loaded");
+    }
+    movie->setSeed(seed_);
+    movie->setRomHash(rom_hash_);
+    movie->setMode(name(mode_));
+    movie->setQuirks(name(quirks_));
+    recording_ = movie;
+}
+
+void Chip8::stopRecording(void) {
+    if (recording_) {
+        recording_->setEnd(instructions_);
+        recording_ = nullptr;
+    }
+}
+
+void Chip8::setProfiler(Profiler *profiler) {
+    profiler_ = profiler;
+    if (profiler_) {
+        profiler_->setMemorySize(memory_mask_ + 1u);
+    }
+}
+
+void Chip8::setTrace(TraceBuffer *trace) {
+    trace_ = trace;
+    if (trace_) {
+        trace_->setAddressMask(memory_mask_);
+    }
+}
+
+void Chip8::setAudio(const std::shared_ptr<IAudio> &audio) {
+    audio_ = audio;
+    publishAudioPattern();
+}
+
+Chip8::RunStats Chip8::replay(const Movie &movie) {
+    if (movie.romHash() != rom_hash_) {
+        throw Chip8Exception("Movie recorded on another rom");
+    }
+    // Another machine would run the same input differently
+    if (movie.mode() != name(mode_)) {
+        throw Chip8Exception("Movie recorded in " + movie.mode() + " mode, the machine runs in " + name(mode_) +
+                             " mode");
+    }
+    if (movie.quirks() != name(quirks_)) {
+        throw Chip8Exception("Movie recorded with " + movie.quirks() + " quirks, the machine has " +
+                             name(quirks_) + " quirks");
+    }
+    if (instructions_) {
+        throw Chip8Exception("Replay must start right after the rom is loaded");
+    }
+
+    RunStats stats = {};
+    auto start_time = std::chrono::steady_clock::now();
+    seed(movie.seed());
+
+    // Runs without any input change up to the instruction of the next event
+    auto runTo = [this, &stats](uint64_t instruction) {
+        while (instructions_ < instruction) {
+            if (waiting_for_key_) {
+                throw Chip8Exception("Movie out of sync: parked on Fx0A at instruction " +
+                                     std::to_string(instructions_));
+            }
+            if (halted_) {
+                throw Chip8Exception("Movie out of sync: halted on 00FD at instruction " +
+                                     std::to_string(instructions_));
+            }
+            auto executed = execute(instruction - instructions_);
+            stats.instructions += executed;
+            instructions_ += executed;
+        }
+    };
+
+    // Same order as run(): the input is latched before the instruction, Fx0A resumes right after the latch
+    for (const auto &event : movie.events()) {
+        runTo(event.instruction);
+        if (event.type == Movie::Event::Type::kTick) {
+            tick();
+            ++stats.frames;
+        } else {
+            keys_ = event.keys;
+            if (event.has_edge) {
+                queueKeyEvent(event.edge);
+            }
+        }
+        if (waiting_for_key_) {
+            resumeWaitForKey();
+        }
+    }
+    runTo(movie.end());
+
+    stats.wall_time_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    return stats;
+}
+
+void Chip8::dumpRegisters(std::ostream &out) const {
+    auto flags = out.flags();
+    auto fill = out.fill();
+
+    out << std::hex << std::uppercase << std::setfill('0') << "V=";
+    for (size_t i = 0; i < sizeof(reg_.V); ++i) {
+        out << std::setw(2) << int(reg_.V[i]);
+    }
+    out << " I=" << std::setw(3) << reg_.I << " PC=" << std::setw(3) << reg_.PC
+        << " DT=" << std::setw(2) << int(reg_.DT) << " ST=" << std::setw(2) << int(reg_.ST);
+
+    out.flags(flags);
+    out.fill(fill);
 }
 
-void Chip8::run(void) {
+Chip8::RunStats Chip8::run(void) {
+    const auto frame_period = std::chrono::microseconds(kCpuPeriodUs);
+    RunStats stats = {};
     auto start_time = std::chrono::steady_clock::now();
+    auto next_frame = start_time;
+    // Cycles the last instruction of a frame took from the next one
+    uint64_t frame_cycles = 0;
+
+    // 00FD ends the session after the frame it ran in
+    while (!keyboard_->quitClicked() && !halted_) {
+        // While the rewind key is held, the CPU stops and the history plays backwards, one frame per tick.
+        // A movie cannot go back in time, so there is no rewind while recording.
+        if (rewind_ && !recording_ && keyboard_->rewindHeld()) {
+            rewind(1);
+        } else {
+            // Parked on Fx0A, the rest of the frame is spent waiting (until a key edge wakes the sleep below)
+            while (frame_cycles < cycles_per_frame_ && !halted_) {
+                frame_cycles += runCycles(cycles_per_frame_ - frame_cycles, &stats);
+            }
+            frame_cycles -= cycles_per_frame_;
+            tick();
+            ++stats.frames;
+        }
+
+        // A single sleep per frame. The keyboard wakes us up early on a quit request, so shutdown does not wait.
+        next_frame += frame_period;
+        auto now = std::chrono::steady_clock::now();
+        while (now < next_frame && !keyboard_->quitClicked()) {
+            bool woken = keyboard_->waitForEvent(next_frame);
+            now = std::chrono::steady_clock::now();
+            if (woken && waiting_for_key_ && now < next_frame) {
+                // Parked on Fx0A: a key edge resumes the program right away, for the share of the frame left
+                pollInput();
+                resumeWaitForKey();
+                uint64_t cycles = (next_frame - now) * cycles_per_frame_ / frame_period;
+                if (!waiting_for_key_ && cycles) {
+                    // The frame that parked counted them as waited
+                    stats.wait_cycles -= std::min(stats.wait_cycles, cycles);
+                    runCycles(cycles, &stats);
+                }
+            }
+        }
+
+        // Behind schedule: the next frames run back to back until we catch up, unless we are so late (suspended
+        // host, debugger) that replaying every missed frame would fast-forward the program
+        if (now - next_frame > kMaxCatchUpFrames * frame_period) {
+            auto missed = (now - next_frame) / frame_period;
+            stats.skipped_frames += missed;
+            next_frame += missed * frame_period;
+        }
+    }
+
+    stats.wall_time_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    return stats;
+}
+
+Chip8::RunStats Chip8::runHeadless(uint64_t max_instructions, uint64_t max_frames) {
+    RunStats stats = {};
+    auto start_time = std::chrono::steady_clock::now();
+    // Cycles elapsed, executed or parked on Fx0A, in total and in the current frame
+    uint64_t cycles = 0;
+    uint64_t frame_cycles = 0;
+
+    while ((!max_instructions || cycles < max_instructions) &&
+           (!max_frames || stats.frames < max_frames) && !halted_) {
+        // Run up to the next frame boundary in a single batch
+        auto count = cycles_per_frame_ - frame_cycles;
+        if (max_instructions && count > max_instructions - cycles) {
+            count = max_instructions - cycles;
+        }
+
+        auto elapsed = runCycles(count, &stats);
+        cycles += elapsed;
+        frame_cycles += elapsed;
 
-    while (!keyboard_->quitClicked()) {
-        auto start_refresh_delay = std::chrono::steady_clock::now();
+        // Virtual 60 Hz refresh: no wall clock involved, so the run is as fast as the host allows
+        bool quit = false;
+        while (frame_cycles >= cycles_per_frame_ && !quit) {
+            frame_cycles -= cycles_per_frame_;
+            tick();
+            ++stats.frames;
+            quit = keyboard_->quitClicked();
+        }
+        if (quit) {
+            break;
+        }
+        // 00FD: as in run(), the frame it ran in is the last one
+        if (halted_ && frame_cycles) {
+            tick();
+            ++stats.frames;
+        }
+    }
+
+    stats.wall_time_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    return stats;
+}
+
+uint64_t Chip8::runCycles(uint64_t cycles, RunStats *stats) {
+    pollInput();
+    if (waiting_for_key_) {
+        resumeWaitForKey();
+    }
+
+    if (waiting_for_key_) {
+        // Still parked: skip the rest of the frame
+        stats->wait_cycles += cycles;
+        return cycles;
+    }
+
+    uint64_t spent = 0;
+    auto executed = skipIdleLoop(cycles, &spent);
+    if (executed) {
+        ++stats->idle_hits;
+    }
+    if (spent < cycles) {
+        uint64_t batch_spent = 0;
+        executed += executeCycles(cycles - spent, &batch_spent);
+        spent += batch_spent;
+    }
+    stats->instructions += executed;
+    instructions_ += executed;
+    return spent;
+}
+
+uint64_t Chip8::skipIdleLoop(uint64_t cycles, uint64_t *spent) {
+    *spent = 0;
+    // A profile or a trace shows the busy-waits as they are
+    if (!idle_loop_skip_ || profiler_ || trace_) {
+        return 0;
+    }
+
+    // PC may be on any of the 3 instructions of the loop
+    for (uint16_t offset = 0; offset <= 4; offset += 2) {
+        uint16_t head = (reg_.PC - offset) & memory_mask_;
+        auto get_dt = readOpcode(head);
+        auto skip_eq = readOpcode(head + 2);
+        auto jump = readOpcode(head + 4);
+        uint8_t x = (get_dt >> 8) & 0x0F;
+        uint8_t kk = skip_eq & 0xFF;
+        if ((get_dt & 0xF0FF) != 0xF007 || (skip_eq & 0xFF00) != (0x3000 | (x << 8)) ||
+            jump != (0x1000 | head)) {
+            continue;
+        }
+
+        // DT only changes on ticks, between frames: until then, Vx = DT never matches kk.
+        // Starting on the 3xkk, the Vx left by an earlier instruction must not match either.
+        if (reg_.DT == kk || (offset == 2 && reg_.V[x] == kk)) {
+            return 0;
+        }
+
+        uint64_t cost = cycle_costs_[0xF] + cycle_costs_[0x3] + cycle_costs_[0x1];
+        uint64_t iterations = cycles / cost;
+        if (!iterations) {
+            return 0;
+        }
+        // Every iteration ends where it started, the only state it leaves behind is Vx
+        reg_.V[x] = reg_.DT;
+        *spent = iterations * cost;
+        return iterations * 3;
+    }
+    return 0;
+}
+
+uint64_t Chip8::executeCycles(uint64_t cycles, uint64_t *spent) {
+    if (unit_costs_) {
+        *spent = execute(cycles);
+        return *spent;
+    }
+
+    // The cost depends on the instruction, so they run one at a time
+    uint64_t executed = 0;
+    *spent = 0;
+    while (*spent < cycles && !waiting_for_key_ && !halted_) {
+        *spent += cycle_costs_[readMemory(reg_.PC) >> 4];
+        executed += execute(1);
+    }
+    return executed;
+}
+
+void Chip8::setCyclesPerFrame(uint64_t cycles) {
+    if (!cycles) {
+        throw Chip8Exception("A frame needs at least one cycle");
+    }
+    cycles_per_frame_ = cycles;
+}
+
+void Chip8::setIdleLoopSkip(bool enabled) {
+    idle_loop_skip_ = enabled;
+}
+
+void Chip8::setCycleCosts(const std::array<uint8_t, 16> &costs) {
+    unit_costs_ = true;
+    for (auto cost : costs) {
+        if (!cost) {
+            throw Chip8Exception("Instruction costs must be at least 1 cycle");
+        }
+        unit_costs_ = unit_costs_ && cost == 1;
+    }
+    cycle_costs_ = costs;
+}
+
+void Chip8::setTiming(const Timing &timing) {
+    setCyclesPerFrame(timing.cycles_per_frame);
+    setCycleCosts(timing.costs);
+    setIdleLoopSkip(timing.idle_loop_skip);
+}
+
+bool Chip8::Timing::unitCosts(void) const {
+    return std::all_of(costs.begin(), costs.end(), [](uint8_t cost) { return cost == 1; });
+}
+
+void Chip8::setEngine(Engine engine) {
+    engine_ = engine;
+    if (engine_ == Engine::kJit && !jit_) {
+        jit_ = std::make_unique<Chip8Jit>();
+    }
+}
+
+uint64_t Chip8::execute(uint64_t count) {
+    if (profiler_ || trace_) {
+        return executeInstrumented(count);
+    }
+    // Only the switch interpreter knows the COSMAC VIP quirks and XO-CHIP
+    if (engine_ == Engine::kSwitch || mode_ == Mode::kXoChip || quirks_ == Quirks::kCosmacVip) {
+        switch (quirks_) {
+            case Quirks::kCosmacVip:
+                return executeSwitch<CosmacVipQuirks>(count);
+            case Quirks::kSuperChip:
+                return executeSwitch<SuperChipQuirks>(count);
+            case Quirks::kModern:
+            default:
+                return executeSwitch<ModernQuirks>(count);
+        }
+    }
+
+    switch (engine_) {
+        case Engine::kPredecoded:
+            return executePredecoded(count);
+        case Engine::kThreaded:
+            return executeThreaded(count);
+        case Engine::kJit:
+        default:
+            return executeJit(count);
+    }
+}
+
+template <typename Policy>
+uint64_t Chip8::executeSwitch(uint64_t count) {
+    uint64_t i = 0;
+    for (; i < count && !waiting_for_key_ && !halted_; ++i) {
+        auto opcode = fetchInstruction();
+        decodeInstruction<Policy>(opcode);
+    }
+    return i;
+}
+
+uint64_t Chip8::executeInstrumented(uint64_t count) {
+    uint64_t i = 0;
+    for (; i < count && !waiting_for_key_ && !halted_; ++i) {
+        uint16_t address = reg_.PC & memory_mask_;
+        // Fx33 / Fx55 write at I before the instruction, the COSMAC VIP quirk then moves I past the registers
+        uint16_t start_i = reg_.I;
+        // Only the sampled instructions pay for the clock reads
+        bool timed = profiler_ && profiler_->sampleNext();
+        uint64_t start_ticks = timed ? Profiler::ticks() : 0;
         auto opcode = fetchInstruction();
         decodeInstruction(opcode);
+        if (timed) {
+            profiler_->recordTime(opcode, Profiler::ticks() - start_ticks);
+        }
+        if (trace_) {
+            bool store = (opcode & 0xF0FF) == 0xF033 || (opcode & 0xF0FF) == 0xF055;
+            trace_->record(address, opcode, store ? start_i : reg_.I, reg_.V[(opcode >> 8) & 0x000F]);
+        }
+        if (profiler_) {
+            profiler_->record(address, opcode);
+        }
+    }
+    return i;
+}
+
+uint64_t Chip8::executePredecoded(uint64_t count) {
+    uint64_t i = 0;
+    for (; i < count && !waiting_for_key_ && !halted_; ++i) {
+        const auto &op = decoded_[reg_.PC & (kMemorySize - 1)];
+        reg_.PC += 2;
+        kOpHandlers[op.kind](*this, op);
+    }
+    return i;
+}
+
+uint64_t Chip8::executeThreaded(uint64_t count) {
+#if defined(__GNUC__)
+    /*
+     * Direct-threaded dispatch: every handler ends with its own indirect jump to the next one, so the
+     * branch predictor sees one jump site per instruction kind instead of a single shared switch.
+     * Labels must follow the OpKind order.
+     */
+    static void *const kLabels[kOpCount] = {
+        &&op_undecoded, &&op_unknown, &&op_clear_screen, &&op_return, &&op_jump, &&op_call,
+        &&op_skip_if_equal, &&op_skip_if_not_equal, &&op_skip_if_vx_vy_equal, &&op_set_vx, &&op_add_to_vx,
+        &&op_set_vx_to_vy, &&op_or_vx_vy, &&op_and_vx_vy, &&op_xor_vx_vy, &&op_add_vx_vy, &&op_sub_vx_vy,
+        &&op_shift_right_vx, &&op_subn_vx_vy, &&op_shift_left_vx, &&op_skip_if_vx_vy_not_equal,
+        &&op_set_index, &&op_jump_to_addr_plus_v0, &&op_set_random, &&op_display_draw, &&op_skip_if_key,
+        &&op_skip_if_not_key, &&op_delay_timer_value, &&op_wait_for_key, &&op_set_delay_timer,
+        &&op_set_sound_timer, &&op_add_to_index, &&op_font_char, &&op_store_bcd, &&op_store_memory,
+        &&op_load_memory, &&op_nop, &&op_scroll_down, &&op_scroll_right, &&op_scroll_left, &&op_exit,
+        &&op_low_res, &&op_high_res, &&op_big_font_char, &&op_store_flags, &&op_load_flags,
+        &&op_jump_to_addr_plus_vx
+    };
+    const DecodedOp *op;
+    auto remaining = count;
+
+#define CHIP8_DISPATCH()                                  \
+    do {                                                  \
+        if (remaining-- == 0) {                           \
+            return count;                                 \
+        }                                                 \
+        op = &decoded_[reg_.PC & (kMemorySize - 1)];      \
+        reg_.PC += 2;                                     \
+        goto *kLabels[op->kind];                          \
+    } while (0)
+
+    CHIP8_DISPATCH();
+
+op_undecoded: {
+        uint16_t address = (reg_.PC - 2) & (kMemorySize - 1);
+        decoded_[address] = predecode(readOpcode(address), mode_, quirks_);
+        op = &decoded_[address];
+        goto *kLabels[op->kind];
+    }
+op_unknown:
+    kOpHandlers[kOpUnknown](*this, *op);
+    CHIP8_DISPATCH();
+op_clear_screen:
+    clearScreen();
+    CHIP8_DISPATCH();
+op_return:
+    returnFromSubroutine();
+    CHIP8_DISPATCH();
+op_jump:
+    jump(op->nnn);
+    CHIP8_DISPATCH();
+op_call:
+    callSubroutine(op->nnn);
+    CHIP8_DISPATCH();
+op_skip_if_equal:
+    skipIfEqual(op->x, op->kk);
+    CHIP8_DISPATCH();
+op_skip_if_not_equal:
+    skipIfNotEqual(op->x, op->kk);
+    CHIP8_DISPATCH();
+op_skip_if_vx_vy_equal:
+    skipNextIfVxVyEqual(op->x, op->y);
+    CHIP8_DISPATCH();
+op_set_vx:
+    setVxRegister(op->x, op->kk);
+    CHIP8_DISPATCH();
+op_add_to_vx:
+    addValueToVxRegister(op->x, op->kk);
+    CHIP8_DISPATCH();
+op_set_vx_to_vy:
+    setVxToVy(op->x, op->y);
+    CHIP8_DISPATCH();
+op_or_vx_vy:
+    orVxVy(op->x, op->y);
+    CHIP8_DISPATCH();
+op_and_vx_vy:
+    andVxVy(op->x, op->y);
+    CHIP8_DISPATCH();
+op_xor_vx_vy:
+    xorVxVy(op->x, op->y);
+    CHIP8_DISPATCH();
+op_add_vx_vy:
+    addVxVy(op->x, op->y);
+    CHIP8_DISPATCH();
+op_sub_vx_vy:
+    subVxVy(op->x, op->y);
+    CHIP8_DISPATCH();
+op_shift_right_vx:
+    shiftRightVx(op->x, op->x);
+    CHIP8_DISPATCH();
+op_subn_vx_vy:
+    subnVxVy(op->x, op->y);
+    CHIP8_DISPATCH();
+op_shift_left_vx:
+    shiftLeftVx(op->x, op->x);
+    CHIP8_DISPATCH();
+op_skip_if_vx_vy_not_equal:
+    skipNextIfVxVyNotEqual(op->x, op->y);
+    CHIP8_DISPATCH();
+op_set_index:
+    setIndexRegister(op->nnn);
+    CHIP8_DISPATCH();
+op_jump_to_addr_plus_v0:
+    jumpToAddrPlusV0(op->nnn);
+    CHIP8_DISPATCH();
+op_set_random:
+    setRandomByteToVx(op->x, op->kk);
+    CHIP8_DISPATCH();
+op_display_draw:
+    displayDraw(op->x, op->y, op->n);
+    CHIP8_DISPATCH();
+op_skip_if_key:
+    skipIfKey(op->x);
+    CHIP8_DISPATCH();
+op_skip_if_not_key:
+    skipIfNotKey(op->x);
+    CHIP8_DISPATCH();
+op_delay_timer_value:
+    setVxToDelayTimer(op->x);
+    CHIP8_DISPATCH();
+op_wait_for_key:
+    waitForKey(op->x);
+    if (waiting_for_key_) {
+        return count - remaining;
+    }
+    CHIP8_DISPATCH();
+op_set_delay_timer:
+    setDelayTimer(op->x);
+    CHIP8_DISPATCH();
+op_set_sound_timer:
+    setSoundTimer(op->x);
+    CHIP8_DISPATCH();
+op_add_to_index:
+    addVxToIndex(op->x);
+    CHIP8_DISPATCH();
+op_font_char:
+    setIndexToFontChar(op->x);
+    CHIP8_DISPATCH();
+op_store_bcd:
+    storeBcd(op->x);
+    CHIP8_DISPATCH();
+op_store_memory:
+    storeRegisters(op->x);
+    CHIP8_DISPATCH();
+op_load_memory:
+    loadRegisters(op->x);
+    CHIP8_DISPATCH();
+op_nop:
+    CHIP8_DISPATCH();
+op_scroll_down:
+    scrollDown(op->n);
+    CHIP8_DISPATCH();
+op_scroll_right:
+    scrollRight();
+    CHIP8_DISPATCH();
+op_scroll_left:
+    scrollLeft();
+    CHIP8_DISPATCH();
+op_exit:
+    exitInterpreter();
+    return count - remaining;
+op_low_res:
+    setHighRes(false);
+    CHIP8_DISPATCH();
+op_high_res:
+    setHighRes(true);
+    CHIP8_DISPATCH();
+op_big_font_char:
+    setIndexToBigFontChar(op->x);
+    CHIP8_DISPATCH();
+op_store_flags:
+    storeFlags(op->x);
+    CHIP8_DISPATCH();
+op_load_flags:
+    loadFlags(op->x);
+    CHIP8_DISPATCH();
+op_jump_to_addr_plus_vx:
+    jumpToAddrPlusVx(op->x, op->nnn);
+    CHIP8_DISPATCH();
 
-        // 60 Hz refresh rate
-        if (std::chrono::duration_cast<std::chrono::microseconds>(
-                std::chrono::steady_clock::now() - start_time).count() > kCpuPeriodUs) {
-            start_time = std::chrono::steady_clock::now();
-            display_->render(screen_buffer_);
-            runDelayTimer();
-            runSoundTimer();
+#undef CHIP8_DISPATCH
+#else
+    // No computed goto: fall back to the function-pointer table
+    return executePredecoded(count);
+#endif
+}
+
+uint64_t Chip8::executeJit(uint64_t count) {
+#if CHIP8_JIT
+    auto remaining = count;
+    while (remaining && !waiting_for_key_ && !halted_) {
+        auto block = jit_->lookup(*this, reg_.PC);
+        if (block) {
+            remaining -= block(reg_.V, &reg_.I, remaining, &reg_.PC, memory_);
+        } else {
+            // Timer, keyboard, draw, call... instructions go through the interpreter
+            executePredecoded(1);
+            --remaining;
         }
+    }
+    return count - remaining;
+#else
+    return executeThreaded(count);
+#endif
+}
 
-        // For now, we'll stick to 500 Hz CPU frequency.
-        // TODO: Tweak each instructions to take a more realistic time based on the original HW:
-        // https://jackson-s.me/2019/07/13/Chip-8-Instruction-Scheduling-and-Frequency.html
-        std::this_thread::sleep_until(start_refresh_delay + 2ms);
+/*
+ * Handlers for the predecoded engine, indexed by OpKind. They only unpack the operands and call
+ * the same instruction methods used by decodeInstruction(), so both engines share the semantics.
+ * Operands are passed by value: an instruction may overwrite (and invalidate) its own entry.
+ */
+const Chip8::OpHandler Chip8::kOpHandlers[kOpCount] = {
+    // kOpUndecoded: decode the instruction at PC - 2 on first use, then run it
+    [](Chip8 &c, const DecodedOp &op) {
+        uint16_t address = (c.reg_.PC - 2) & (kMemorySize - 1);
+        c.decoded_[address] = predecode(c.readOpcode(address), c.mode_, c.quirks_);
+        const auto decoded = c.decoded_[address];
+        kOpHandlers[decoded.kind](c, decoded);
+    },
+    // kOpUnknown
+    [](Chip8 &c, const DecodedOp &op) {
+        std::cerr << "UNKNOWN OPCODE = " << std::setfill('0') << std::setw(4) << std::hex << std::uppercase
+            << op.nnn << "\n";
+    },
+    [](Chip8 &c, const DecodedOp &op) { c.clearScreen(); },
+    [](Chip8 &c, const DecodedOp &op) { c.returnFromSubroutine(); },
+    [](Chip8 &c, const DecodedOp &op) { c.jump(op.nnn); },
+    [](Chip8 &c, const DecodedOp &op) { c.callSubroutine(op.nnn); },
+    [](Chip8 &c, const DecodedOp &op) { c.skipIfEqual(op.x, op.kk); },
+    [](Chip8 &c, const DecodedOp &op) { c.skipIfNotEqual(op.x, op.kk); },
+    [](Chip8 &c, const DecodedOp &op) { c.skipNextIfVxVyEqual(op.x, op.y); },
+    [](Chip8 &c, const DecodedOp &op) { c.setVxRegister(op.x, op.kk); },
+    [](Chip8 &c, const DecodedOp &op) { c.addValueToVxRegister(op.x, op.kk); },
+    [](Chip8 &c, const DecodedOp &op) { c.setVxToVy(op.x, op.y); },
+    [](Chip8 &c, const DecodedOp &op) { c.orVxVy(op.x, op.y); },
+    [](Chip8 &c, const DecodedOp &op) { c.andVxVy(op.x, op.y); },
+    [](Chip8 &c, const DecodedOp &op) { c.xorVxVy(op.x, op.y); },
+    [](Chip8 &c, const DecodedOp &op) { c.addVxVy(op.x, op.y); },
+    [](Chip8 &c, const DecodedOp &op) { c.subVxVy(op.x, op.y); },
+    [](Chip8 &c, const DecodedOp &op) { c.shiftRightVx(op.x, op.x); },
+    [](Chip8 &c, const DecodedOp &op) { c.subnVxVy(op.x, op.y); },
+    [](Chip8 &c, const DecodedOp &op) { c.shiftLeftVx(op.x, op.x); },
+    [](Chip8 &c, const DecodedOp &op) { c.skipNextIfVxVyNotEqual(op.x, op.y); },
+    [](Chip8 &c, const DecodedOp &op) { c.setIndexRegister(op.nnn); },
+    [](Chip8 &c, const DecodedOp &op) { c.jumpToAddrPlusV0(op.nnn); },
+    [](Chip8 &c, const DecodedOp &op) { c.setRandomByteToVx(op.x, op.kk); },
+    [](Chip8 &c, const DecodedOp &op) { c.displayDraw(op.x, op.y, op.n); },
+    [](Chip8 &c, const DecodedOp &op) { c.skipIfKey(op.x); },
+    [](Chip8 &c, const DecodedOp &op) { c.skipIfNotKey(op.x); },
+    [](Chip8 &c, const DecodedOp &op) { c.setVxToDelayTimer(op.x); },
+    [](Chip8 &c, const DecodedOp &op) { c.waitForKey(op.x); },
+    [](Chip8 &c, const DecodedOp &op) { c.setDelayTimer(op.x); },
+    [](Chip8 &c, const DecodedOp &op) { c.setSoundTimer(op.x); },
+    [](Chip8 &c, const DecodedOp &op) { c.addVxToIndex(op.x); },
+    [](Chip8 &c, const DecodedOp &op) { c.setIndexToFontChar(op.x); },
+    [](Chip8 &c, const DecodedOp &op) { c.storeBcd(op.x); },
+    [](Chip8 &c, const DecodedOp &op) { c.storeRegisters(op.x); },
+    [](Chip8 &c, const DecodedOp &op) { c.loadRegisters(op.x); },
+    // kOpNop
+    [](Chip8 &c, const DecodedOp &op) {},
+    [](Chip8 &c, const DecodedOp &op) { c.scrollDown(op.n); },
+    [](Chip8 &c, const DecodedOp &op) { c.scrollRight(); },
+    [](Chip8 &c, const DecodedOp &op) { c.scrollLeft(); },
+    [](Chip8 &c, const DecodedOp &op) { c.exitInterpreter(); },
+    [](Chip8 &c, const DecodedOp &op) { c.setHighRes(false); },
+    [](Chip8 &c, const DecodedOp &op) { c.setHighRes(true); },
+    [](Chip8 &c, const DecodedOp &op) { c.setIndexToBigFontChar(op.x); },
+    [](Chip8 &c, const DecodedOp &op) { c.storeFlags(op.x); },
+    [](Chip8 &c, const DecodedOp &op) { c.loadFlags(op.x); },
+    [](Chip8 &c, const DecodedOp &op) { c.jumpToAddrPlusVx(op.x, op.nnn); }
+};
+
+Chip8::DecodedOp Chip8::predecode(uint16_t opcode, Mode mode, Quirks quirks) {
+    DecodedOp op;
+    op.kind = kOpNop;
+    op.x = static_cast<uint8_t>((opcode >> 8) & 0x000F);
+    op.y = static_cast<uint8_t>((opcode >> 4) & 0x000F);
+    op.kk = static_cast<uint8_t>(opcode & 0x00FF);
+    op.n = static_cast<uint8_t>(opcode & 0x000F);
+    op.nnn = opcode & 0x0FFF;
+
+    // Same classification as decodeInstruction(), done once per address instead of once per step
+    if (opcode == kClearScreen) {
+        op.kind = kOpClearScreen;
+        return op;
     }
+
+    if (opcode == kReturn) {
+        op.kind = kOpReturn;
+        return op;
+    }
+
+    switch ((opcode >> 12) & 0x000F) {
+        case 0x0:
+            op.kind = kOpUnknown;
+            if (mode == Mode::kChip8) {
+                break;
+            }
+            if ((opcode & 0xFFF0) == kScrollDown) {
+                op.kind = kOpScrollDown;
+            }
+            switch (opcode) {
+                case kScrollRight: op.kind = kOpScrollRight; break;
+                case kScrollLeft: op.kind = kOpScrollLeft; break;
+                case kExit: op.kind = kOpExit; break;
+                case kLowRes: op.kind = kOpLowRes; break;
+                case kHighRes: op.kind = kOpHighRes; break;
+                default: break;
+            }
+            break;
+        case kJump: op.kind = kOpJump; break;
+        case kCall: op.kind = kOpCall; break;
+        case kSkipIfEqual: op.kind = kOpSkipIfEqual; break;
+        case kSkipIfNotEqual: op.kind = kOpSkipIfNotEqual; break;
+        case kSkipIfVxVyEqual: op.kind = kOpSkipIfVxVyEqual; break;
+        case kSetVxReg: op.kind = kOpSetVx; break;
+        case kAddValueToVxReg: op.kind = kOpAddToVx; break;
+        case kVRegOperation:
+            switch (op.n) {
+                case 0x00: op.kind = kOpSetVxToVy; break;
+                case 0x01: op.kind = kOpOrVxVy; break;
+                case 0x02: op.kind = kOpAndVxVy; break;
+                case 0x03: op.kind = kOpXorVxVy; break;
+                case 0x04: op.kind = kOpAddVxVy; break;
+                case 0x05: op.kind = kOpSubVxVy; break;
+                case 0x06: op.kind = kOpShiftRightVx; break;
+                case 0x07: op.kind = kOpSubnVxVy; break;
+                case 0x0E: op.kind = kOpShiftLeftVx; break;
+                default: break;
+            }
+            break;
+        case kSkipIfVxVyNotEqual: op.kind = kOpSkipIfVxVyNotEqual; break;
+        case kSetIndexRegI: op.kind = kOpSetIndex; break;
+        case kJumpToAddrPlusV0:
+            op.kind = quirks == Quirks::kSuperChip ? kOpJumpToAddrPlusVx : kOpJumpToAddrPlusV0;
+            break;
+        case kSetRandom: op.kind = kOpSetRandom; break;
+        case kDisplayDraw: op.kind = kOpDisplayDraw; break;
+        case kSkipNetIfKey:
+            if (op.y == 0x09 && op.n == 0x0E) {
+                op.kind = kOpSkipIfKey;
+            } else if (op.y == 0x0A && op.n == 0x01) {
+                op.kind = kOpSkipIfNotKey;
+            }
+            break;
+        case kMisc:
+            switch (op.kk) {
+                case kMiscDelayTimerValue: op.kind = kOpDelayTimerValue; break;
+                case kMiscWaitForKey: op.kind = kOpWaitForKey; break;
+                case kMiscSetDelayTimer: op.kind = kOpSetDelayTimer; break;
+                case kMiscSetSoundTimer: op.kind = kOpSetSoundTimer; break;
+                case kMiscAddToIndex: op.kind = kOpAddToIndex; break;
+                case kMiscFontChar: op.kind = kOpFontChar; break;
+                case kMiscStoreBcd: op.kind = kOpStoreBcd; break;
+                case kMiscStoreMemory: op.kind = kOpStoreMemory; break;
+                case kMiscLoadMemory: op.kind = kOpLoadMemory; break;
+                case kMiscBigFontChar: op.kind = mode == Mode::kChip8 ? kOpNop : kOpBigFontChar; break;
+                case kMiscStoreFlags: op.kind = mode == Mode::kChip8 ? kOpNop : kOpStoreFlags; break;
+                case kMiscLoadFlags: op.kind = mode == Mode::kChip8 ? kOpNop : kOpLoadFlags; break;
+                default: break;
+            }
+            break;
+        default:
+            op.kind = kOpUnknown;
+            break;
+    }
+
+    return op;
+}
+
+void Chip8::invalidateDecoded(uint16_t address) {
+    // An instruction spans two bytes, so a write also affects the one starting right before it
+    decoded_[address & (kMemorySize - 1)].kind = kOpUndecoded;
+    decoded_[(address - 1) & (kMemorySize - 1)].kind = kOpUndecoded;
+}
+
+void Chip8::writeMemory(uint16_t address, uint8_t value) {
+    // Addresses wrap around the memory of the mode, so every engine agrees on out of range accesses
+    address &= memory_mask_;
+    memory_[address] = value;
+    dirty_pages_.set(address / kPageSize);
+    invalidateDecoded(address);
+    if (jit_) {
+        jit_->invalidate(address);
+    }
+}
+
+uint16_t Chip8::readOpcode(uint16_t address) const {
+    // CHIP-8 opcodes are stored in big-endian
+    return ((static_cast<uint16_t>(readMemory(address)) << 8) & 0xFF00) + readMemory(address + 1);
+}
+
+uint8_t Chip8::readMemory(uint16_t address) const {
+    return memory_[address & memory_mask_];
+}
+
+void Chip8::tick(void) {
+    render();
+    runDelayTimer();
+    runSoundTimer();
+
+    if (rewind_) {
+        saveState(&rewind_state_);
+        rewind_->push(rewind_state_);
+    }
+    if (recording_) {
+        recording_->addTick(instructions_);
+    }
+}
+
+void Chip8::render(void) {
+    if (mode_ == Mode::kXoChip) {
+        display_->renderPlanes(screen_buffer_, displayWidth(), displayHeight(), kPlanes, dirty_rows_);
+    } else {
+        display_->renderPacked(screen_buffer_, displayWidth(), displayHeight(), dirty_rows_);
+    }
+    dirty_rows_ = 0;
 }
 
 void Chip8::runDelayTimer(void) {
@@ -134,17 +1295,55 @@ void Chip8::runSoundTimer(void) {
     }
 }
 
-void Chip8::buzzerOn(void) {}
+void Chip8::buzzerOn(void) {
+    if (audio_) {
+        audio_->buzzerOn();
+    }
+}
 
-void Chip8::buzzerOff(void) {}
+void Chip8::buzzerOff(void) {
+    if (audio_) {
+        audio_->buzzerOff();
+    }
+}
+
+void Chip8::publishAudioPattern(void) {
+    if (!audio_) {
+        return;
+    }
+    // A rom that never loaded a pattern (F002) gets the default tone rather than silence
+    bool silent = std::all_of(std::begin(audio_pattern_), std::end(audio_pattern_), [](uint8_t byte) {
+        return !byte;
+    });
+    if (mode_ != Mode::kXoChip || silent) {
+        audio_->setPattern(nullptr, 0.0f);
+        return;
+    }
+    audio_->setPattern(audio_pattern_, 4000.0f * std::exp2((pitch_ - 64) / 48.0f));
+}
 
 uint16_t Chip8::fetchInstruction(void) {
-    // CHIP-8 opcodes are stored in big-endian
-    uint16_t opcode = ((static_cast<uint16_t>(memory_[reg_.PC]) << 8) & 0xFF00) + memory_[reg_.PC + 1];
+    uint16_t opcode = readOpcode(reg_.PC);
     reg_.PC += 2;
     return opcode;
 }
 
+void Chip8::decodeInstruction(uint16_t opcode) {
+    switch (quirks_) {
+        case Quirks::kCosmacVip:
+            decodeInstruction<CosmacVipQuirks>(opcode);
+            break;
+        case Quirks::kSuperChip:
+            decodeInstruction<SuperChipQuirks>(opcode);
+            break;
+        case Quirks::kModern:
+        default:
+            decodeInstruction<ModernQuirks>(opcode);
+            break;
+    }
+}
+
+template <typename Policy>
 void Chip8::decodeInstruction(uint16_t opcode) {
     if (opcode == kClearScreen) {
         clearScreen();
@@ -162,13 +1361,6 @@ void Chip8::decodeInstruction(uint16_t opcode) {
     uint16_t nnn = opcode & 0x0FFF;
     uint8_t n = static_cast<uint8_t>(opcode & 0x000F);
 
-    /*std::cout << "OPCODE [" << std::setfill('0') << std::setw(4) << std::hex << std::uppercase << opcode << "]";
-    std::cout << ", x = " << std::setfill('0') << std::setw(1) << std::hex << std::uppercase << int(x);
-    std::cout << ", y = " << std::setfill('0') << std::setw(1) << std::hex << std::uppercase << int(y);
-    std::cout << ", kk = " << std::setfill('0') << std::setw(2) << std::hex << std::uppercase << int(kk);
-    std::cout << ", nnn = " << std::setfill('0') << std::setw(3) << std::hex << std::uppercase << int(nnn);
-    std::cout << ", n = " << std::setfill('0') << std::setw(1) << std::hex << std::uppercase << int(n) << "\n";*/
-
     switch ((opcode >> 12) & 0x000F) {
         case kJump:
             jump(nnn);
@@ -183,6 +1375,9 @@ void Chip8::decodeInstruction(uint16_t opcode) {
             skipIfNotEqual(x, kk);
             break;
         case kSkipIfVxVyEqual:
+            if (mode_ == Mode::kXoChip && n && decodeExtended(opcode)) {
+                break;
+            }
             skipNextIfVxVyEqual(x, y);
             break;
         case kSetVxReg:
@@ -192,13 +1387,17 @@ void Chip8::decodeInstruction(uint16_t opcode) {
             addValueToVxRegister(x, kk);
             break;
         case kVRegOperation:
-            runVRegOperation(x, y, n);
+            runVRegOperation<Policy>(x, y, n);
             break;
         case kSkipIfVxVyNotEqual:
             skipNextIfVxVyNotEqual(x, y);
             break;
         case kJumpToAddrPlusV0:
-            jumpToAddrPlusV0(nnn);
+            if (Policy::kJumpUsesVx) {
+                jumpToAddrPlusVx(x, nnn);
+            } else {
+                jumpToAddrPlusV0(nnn);
+            }
             break;
         case kSetRandom:
             setRandomByteToVx(x, kk);
@@ -213,34 +1412,134 @@ void Chip8::decodeInstruction(uint16_t opcode) {
             skipNetIfKey(x, y, n);
             break;
         case kMisc:
-            decodeMisc(x, kk);
+            if (mode_ == Mode::kChip8 || !decodeExtended(opcode)) {
+                decodeMisc<Policy>(x, kk);
+            }
             break;
         default:
-            std::cerr << "UNKNOWN OPCODE = " << std::setfill('0') << std::setw(4) << std::hex << std::uppercase 
-                << opcode << "\n";
+            if (mode_ == Mode::kChip8 || !decodeExtended(opcode)) {
+                std::cerr << "UNKNOWN OPCODE = " << std::setfill('0') << std::setw(4) << std::hex << std::uppercase 
+                    << opcode << "\n";
+            }
             break;
     }
 }
 
+bool Chip8::decodeExtended(uint16_t opcode) {
+    uint8_t x = static_cast<uint8_t>((opcode >> 8) & 0x000F);
+    uint8_t y = static_cast<uint8_t>((opcode >> 4) & 0x000F);
+    uint8_t kk = static_cast<uint8_t>(opcode & 0x00FF);
+    uint8_t n = static_cast<uint8_t>(opcode & 0x000F);
+    bool xo_chip = mode_ == Mode::kXoChip;
+
+    switch ((opcode >> 12) & 0x000F) {
+        case 0x0:
+            if ((opcode & 0xFFF0) == kScrollDown) {
+                scrollDown(n);
+                return true;
+            }
+            if (xo_chip && (opcode & 0xFFF0) == kScrollUp) {
+                scrollUp(n);
+                return true;
+            }
+            switch (opcode) {
+                case kScrollRight:
+                    scrollRight();
+                    return true;
+                case kScrollLeft:
+                    scrollLeft();
+                    return true;
+                case kExit:
+                    exitInterpreter();
+                    return true;
+                case kLowRes:
+                    setHighRes(false);
+                    return true;
+                case kHighRes:
+                    setHighRes(true);
+                    return true;
+                default:
+                    return false;
+            }
+        case kSkipIfVxVyEqual:
+            if (xo_chip && n == kStoreRange) {
+                storeRange(x, y);
+                return true;
+            }
+            if (xo_chip && n == kLoadRange) {
+                loadRange(x, y);
+                return true;
+            }
+            return false;
+        case kMisc:
+            switch (kk) {
+                case kMiscBigFontChar:
+                    setIndexToBigFontChar(x);
+                    return true;
+                case kMiscStoreFlags:
+                    storeFlags(x);
+                    return true;
+                case kMiscLoadFlags:
+                    loadFlags(x);
+                    return true;
+                case kMiscLongIndex:
+                    if (xo_chip && !x) {
+                        setLongIndex();
+                        return true;
+                    }
+                    return false;
+                case kMiscSelectPlanes:
+                    if (xo_chip) {
+                        selectPlanes(x);
+                        return true;
+                    }
+                    return false;
+                case kMiscAudioPattern:
+                    if (xo_chip && !x) {
+                        loadAudioPattern();
+                        return true;
+                    }
+                    return false;
+                case kMiscSetPitch:
+                    if (xo_chip) {
+                        setPitch(x);
+                        return true;
+                    }
+                    return false;
+                default:
+                    return false;
+            }
+        default:
+            return false;
+    }
+}
+
 void Chip8::jump(uint16_t address) {
     reg_.PC = address;
 }
 
 void Chip8::callSubroutine(uint16_t address) {
+    reg_.stack[reg_.SP % kStackDepth] = reg_.PC;
     ++reg_.SP;
-    reg_.stack.push(reg_.PC);
     reg_.PC = address;
 }
 
+void Chip8::skipNextInstruction(void) {
+    if (mode_ == Mode::kXoChip && readOpcode(reg_.PC) == 0xF000) {
+        reg_.PC += 2;
+    }
+    reg_.PC += 2;
+}
+
 void Chip8::skipIfEqual(uint8_t v_reg, uint8_t value) {
     if (reg_.V[v_reg] == value) {
-        reg_.PC += 2;
+        skipNextInstruction();
     }
 }
 
 void Chip8::skipIfNotEqual(uint8_t v_reg, uint8_t value) {
     if (reg_.V[v_reg] != value) {
-        reg_.PC += 2;
+        skipNextInstruction();
     }
 }
 
@@ -254,74 +1553,223 @@ void Chip8::addValueToVxRegister(uint8_t v_reg, uint8_t value) {
 }
 
 void Chip8::clearScreen(void) {
-    std::memset(screen_buffer_, 0, sizeof(screen_buffer_));
+    auto row_words = rowWords();
+    auto plane_words = planeWords();
+    for (size_t plane = 0; plane < kPlanes; ++plane) {
+        if (!(planes_ & (1U << plane))) {
+            continue;
+        }
+        auto *words = &screen_buffer_[plane * plane_words];
+        for (uint32_t i = 0; i < plane_words; ++i) {
+            if (words[i]) {
+                dirty_rows_ |= 1ULL << (i / row_words);
+            }
+        }
+        std::memset(words, 0, plane_words * sizeof(uint64_t));
+    }
     display_->clear();
 }
 
+void Chip8::scrollDown(uint8_t n) {
+    auto height = displayHeight();
+    auto row_words = rowWords();
+    auto plane_words = planeWords();
+    uint32_t rows = std::min<uint32_t>(n, height);
+    if (!rows) {
+        return;
+    }
+    for (size_t plane = 0; plane < kPlanes; ++plane) {
+        if (planes_ & (1U << plane)) {
+            auto *words = &screen_buffer_[plane * plane_words];
+            std::memmove(words + rows * row_words, words, (height - rows) * row_words * sizeof(uint64_t));
+            std::memset(words, 0, rows * row_words * sizeof(uint64_t));
+        }
+    }
+    dirty_rows_ = ~0ULL;
+}
+
+void Chip8::scrollUp(uint8_t n) {
+    auto height = displayHeight();
+    auto row_words = rowWords();
+    auto plane_words = planeWords();
+    uint32_t rows = std::min<uint32_t>(n, height);
+    if (!rows) {
+        return;
+    }
+    for (size_t plane = 0; plane < kPlanes; ++plane) {
+        if (planes_ & (1U << plane)) {
+            auto *words = &screen_buffer_[plane * plane_words];
+            std::memmove(words, words + rows * row_words, (height - rows) * row_words * sizeof(uint64_t));
+            std::memset(words + (height - rows) * row_words, 0, rows * row_words * sizeof(uint64_t));
+        }
+    }
+    dirty_rows_ = ~0ULL;
+}
+
+void Chip8::scrollRight(void) {
+    auto height = displayHeight();
+    auto row_words = rowWords();
+    auto plane_words = planeWords();
+    for (size_t plane = 0; plane < kPlanes; ++plane) {
+        if (!(planes_ & (1U << plane))) {
+            continue;
+        }
+        for (uint32_t row = 0; row < height; ++row) {
+            // Right to left, each word takes the 4 low pixels of the word on its left
+            auto *words = &screen_buffer_[plane * plane_words + row * row_words];
+            uint64_t any = 0;
+            for (uint32_t word = row_words - 1; word > 0; --word) {
+                any |= words[word];
+                words[word] = (words[word] >> 4) | (words[word - 1] << 60);
+            }
+            any |= words[0];
+            words[0] >>= 4;
+            if (any) {
+                dirty_rows_ |= 1ULL << row;
+            }
+        }
+    }
+}
+
+void Chip8::scrollLeft(void) {
+    auto height = displayHeight();
+    auto row_words = rowWords();
+    auto plane_words = planeWords();
+    for (size_t plane = 0; plane < kPlanes; ++plane) {
+        if (!(planes_ & (1U << plane))) {
+            continue;
+        }
+        for (uint32_t row = 0; row < height; ++row) {
+            // Left to right, each word takes the 4 high pixels of the word on its right
+            auto *words = &screen_buffer_[plane * plane_words + row * row_words];
+            uint64_t any = 0;
+            for (uint32_t word = 0; word + 1 < row_words; ++word) {
+                any |= words[word];
+                words[word] = (words[word] << 4) | (words[word + 1] >> 60);
+            }
+            any |= words[row_words - 1];
+            words[row_words - 1] <<= 4;
+            if (any) {
+                dirty_rows_ |= 1ULL << row;
+            }
+        }
+    }
+}
+
+void Chip8::exitInterpreter(void) {
+    // There is no HP48 to go back to: the program ends, with PC left on the 00FD
+    reg_.PC -= 2;
+    halted_ = true;
+}
+
+void Chip8::setHighRes(bool enabled) {
+    // Both switches clear the screen, so the planes can be laid out for the new resolution
+    hires_ = enabled;
+    std::memset(screen_buffer_, 0, sizeof(screen_buffer_));
+    dirty_rows_ = ~0ULL;
+}
+
 void Chip8::returnFromSubroutine(void) {
-    reg_.PC = reg_.stack.top();
-    reg_.stack.pop();
+    // Without a matching call, this returns to whatever the wrapped-around slot holds
     --reg_.SP;
+    reg_.PC = reg_.stack[reg_.SP % kStackDepth];
 }
 
+template <typename Policy>
 void Chip8::runVRegOperation(uint8_t x, uint8_t y, uint8_t n) {
     switch (n) {
-        case 0x00: {
-            reg_.V[x] = reg_.V[y];
+        case 0x00:
+            setVxToVy(x, y);
             break;
-        }
-        case 0x01: {
-            reg_.V[x] |= reg_.V[y];
+        case 0x01:
+            orVxVy(x, y);
+            if (Policy::kLogicResetsVf) {
+                reg_.V[0xF] = 0;
+            }
             break;
-        }
-        case 0x02: {
-            reg_.V[x] &= reg_.V[y];
+        case 0x02:
+            andVxVy(x, y);
+            if (Policy::kLogicResetsVf) {
+                reg_.V[0xF] = 0;
+            }
             break;
-        }
-        case 0x03: {
-            reg_.V[x] ^= reg_.V[y];
+        case 0x03:
+            xorVxVy(x, y);
+            if (Policy::kLogicResetsVf) {
+                reg_.V[0xF] = 0;
+            }
             break;
-        }
-        case 0x04: {
-            uint16_t result = static_cast<uint16_t>(reg_.V[x]) + static_cast<uint16_t>(reg_.V[y]);
-            reg_.V[x] =  static_cast<uint8_t>(result & 0x00FF);
-            reg_.V[0xF] = static_cast<uint8_t>((result >> 8) & 0x01);
+        case 0x04:
+            addVxVy(x, y);
             break;
-        }
-        case 0x05: {
-            reg_.V[0xF] = (reg_.V[x] > reg_.V[y]);
-            reg_.V[x] -= reg_.V[y];
+        case 0x05:
+            subVxVy(x, y);
             break;
-        }
-        case 0x06: {
-            reg_.V[0xF] = reg_.V[x] & 0x01;
-            reg_.V[x] = reg_.V[x] >> 1;
+        case 0x06:
+            shiftRightVx(x, Policy::kShiftUsesVy ? y : x);
             break;
-        }
-        case 0x07: {
-            reg_.V[0xF] = (reg_.V[y] > reg_.V[x]);
-            reg_.V[x] = reg_.V[y] - reg_.V[x];
+        case 0x07:
+            subnVxVy(x, y);
             break;
-        }
-        case 0x0E: {
-            reg_.V[0xF] = reg_.V[x] & 0x80;
-            reg_.V[x] = reg_.V[x] << 1;
+        case 0x0E:
+            shiftLeftVx(x, Policy::kShiftUsesVy ? y : x);
             break;
-        }
         default:
             break;
     }
 }
 
+void Chip8::setVxToVy(uint8_t x, uint8_t y) {
+    reg_.V[x] = reg_.V[y];
+}
+
+void Chip8::orVxVy(uint8_t x, uint8_t y) {
+    reg_.V[x] |= reg_.V[y];
+}
+
+void Chip8::andVxVy(uint8_t x, uint8_t y) {
+    reg_.V[x] &= reg_.V[y];
+}
+
+void Chip8::xorVxVy(uint8_t x, uint8_t y) {
+    reg_.V[x] ^= reg_.V[y];
+}
+
+void Chip8::addVxVy(uint8_t x, uint8_t y) {
+    uint16_t result = static_cast<uint16_t>(reg_.V[x]) + static_cast<uint16_t>(reg_.V[y]);
+    reg_.V[x] =  static_cast<uint8_t>(result & 0x00FF);
+    reg_.V[0xF] = static_cast<uint8_t>((result >> 8) & 0x01);
+}
+
+void Chip8::subVxVy(uint8_t x, uint8_t y) {
+    reg_.V[0xF] = (reg_.V[x] > reg_.V[y]);
+    reg_.V[x] -= reg_.V[y];
+}
+
+void Chip8::shiftRightVx(uint8_t x, uint8_t y) {
+    reg_.V[0xF] = reg_.V[y] & 0x01;
+    reg_.V[x] = reg_.V[y] >> 1;
+}
+
+void Chip8::subnVxVy(uint8_t x, uint8_t y) {
+    reg_.V[0xF] = (reg_.V[y] > reg_.V[x]);
+    reg_.V[x] = reg_.V[y] - reg_.V[x];
+}
+
+void Chip8::shiftLeftVx(uint8_t x, uint8_t y) {
+    reg_.V[0xF] = reg_.V[y] & 0x80;
+    reg_.V[x] = reg_.V[y] << 1;
+}
+
 void Chip8::skipNextIfVxVyNotEqual(uint8_t x, uint8_t y) {
     if (reg_.V[x] != reg_.V[y]) {
-        reg_.PC += 2;
+        skipNextInstruction();
     }
 }
 
 void Chip8::skipNextIfVxVyEqual(uint8_t x, uint8_t y) {
     if (reg_.V[x] == reg_.V[y]) {
-        reg_.PC += 2;
+        skipNextInstruction();
     }
 }
 
@@ -333,103 +1781,139 @@ void Chip8::jumpToAddrPlusV0(uint16_t address) {
     reg_.PC = address + reg_.V[0x00];
 }
 
-void Chip8::setRandomByteToVx(uint8_t v_reg, uint8_t value) {
-    std::random_device dev;
-    std::mt19937 rng(dev());
-    std::uniform_int_distribution<std::mt19937::result_type> dist_0_255(0, 255);
-    uint8_t rnd_number = dist_0_255(rng);
+void Chip8::jumpToAddrPlusVx(uint8_t x, uint16_t address) {
+    reg_.PC = address + reg_.V[x];
+}
 
-    reg_.V[v_reg] = rnd_number & value;
+void Chip8::setRandomByteToVx(uint8_t v_reg, uint8_t value) {
+    reg_.V[v_reg] = rng_.nextByte() & value;
 }
 
 void Chip8::displayDraw(uint8_t x, uint8_t y, uint8_t n) {
+    if (mode_ != Mode::kChip8) {
+        displayDrawExtended(x, y, n);
+        return;
+    }
+
     uint8_t display_x_pos = reg_.V[x] % kDisplayWidth;
     uint8_t display_y_pos = reg_.V[y] % kDisplayHeight;
-    auto start_x_pos = display_x_pos;
     reg_.V[0xF] = 0x00;
 
     // We update our screen buffer before actually rendering
-    for(uint32_t i = 0; i < n; ++i) {
-        if (display_y_pos >= kDisplayHeight) {
-            break;
+    for (uint32_t i = 0; i < n && display_y_pos < kDisplayHeight; ++i, ++display_y_pos) {
+        // Sprite row moved to the leftmost pixel (MSB), then to its X position.
+        // Pixels past the right edge are shifted out, which clips the sprite horizontally.
+        uint64_t sprite_row = (static_cast<uint64_t>(readMemory(reg_.I + i)) << (kDisplayWidth - 8)) >> display_x_pos;
+        auto &screen_row = screen_buffer_[display_y_pos];
+        if (screen_row & sprite_row) {
+            reg_.V[0xF] = 0x01;
+        }
+        if (sprite_row) {
+            dirty_rows_ |= 1ULL << display_y_pos;
         }
 
-        display_x_pos = start_x_pos;
-        const auto &display_data = memory_[reg_.I + i];
-        for (int8_t j = 7; j >= 0; --j) {
-            if (display_x_pos >= kDisplayWidth) {
-                break;
-            }
+        screen_row ^= sprite_row;
+    }
+}
 
-            const uint8_t &sprite_pixel = (display_data >> j) & 0x01;
-            // (Y position * display width) walks the pointer on the vertical line
-            auto *screen_buf_pixel = &screen_buffer_[display_x_pos + display_y_pos * kDisplayWidth];
-            if (sprite_pixel && *screen_buf_pixel) {
-                reg_.V[0xF] = 0x01;
-            }
+void Chip8::displayDrawExtended(uint8_t x, uint8_t y, uint8_t n) {
+    auto width = displayWidth();
+    auto height = displayHeight();
+    auto row_words = rowWords();
+    auto plane_words = planeWords();
+    uint32_t display_x_pos = reg_.V[x] % width;
+    uint32_t display_y_pos = reg_.V[y] % height;
+    uint32_t word = display_x_pos / 64;
+    uint32_t shift = display_x_pos % 64;
+    // Dxy0 draws 16 x 16 sprites, 2 bytes per row
+    uint32_t sprite_width = n ? 8 : 16;
+    uint32_t sprite_rows = n ? n : 16;
+    uint16_t sprite = reg_.I;
+    reg_.V[0xF] = 0x00;
 
-            *screen_buf_pixel ^= sprite_pixel;
-            ++display_x_pos;
+    // Each selected plane draws the next sprite in memory
+    for (size_t plane = 0; plane < kPlanes; ++plane) {
+        if (!(planes_ & (1U << plane))) {
+            continue;
         }
-          ++display_y_pos;
+        auto row = display_y_pos;
+        for (uint32_t i = 0; i < sprite_rows && row < height; ++i, ++row) {
+            uint64_t bits = sprite_width == 16 ? readOpcode(sprite + 2 * i) : readMemory(sprite + i);
+            // Sprite row moved to the leftmost pixel (MSB), then to its X position over up to two words.
+            // Pixels past the right edge are shifted out, which clips the sprite horizontally.
+            bits <<= 64 - sprite_width;
+            uint64_t parts[2] = {bits >> shift, shift ? bits << (64 - shift) : 0};
+            auto *screen_row = &screen_buffer_[plane * plane_words + row * row_words];
+            for (uint32_t k = 0; k < 2 && word + k < row_words; ++k) {
+                if (screen_row[word + k] & parts[k]) {
+                    reg_.V[0xF] = 0x01;
+                }
+                if (parts[k]) {
+                    dirty_rows_ |= 1ULL << row;
+                }
+                screen_row[word + k] ^= parts[k];
+            }
+        }
+        sprite += sprite_rows * sprite_width / 8;
     }
 }
 
 void Chip8::skipNetIfKey(uint8_t x, uint8_t y, uint8_t n) {
     // SKP Vx
-    if (y == 0x09 && n == 0x0E && keyIsPressed(x)) {
-        reg_.PC += 2;
+    if (y == 0x09 && n == 0x0E) {
+        skipIfKey(x);
     // SKNP Vx
-    } else if (y == 0x0A && n == 0x01 && !keyIsPressed(x)) {
-        reg_.PC += 2;
+    } else if (y == 0x0A && n == 0x01) {
+        skipIfNotKey(x);
     }
 }
 
+void Chip8::skipIfKey(uint8_t x) {
+    if (keyIsPressed(x)) {
+        skipNextInstruction();
+    }
+}
+
+void Chip8::skipIfNotKey(uint8_t x) {
+    if (!keyIsPressed(x)) {
+        skipNextInstruction();
+    }
+}
+
+template <typename Policy>
 void Chip8::decodeMisc(uint8_t x, uint8_t kk) {
     switch (kk) {
         case kMiscDelayTimerValue:
-            reg_.V[x] = reg_.DT;
+            setVxToDelayTimer(x);
             break;
-        case kMiscWaitForKey: {
-            uint8_t keyValue = 0xFF;
-            auto isPressed = getKey(&keyValue);
-            if (!isPressed) {
-                reg_.PC -= 2;
-            } else {
-                std::cout << "KEY PRESSED: " << std::to_string(keyValue) << "\n";
-                reg_.V[x] = keyValue;
-            }
-        }
+        case kMiscWaitForKey:
+            waitForKey(x);
             break;
         case kMiscSetDelayTimer:
-            reg_.DT = reg_.V[x];
+            setDelayTimer(x);
             break;
         case kMiscSetSoundTimer:
-            reg_.ST = reg_.V[x];
+            setSoundTimer(x);
             break;
         case kMiscAddToIndex:
-            reg_.I += reg_.V[x];
+            addVxToIndex(x);
             break;
         case kMiscFontChar:
-            reg_.I = memory_[reg_.V[x] * 5];
+            setIndexToFontChar(x);
             break;
-        case kMiscStoreBcd: {
-            uint8_t value = reg_.V[x];
-            memory_[reg_.I + 2] = value % 10;
-            value /= 10;
-            memory_[reg_.I + 1] = value % 10;
-            value /= 10;
-            memory_[reg_.I] = value % 10;
-        }
+        case kMiscStoreBcd:
+            storeBcd(x);
             break;
         case kMiscStoreMemory:
-            for (uint8_t i = 0; i <= x; ++i) {
-                memory_[reg_.I + i] = reg_.V[i];
+            storeRegisters(x);
+            if (Policy::kLoadStoreIncrementsI) {
+                reg_.I += x + 1;
             }
             break;
         case kMiscLoadMemory:
-            for (uint8_t i = 0; i <= x; ++i) {
-                reg_.V[i] = memory_[reg_.I + i];
+            loadRegisters(x);
+            if (Policy::kLoadStoreIncrementsI) {
+                reg_.I += x + 1;
             }
             break;
         default:
@@ -437,43 +1921,164 @@ void Chip8::decodeMisc(uint8_t x, uint8_t kk) {
     }
 }
 
-bool Chip8::keyIsPressed(uint8_t x) {
-    auto key = keyboard_->getKey();
+void Chip8::setVxToDelayTimer(uint8_t x) {
+    reg_.V[x] = reg_.DT;
+}
 
-    if (key.state == IKeyboard::Key::State::kReleased) {
-        return false;
+void Chip8::waitForKey(uint8_t x) {
+    uint8_t keyValue = 0xFF;
+    if (getKey(&keyValue)) {
+        setVxToKey(x, keyValue);
+        return;
     }
 
-    if (isKeyChip8Valid(key.value) && key.value == reg_.V[x]) {
-        return true;
+    // Park the CPU instead of executing Fx0A again: the run loops sleep until a key edge comes in
+    waiting_for_key_ = true;
+    wait_key_register_ = x;
+}
+
+void Chip8::resumeWaitForKey(void) {
+    uint8_t keyValue = 0xFF;
+    if (getKey(&keyValue)) {
+        waiting_for_key_ = false;
+        setVxToKey(wait_key_register_, keyValue);
     }
+}
 
-    return false;
+void Chip8::setVxToKey(uint8_t x, uint8_t keyValue) {
+    reg_.V[x] = keyValue;
+}
+
+void Chip8::setDelayTimer(uint8_t x) {
+    reg_.DT = reg_.V[x];
+}
+
+void Chip8::setSoundTimer(uint8_t x) {
+    reg_.ST = reg_.V[x];
 }
 
-bool Chip8::isKeyChip8Valid(char value) {
-    uint8_t chip8Key = convertKeyboardToChip8(value);
-    return (chip8Key >= 0x00 && chip8Key <= 0x0F);
+void Chip8::addVxToIndex(uint8_t x) {
+    reg_.I += reg_.V[x];
 }
 
-uint8_t Chip8::convertKeyboardToChip8(char value) {
-    auto upperChar = static_cast<char>(std::toupper(static_cast<unsigned char>(value)));
+void Chip8::setIndexToFontChar(uint8_t x) {
+    reg_.I = readMemory(reg_.V[x] * 5);
+}
+
+void Chip8::storeBcd(uint8_t x) {
+    uint8_t value = reg_.V[x];
+    writeMemory(reg_.I + 2, value % 10);
+    value /= 10;
+    writeMemory(reg_.I + 1, value % 10);
+    value /= 10;
+    writeMemory(reg_.I, value % 10);
+}
 
-    if (keyboardToChip8Map.count(upperChar) > 0) {
-        return keyboardToChip8Map.at(upperChar);
+void Chip8::storeRegisters(uint8_t x) {
+    for (uint8_t i = 0; i <= x; ++i) {
+        writeMemory(reg_.I + i, reg_.V[i]);
     }
+}
 
-    return 0xFF;
+void Chip8::loadRegisters(uint8_t x) {
+    for (uint8_t i = 0; i <= x; ++i) {
+        reg_.V[i] = readMemory(reg_.I + i);
+    }
 }
 
-bool Chip8::getKey(uint8_t *keyValue) {
-    auto key = keyboard_->getKey();
+void Chip8::setIndexToBigFontChar(uint8_t x) {
+    reg_.I = kBigSpritesMemLocation + (reg_.V[x] & 0x0F) * 10;
+}
 
-    if (key.state == IKeyboard::Key::State::kReleased || !isKeyChip8Valid(key.value)) {
-        return false;
+void Chip8::storeFlags(uint8_t x) {
+    for (uint8_t i = 0; i <= x; ++i) {
+        flags_[i] = reg_.V[i];
     }
+}
 
-    *keyValue = convertKeyboardToChip8(key.value);
-    return true;
+void Chip8::loadFlags(uint8_t x) {
+    for (uint8_t i = 0; i <= x; ++i) {
+        reg_.V[i] = flags_[i];
+    }
+}
+
+void Chip8::storeRange(uint8_t x, uint8_t y) {
+    // Vx first, in reverse register order when x > y. I is left unchanged.
+    uint8_t count = (x <= y ? y - x : x - y) + 1;
+    for (uint8_t i = 0; i < count; ++i) {
+        writeMemory(reg_.I + i, reg_.V[x <= y ? x + i : x - i]);
+    }
+}
+
+void Chip8::loadRange(uint8_t x, uint8_t y) {
+    uint8_t count = (x <= y ? y - x : x - y) + 1;
+    for (uint8_t i = 0; i < count; ++i) {
+        reg_.V[x <= y ? x + i : x - i] = readMemory(reg_.I + i);
+    }
+}
+
+void Chip8::setLongIndex(void) {
+    // F000 nnnn: the address is the next opcode word
+    reg_.I = readOpcode(reg_.PC);
+    reg_.PC += 2;
+}
+
+void Chip8::selectPlanes(uint8_t x) {
+    planes_ = x & 0x03;
+}
+
+void Chip8::loadAudioPattern(void) {
+    for (size_t i = 0; i < sizeof(audio_pattern_); ++i) {
+        audio_pattern_[i] = readMemory(reg_.I + i);
+    }
+    publishAudioPattern();
+}
+
+void Chip8::setPitch(uint8_t x) {
+    pitch_ = reg_.V[x];
+    publishAudioPattern();
+}
+
+bool Chip8::keyIsPressed(uint8_t x) {
+    return (keys_ >> (reg_.V[x] & 0x0F)) & 0x01;
 }
 
+bool Chip8::getKey(uint8_t *keyValue) {
+    // Only a key-down edge completes Fx0A, key-ups are consumed and ignored
+    while (key_events_count_) {
+        const auto &key = key_events_[key_events_head_];
+        key_events_head_ = (key_events_head_ + 1) % kKeyEventsSize;
+        --key_events_count_;
+        if (key.state == IKeyboard::Key::State::kPressed) {
+            *keyValue = key.value;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void Chip8::pollInput(void) {
+    auto keys = keyboard_->pressedKeys();
+    bool changed = keys != keys_;
+    keys_ = keys;
+
+    IKeyboard::Key key;
+    while (keyboard_->getKeyEvent(&key)) {
+        queueKeyEvent(key);
+        if (recording_) {
+            recording_->addKeys(instructions_, keys_, &key);
+        }
+        changed = false;
+    }
+    if (changed && recording_) {
+        recording_->addKeys(instructions_, keys_, nullptr);
+    }
+}
+
+void Chip8::queueKeyEvent(const IKeyboard::Key &key) {
+    if (key_events_count_ < kKeyEventsSize) {
+        key_events_[(key_events_head_ + key_events_count_) % kKeyEventsSize] = key;
+        ++key_events_count_;
+    }
+}
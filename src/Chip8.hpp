@@ -1,17 +1,56 @@
 #pragma once
 
+#include <array>
+#include <bitset>
 #include <cstdint>
+#include <ostream>
 #include <string>
 #include <vector>
 #include <exception>
 #include <memory>
-#include <stack>
-#include <map>
 
+#include "IAudio.hpp"
 #include "IDisplay.hpp"
 #include "IKeyboard.hpp"
+#include "Movie.hpp"
+#include "Profiler.hpp"
+#include "RewindBuffer.hpp"
+#include "TraceBuffer.hpp"
+#include "Xoshiro256.hpp"
+
+class Chip8Bench;
+class Chip8Jit;
+class Chip8Lockstep;
 
 class Chip8 {
+private:
+    // CHIP-8 memory is 4 KB
+    static constexpr size_t kMemorySize = 4096;
+    // XO-CHIP extends it to 64 KB (F000 nnnn loads a 16-bit I)
+    static constexpr size_t kXoMemorySize = 65536;
+    // Call stack entries (the COSMAC VIP had 12, most interpreters 16). A deeper call overwrites the oldest
+    // entries: SP wraps around the stack, so overflows and underflows are defined and never allocate.
+    static constexpr size_t kStackDepth = 16;
+    static_assert(kStackDepth && !(kStackDepth & (kStackDepth - 1)), "SP wraps around the stack");
+
+    // CHIP-8 Registers
+    struct Register {
+        // General purpose registers (V0 - VF)
+        uint8_t V[16];
+        // 12-bit I register (usually to point at locations in memory)
+        uint16_t I;
+        // Program Counter
+        uint16_t PC;
+        // Stack Pointer: number of calls minus returns, the top entry is stack[(SP - 1) % kStackDepth]
+        uint8_t SP;
+        // Delay Timer
+        uint8_t DT;
+        // Sound Timer
+        uint8_t ST;
+        // Stack region
+        uint16_t stack[kStackDepth];
+    };
+
 public:
     class Chip8Exception : public std::exception {
     public:
@@ -24,20 +63,152 @@ public:
     Chip8(size_t memory_start_offset, const std::shared_ptr<IDisplay> &display, const std::shared_ptr<IKeyboard> &keyboard);
     // Default memory start offset used (0x200)
     Chip8(const std::shared_ptr<IDisplay> &display, const std::shared_ptr<IKeyboard> &keyboard);
-    virtual ~Chip8() {}
+    virtual ~Chip8();
+
+    // Execution engines. All of them produce the same machine state.
+    enum class Engine {
+        // Fetches and decodes every instruction through decodeInstruction()
+        kSwitch,
+        // Executes from a cache of predecoded instructions indexed by PC
+        kPredecoded,
+        // Same cache, with direct-threaded dispatch (computed goto on GCC/Clang)
+        kThreaded,
+        // x86-64 basic-block recompiler, falls back to kThreaded on other hosts
+        kJit
+    };
+
+    enum class Mode {
+        // Original instruction set, 64 x 32 display, 4 KB memory
+        kChip8,
+        // SUPER-CHIP 1.1: 128 x 64 hi-res (00FE / 00FF), scrolling (00Cn, 00FB, 00FC), 16 x 16 sprites (Dxy0),
+        // big font (Fx30), RPL flags (Fx75 / Fx85) and exit (00FD)
+        kSuperChip,
+        // XO-CHIP: SUPER-CHIP plus 64 KB memory, two bit-planes (Fn01), scroll up (00Dn), register ranges
+        // (5xy2 / 5xy3), I = nnnn (F000 nnnn) and the audio pattern (F002, Fx3A)
+        kXoChip
+    };
+
+    // Behavior variants of the opcodes interpreters disagree on (see Chip8Quirks.hpp)
+    enum class Quirks {
+        // What most modern roms expect
+        kModern,
+        // Original COSMAC VIP interpreter
+        kCosmacVip,
+        // SUPER-CHIP 1.1 (HP48)
+        kSuperChip
+    };
+
+    // Execution statistics reported by runHeadless()
+    struct RunStats {
+        uint64_t instructions;
+        // Instruction slots spent parked on Fx0A (wait for key)
+        uint64_t wait_cycles;
+        uint64_t frames;
+        // Frames dropped by run() because the host fell too far behind
+        uint64_t skipped_frames;
+        // Delay timer busy-waits fast-forwarded to the end of their frame (see setIdleLoopSkip())
+        uint64_t idle_hits;
+        double wall_time_s;
+    };
 
     void load(const std::string &path);
-    void run(void);
+    // Loads a rom already read by readRom(), so a batch of instances can share one copy
+    void loadRom(const std::vector<uint8_t> &rom);
+    static std::vector<uint8_t> readRom(const std::string &path);
+    /** Runs the loaded program in real time until the keyboard asks to quit
+     *
+     * Each 60 Hz frame runs its CPU budget in one batch, then ticks the timers and renders once, then sleeps until
+     * the next frame. A late host runs the missed frames back to back to catch up, up to kMaxCatchUpFrames; beyond
+     * that they are skipped.
+     */
+    RunStats run(void);
+    /** Runs the loaded program without any throttling until one of the budgets is reached
+     *
+     * @param max_instructions stops after this many cycles, executed or waiting (0 = no limit). With the default
+     *                         costs, a cycle is one instruction slot.
+     * @param max_frames stops after this many 60 Hz frames (0 = no limit)
+     *
+     * Frames are virtual: timers and render tick once every cycles-per-frame cycles.
+     * While parked on Fx0A, virtual time jumps straight to the next frame.
+     */
+    RunStats runHeadless(uint64_t max_instructions, uint64_t max_frames);
+    // CPU budget of a frame, in cycles (default: kInstructionsPerFrame)
+    void setCyclesPerFrame(uint64_t cycles);
+    /** Cost in cycles of each instruction, indexed by the first opcode nibble (default: 1 for all, so a frame runs
+     * cycles-per-frame instructions). A frame ends with the instruction that reaches its budget, the overshoot is
+     * taken from the next frame. Throws Chip8Exception on a zero cost.
+     */
+    void setCycleCosts(const std::array<uint8_t, 16> &costs);
+    /** Fast-forwards delay timer busy-waits (default: on)
+     *
+     * A frame that starts in an "Fx07, 3xkk, 1nnn" loop back to the Fx07 cannot leave it before the next tick: the
+     * remaining whole iterations are accounted for (instruction count, cycles, Vx = DT) without being executed.
+     * The result is exactly that of executing them, so movies and results do not depend on it.
+     */
+    void setIdleLoopSkip(bool enabled);
+    // Clock of the runs: the three settings above at once
+    struct Timing;
+    void setTiming(const Timing &timing);
+    void setEngine(Engine engine);
+    /** Instruction set and display of the machine (default: kChip8)
+     *
+     * Must be called before the rom is loaded: it sets the memory size, resets the display to low resolution and
+     * selects the quirks of the mode (defaultQuirks(), setQuirks() afterwards overrides them).
+     * Extended opcodes are unknown in kChip8 mode, so plain roms run exactly as before. kXoChip always runs on the
+     * switch engine, whatever setEngine() selected: its 4-byte instruction and 64 KB addresses do not fit the
+     * decoded caches.
+     */
+    void setMode(Mode mode);
+    Mode mode(void) const;
+    /** Behavior of the shifts, Fx55 / Fx65, Bnnn and the logic ops (default: defaultQuirks() of the mode)
+     *
+     * kCosmacVip always runs on the switch engine, as kXoChip does: the decoded caches and the JIT implement the
+     * modern and SUPER-CHIP behaviors only. The switch interpreter is instantiated once per quirks policy, so the
+     * choice costs no branch per instruction.
+     */
+    void setQuirks(Quirks quirks);
+    Quirks quirks(void) const;
+    // kSuperChip for Mode::kSuperChip, else kModern
+    static Quirks defaultQuirks(Mode mode);
+    // Command line names: chip8, schip, xochip and modern, vip, schip
+    static const char *name(Mode mode);
+    static const char *name(Quirks quirks);
+    // Seeds Cxkk (random). Instances are seeded from std::random_device by default.
+    void seed(uint64_t value);
+    // Resolution of the current frame: 64 x 32, or 128 x 64 in hi-res
+    uint32_t displayWidth(void) const;
+    uint32_t displayHeight(void) const;
+    // 64-bit hash of the current frame, to compare runs without keeping the pixels
+    uint64_t frameHash(void) const;
+    // Hash of count packed words of a frame (all its planes), the one frameHash() returns
+    static uint64_t hashFrame(const uint64_t *words, size_t count);
+    // Instructions executed since the rom was loaded, the clock of movies and key scripts
+    uint64_t instructionCount(void) const;
+    // True once the program ran 00FD (SUPER-CHIP exit): nothing more runs until a rom is loaded
+    bool halted(void) const;
+    // Writes V0 - VF, I, PC, DT and ST in hex on a single line
+    void dumpRegisters(std::ostream &out) const;
     static size_t displaySize(void);
 
     enum Opcodes {
         kClearScreen = 0x00E0,
         kReturn = 0x00EE,
+        // SUPER-CHIP / XO-CHIP opcodes started in 0x00 (00Cn and 00Dn carry n in their low nibble)
+        kScrollDown = 0x00C0,
+        kScrollUp = 0x00D0,
+        kScrollRight = 0x00FB,
+        kScrollLeft = 0x00FC,
+        kExit = 0x00FD,
+        kLowRes = 0x00FE,
+        kHighRes = 0x00FF,
         kJump = 0x01,
         kCall = 0x02,
         kSkipIfEqual = 0x03,
         kSkipIfNotEqual = 0x04,
         kSkipIfVxVyEqual = 0x05,
+        // XO-CHIP sub-opcodes for opcodes started in 0x05
+        kStoreRange = 0x02,
+        kLoadRange = 0x03,
         kSetVxReg = 0x06,
         kAddValueToVxReg = 0x07,
         kVRegOperation = 0x08,
@@ -57,73 +228,406 @@ public:
         kMiscFontChar = 0x29,
         kMiscStoreBcd = 0x33,
         kMiscStoreMemory = 0x55,
-        kMiscLoadMemory = 0x65
+        kMiscLoadMemory = 0x65,
+        // SUPER-CHIP / XO-CHIP sub-opcodes for opcodes started in 0x0F
+        kMiscLongIndex = 0x00,
+        kMiscSelectPlanes = 0x01,
+        kMiscAudioPattern = 0x02,
+        kMiscBigFontChar = 0x30,
+        kMiscSetPitch = 0x3A,
+        kMiscStoreFlags = 0x75,
+        kMiscLoadFlags = 0x85
     };
 
     // CHIP-8 display size if 64 x 32 pixels
     static constexpr size_t kDisplayWidth = 64;
     static constexpr size_t kDisplayHeight = 32;
+    // SUPER-CHIP / XO-CHIP hi-res display
+    static constexpr size_t kHiresWidth = 128;
+    static constexpr size_t kHiresHeight = 64;
+    // XO-CHIP bit-planes, the other modes only draw on the first one
+    static constexpr size_t kPlanes = 2;
+    // Words of a plane in hi-res, the largest frame
+    static constexpr size_t kPlaneWords = kHiresWidth / 64 * kHiresHeight;
+
+    // Snapshots hold the memory as pages shared between them (only the first 16 outside of XO-CHIP)
+    static constexpr size_t kPageSize = 256;
+    static constexpr size_t kPageCount = kXoMemorySize / kPageSize;
+    using Page = std::array<uint8_t, kPageSize>;
+
+    /*
+     * Complete machine state: registers, call stack, timers, memory, framebuffer, Fx0A wait and random
+     * generator. The display, keyboard, engine and decoded caches are not part of it.
+     *
+     * Memory pages are immutable and shared (copy-on-write): copying a snapshot copies page handles, and a
+     * snapshot taken from a machine only allocates the pages written since its previous snapshot() or
+     * restore(). A search explores its branches on one machine: snapshot() at the decision point, run a
+     * branch, restore() and run the next. Each branch costs the pages it dirties, restore() copies back only
+     * those, and the decoded caches of the code it did not write stay valid.
+     */
+    class Snapshot {
+    private:
+        friend class Chip8;
+
+        Register reg_;
+        std::array<std::shared_ptr<const Page>, kPageCount> pages_;
+        uint64_t screen_buffer_[kPlanes * kPlaneWords];
+        bool hires_;
+        uint8_t planes_;
+        uint8_t flags_[16];
+        uint8_t audio_pattern_[16];
+        uint8_t pitch_;
+        bool waiting_for_key_;
+        uint8_t wait_key_register_;
+        bool halted_;
+        Xoshiro256 rng_;
+    };
+
+    // Captures the state. Not const: the machine keeps the new pages to share them with the next snapshot.
+    Snapshot snapshot(void);
+    // Puts the machine back in the snapshot state (taken in the same mode), only the pages that differ are copied back
+    void restore(const Snapshot &state);
+
+    /** Writes the same state as a Snapshot as a flat byte image, for the rewind history
+     *
+     * The layout is only stable within one build: it is not meant to be stored in files.
+     */
+    void saveState(std::vector<uint8_t> *state) const;
+    // Throws Chip8Exception if state does not come from saveState()
+    void loadState(const std::vector<uint8_t> &state);
+
+    /** Records a save state on every 60 Hz tick, keeping at most capacity_bytes of delta-compressed history
+     *
+     * Unlike the rest of the emulation, this allocates as it runs (the entry list of the history grows).
+     */
+    void enableRewind(size_t capacity_bytes);
+    // nullptr until enableRewind() is called
+    const RewindBuffer *rewindBuffer(void) const;
+    /** Goes back the given number of recorded frames and renders the frame reached. The newer frames are dropped.
+     *
+     * Returns false (and changes nothing) when the history does not go back that far
+     */
+    bool rewind(size_t frames);
+
+    /** Records the seed, the input and the ticks of the following runs into movie, until stopRecording()
+     *
+     * Must be called right after the rom is loaded (throws Chip8Exception otherwise). The movie grows by an event
+     * per tick and key change, so recording allocates as it runs.
+     */
+    void record(Movie *movie);
+    void stopRecording(void);
+    /** Replays a movie recorded on the same rom, headless and without any throttling
+     *
+     * Must be called right after the rom is loaded. Throws Chip8Exception if the movie does not match the rom,
+     * the mode or the quirks, or goes out of sync.
+     */
+    RunStats replay(const Movie &movie);
+
+    /** Feeds every instruction executed from now on to profiler (not owned), until setProfiler(nullptr)
+     *
+     * While profiling, instructions are single-stepped through the switch engine whatever the engine selected,
+     * each one timed, and idle loops are executed rather than skipped. Without a profiler, the engines are
+     * untouched: execute() tests for it once per batch.
+     */
+    void setProfiler(Profiler *profiler);
+    /** Writes a record of every instruction executed from now on to trace (not owned), until setTrace(nullptr)
+     *
+     * Same execution path as the profiler: single-stepped through the switch engine, idle loops executed.
+     */
+    void setTrace(TraceBuffer *trace);
+    /** Plays the sound timer on audio, nullptr (the default) keeps the emulation silent
+     *
+     * audio gets a buzzerOn() / buzzerOff() call on every 60 Hz tick, and the XO-CHIP pattern and pitch
+     * whenever they change.
+     */
+    void setAudio(const std::shared_ptr<IAudio> &audio);
+
+    // 500 Hz CPU over a 60 Hz frame: the default budget of a frame
+    static constexpr uint64_t kInstructionsPerFrame = 8;
+    // Late frames run back to back up to this many, the older ones are skipped
+    static constexpr uint64_t kMaxCatchUpFrames = 6;
+
+    // --cpf, --costs and --no-idle-skip, the defaults being those of a new machine
+    struct Timing {
+        uint64_t cycles_per_frame = kInstructionsPerFrame;
+        std::array<uint8_t, 16> costs = {1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1};
+        bool idle_loop_skip = true;
+
+        // Every instruction takes one cycle
+        bool unitCosts(void) const;
+    };
 
 private:
+    friend class Chip8Bench;
+    friend class Chip8Jit;
+    friend class Chip8Lockstep;
+
+    // Leaf operations of the predecoded representation (one per instruction behavior)
+    enum OpKind : uint8_t {
+        kOpUndecoded = 0,
+        kOpUnknown,
+        kOpClearScreen,
+        kOpReturn,
+        kOpJump,
+        kOpCall,
+        kOpSkipIfEqual,
+        kOpSkipIfNotEqual,
+        kOpSkipIfVxVyEqual,
+        kOpSetVx,
+        kOpAddToVx,
+        kOpSetVxToVy,
+        kOpOrVxVy,
+        kOpAndVxVy,
+        kOpXorVxVy,
+        kOpAddVxVy,
+        kOpSubVxVy,
+        kOpShiftRightVx,
+        kOpSubnVxVy,
+        kOpShiftLeftVx,
+        kOpSkipIfVxVyNotEqual,
+        kOpSetIndex,
+        kOpJumpToAddrPlusV0,
+        kOpSetRandom,
+        kOpDisplayDraw,
+        kOpSkipIfKey,
+        kOpSkipIfNotKey,
+        kOpDelayTimerValue,
+        kOpWaitForKey,
+        kOpSetDelayTimer,
+        kOpSetSoundTimer,
+        kOpAddToIndex,
+        kOpFontChar,
+        kOpStoreBcd,
+        kOpStoreMemory,
+        kOpLoadMemory,
+        kOpNop,
+        // SUPER-CHIP, only decoded outside of kChip8 mode
+        kOpScrollDown,
+        kOpScrollRight,
+        kOpScrollLeft,
+        kOpExit,
+        kOpLowRes,
+        kOpHighRes,
+        kOpBigFontChar,
+        kOpStoreFlags,
+        kOpLoadFlags,
+        // Bxnn, decoded for the SUPER-CHIP quirks
+        kOpJumpToAddrPlusVx,
+        kOpCount
+    };
+
+    // Compact decoded instruction (8 bytes). kind selects the handler in kOpHandlers.
+    struct DecodedOp {
+        uint8_t kind;
+        uint8_t x;
+        uint8_t y;
+        uint8_t kk;
+        uint8_t n;
+        uint16_t nnn;
+    };
+
+    using OpHandler = void (*)(Chip8 &chip8, const DecodedOp &op);
+    static const OpHandler kOpHandlers[kOpCount];
+
+    // The engines run up to count instructions and return how many ran (less when parked on Fx0A)
+    uint64_t execute(uint64_t count);
+    // Runs up to cycles of the current frame (pollInput() first), returns the cycles elapsed, executed or parked
+    uint64_t runCycles(uint64_t cycles, RunStats *stats);
+    // Executes instructions until their costs reach cycles, returns the number executed and the cycles spent
+    uint64_t executeCycles(uint64_t cycles, uint64_t *spent);
+    // Skips the whole iterations of a delay timer busy-wait that fit in cycles, returns the instructions skipped
+    uint64_t skipIdleLoop(uint64_t cycles, uint64_t *spent);
+    // The switch interpreter, with the quirks of Policy (a Chip8Quirks.hpp struct) folded in at compile time
+    template <typename Policy>
+    uint64_t executeSwitch(uint64_t count);
+    uint64_t executePredecoded(uint64_t count);
+    uint64_t executeThreaded(uint64_t count);
+    uint64_t executeJit(uint64_t count);
+    // Single-steps through decodeInstruction(), feeding the profiler and / or the trace
+    uint64_t executeInstrumented(uint64_t count);
+    /** XO-CHIP roms never reach the decoded caches, so only the SUPER-CHIP opcodes are decoded for the other modes.
+     * Neither do the COSMAC VIP quirks: only the SUPER-CHIP Bxnn differs from the modern decoding.
+     */
+    static DecodedOp predecode(uint16_t opcode, Mode mode, Quirks quirks);
+    void invalidateDecoded(uint16_t address);
+    void writeMemory(uint16_t address, uint8_t value);
+    uint16_t readOpcode(uint16_t address) const;
+    uint8_t readMemory(uint16_t address) const;
+    // Words per row and per plane of the current resolution
+    uint32_t rowWords(void) const;
+    uint32_t planeWords(void) const;
+    void tick(void);
+    void render(void);
     void runDelayTimer(void);
     void runSoundTimer(void);
     void buzzerOn(void);
     void buzzerOff(void);
+    // Sends the XO-CHIP pattern and pitch to audio_ (the default tone outside of XO-CHIP)
+    void publishAudioPattern(void);
     uint16_t fetchInstruction(void);
+    // Executes opcode with the policy of quirks_
     void decodeInstruction(uint16_t opcode);
+    template <typename Policy>
+    void decodeInstruction(uint16_t opcode);
+    // 0nnn, 5xyn and Fxkk opcodes of SUPER-CHIP / XO-CHIP, returns false if opcode is not one of them
+    bool decodeExtended(uint16_t opcode);
     // Instructions
     void jump(uint16_t address);
     void callSubroutine(uint16_t address);
+    // Skips the next instruction, 4 bytes long when it is an XO-CHIP F000 nnnn
+    void skipNextInstruction(void);
     void skipIfEqual(uint8_t v_reg, uint8_t value);
     void skipIfNotEqual(uint8_t v_reg, uint8_t value);
     void setVxRegister(uint8_t v_reg, uint8_t value);
     void addValueToVxRegister(uint8_t v_reg, uint8_t value);
     void setIndexRegister(uint16_t value);
     void displayDraw(uint8_t x, uint8_t y, uint8_t n);
+    // Dxyn of the extended modes: any resolution, 16 x 16 sprites (n = 0) and one sprite per selected plane
+    void displayDrawExtended(uint8_t x, uint8_t y, uint8_t n);
     void clearScreen(void);
+    // Scrolls the selected planes by whole rows (memmove) or by 4 pixels (word shifts)
+    void scrollDown(uint8_t n);
+    void scrollUp(uint8_t n);
+    void scrollRight(void);
+    void scrollLeft(void);
+    void exitInterpreter(void);
+    void setHighRes(bool enabled);
     void returnFromSubroutine(void);
+    template <typename Policy>
     void runVRegOperation(uint8_t x, uint8_t y, uint8_t n);
+    void setVxToVy(uint8_t x, uint8_t y);
+    void orVxVy(uint8_t x, uint8_t y);
+    void andVxVy(uint8_t x, uint8_t y);
+    void xorVxVy(uint8_t x, uint8_t y);
+    void addVxVy(uint8_t x, uint8_t y);
+    void subVxVy(uint8_t x, uint8_t y);
+    // Vx = Vy shifted (y = x: Vx shifted in place)
+    void shiftRightVx(uint8_t x, uint8_t y);
+    void subnVxVy(uint8_t x, uint8_t y);
+    void shiftLeftVx(uint8_t x, uint8_t y);
     void skipNextIfVxVyEqual(uint8_t x, uint8_t y);
     void skipNextIfVxVyNotEqual(uint8_t x, uint8_t y);
     void jumpToAddrPlusV0(uint16_t address);
+    // SUPER-CHIP Bxnn: jumps to xnn + Vx
+    void jumpToAddrPlusVx(uint8_t x, uint16_t address);
     void setRandomByteToVx(uint8_t v_reg, uint8_t value);
     void skipNetIfKey(uint8_t x, uint8_t y, uint8_t n);
+    void skipIfKey(uint8_t x);
+    void skipIfNotKey(uint8_t x);
+    template <typename Policy>
     void decodeMisc(uint8_t x, uint8_t kk);
+    void setVxToDelayTimer(uint8_t x);
+    void waitForKey(uint8_t x);
+    void resumeWaitForKey(void);
+    void setVxToKey(uint8_t x, uint8_t keyValue);
+    void setDelayTimer(uint8_t x);
+    void setSoundTimer(uint8_t x);
+    void addVxToIndex(uint8_t x);
+    void setIndexToFontChar(uint8_t x);
+    void storeBcd(uint8_t x);
+    void storeRegisters(uint8_t x);
+    void loadRegisters(uint8_t x);
+    void setIndexToBigFontChar(uint8_t x);
+    void storeFlags(uint8_t x);
+    void loadFlags(uint8_t x);
+    void storeRange(uint8_t x, uint8_t y);
+    void loadRange(uint8_t x, uint8_t y);
+    void setLongIndex(void);
+    void selectPlanes(uint8_t x);
+    void loadAudioPattern(void);
+    void setPitch(uint8_t x);
     bool keyIsPressed(uint8_t x);
     bool getKey(uint8_t *keyValue);
-    bool isKeyChip8Valid(char value);
-    uint8_t convertKeyboardToChip8(char value);
-
-    // CHIP-8 Registers
-    struct Register {
-        // General purpose registers (V0 - VF)
-        uint8_t V[16];
-        // 12-bit I register (usually to point at locations in memory)
-        uint16_t I;
-        // Program Counter
-        uint16_t PC;
-        // Stack Pointer
-        uint8_t SP;
-        // Delay Timer
-        uint8_t DT;
-        // Sound Timer
-        uint8_t ST;
-        // Stack region
-        std::stack<uint16_t> stack;
-    };
+    // Latches the keyboard state, the only input the instructions see (and the one a movie records)
+    void pollInput(void);
+    void queueKeyEvent(const IKeyboard::Key &key);
+    // Hash of a 64 x 32 frame
+    static uint64_t hashFrame(const uint64_t *screen_rows);
+    // Writes only the bytes / rows that differ, so untouched code and rows stay decoded and clean
+    void restoreMemory(uint16_t address, const uint8_t *source, size_t size);
+    void restoreScreen(const uint64_t *screen_words, bool hires);
 
-    // CHIP-8 memory is 4 KB
-    static constexpr size_t kMemorySize = 4096;
     static constexpr size_t kMemoryStartOffsetDefault = 0x200;
     static constexpr uint8_t kSpritesMemLocation = 0x00;
+    // Hex sprites (0 - F), 5 bytes each
+    static const uint8_t kHexSprites[16 * 5];
+    // SUPER-CHIP / XO-CHIP big hex sprites (0 - F), 10 bytes each, right after the small ones
+    static constexpr uint8_t kBigSpritesMemLocation = 0x50;
+    static const uint8_t kBigHexSprites[16 * 10];
+    // RPL user flags kept by Fx75 (8 on the HP48, 16 on XO-CHIP)
+    static constexpr size_t kFlagsSize = 16;
+    // Key edges latched for Fx0A, the newer edges are dropped when it is full
+    static constexpr size_t kKeyEventsSize = 64;
     // 60 Hz = 16667 us (period)
     static constexpr int64_t kCpuPeriodUs = 16667;
 
     Register reg_;
-    uint8_t memory_[kMemorySize];
-    uint8_t screen_buffer_[kDisplayWidth * kDisplayHeight];
+    Mode mode_;
+    Quirks quirks_;
+    // kMemorySize - 1, or kXoMemorySize - 1 in XO-CHIP mode: addresses wrap around the memory of the mode
+    uint16_t memory_mask_;
+    uint8_t memory_[kXoMemorySize];
+    // Pages of the last snapshot taken or restored, memory_ still matches those whose dirty bit is clear
+    std::array<std::shared_ptr<const Page>, kPageCount> pages_;
+    // Bit N set when page N was written since (every page before the first snapshot)
+    std::bitset<kPageCount> dirty_pages_;
+    // Predecoded view of memory_, one entry per byte address (kOpUndecoded until first executed)
+    DecodedOp decoded_[kMemorySize];
+    Engine engine_;
+    uint64_t cycles_per_frame_;
+    std::array<uint8_t, 16> cycle_costs_;
+    // Every cost is 1: a budget of cycles is a number of instructions, run in a single engine batch
+    bool unit_costs_;
+    bool idle_loop_skip_;
+    // Set by Fx0A until a key is pressed, the key is then stored in V[wait_key_register_]
+    bool waiting_for_key_;
+    uint8_t wait_key_register_;
+    // Set by 00FD, run() and runHeadless() end and the engines stop on it
+    bool halted_;
+    // Per-instance generator, so concurrent instances do not share state
+    Xoshiro256 rng_;
+    uint64_t seed_;
+    // Instructions executed since the rom was loaded: the timestamps of a movie
+    uint64_t instructions_;
+    uint64_t rom_hash_;
+    // Input latched by pollInput()
+    uint16_t keys_;
+    IKeyboard::Key key_events_[kKeyEventsSize];
+    size_t key_events_head_;
+    size_t key_events_count_;
+    // Not owned, set between record() and stopRecording()
+    Movie *recording_;
+    // Not owned, set by setProfiler()
+    Profiler *profiler_;
+    // Not owned, set by setTrace()
+    TraceBuffer *trace_;
+    // Only allocated when the kJit engine is selected
+    std::unique_ptr<Chip8Jit> jit_;
+    // Only allocated by enableRewind()
+    std::unique_ptr<RewindBuffer> rewind_;
+    // Save state scratch of the rewind history
+    std::vector<uint8_t> rewind_state_;
+    /*
+     * One bit per pixel, rowWords() 64-bit words per row (1 in lo-res, 2 in hi-res), the leftmost pixel in the
+     * MSB of the first word. The planes follow each other, planeWords() apart: a lo-res CHIP-8 frame is the 32
+     * first words.
+     */
+    uint64_t screen_buffer_[kPlanes * kPlaneWords];
+    // Bit N set when row N changed since the last render
+    uint64_t dirty_rows_;
+    // 128 x 64 (00FF) instead of 64 x 32 (00FE)
+    bool hires_;
+    // Bit N set when plane N is drawn, cleared and scrolled (Fn01), 1 outside of XO-CHIP
+    uint8_t planes_;
+    // RPL user flags (Fx75 / Fx85)
+    uint8_t flags_[kFlagsSize];
+    // XO-CHIP audio: 128 one-bit samples (F002) played at 4000 * 2 ^ ((pitch - 64) / 48) Hz (Fx3A)
+    uint8_t audio_pattern_[16];
+    uint8_t pitch_;
     size_t memory_start_offset_;
     std::shared_ptr<IDisplay> display_;
     const std::shared_ptr<IKeyboard> keyboard_;
+    // Set by setAudio(), nullptr when silent
+    std::shared_ptr<IAudio> audio_;
 };
         
\ No newline at end of file
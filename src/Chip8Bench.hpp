@@ -0,0 +1,40 @@
+#pragma once
+
+#include "Chip8.hpp"
+
+#include <cstdint>
+
+/*
+ * Entry points into the private paths of Chip8 for the microbenchmarks (achip8emu_bench): the same code the
+ * engines run, without the frame loop around it.
+ */
+class Chip8Bench {
+public:
+    // Fetches and decodes count instructions, as the switch engine does
+    static void fetchDecode(Chip8 &chip8, uint64_t count) {
+        for (uint64_t i = 0; i < count; ++i) {
+            auto opcode = chip8.fetchInstruction();
+            chip8.decodeInstruction(opcode);
+        }
+    }
+
+    // Dxyn with Vx = x, Vy = y and the sprite at I
+    static void draw(Chip8 &chip8, uint8_t x, uint8_t y, uint8_t n, uint16_t sprite) {
+        chip8.reg_.V[0x0] = x;
+        chip8.reg_.V[0x1] = y;
+        chip8.reg_.I = sprite;
+        chip8.displayDraw(0x0, 0x1, n);
+    }
+
+    static void clearScreen(Chip8 &chip8) {
+        chip8.clearScreen();
+    }
+
+    // Every pixel on, every row dirty
+    static void fillScreen(Chip8 &chip8) {
+        for (size_t row = 0; row < Chip8::kDisplayHeight; ++row) {
+            chip8.screen_buffer_[row] = ~0ULL;
+        }
+        chip8.dirty_rows_ = ~0ULL;
+    }
+};
@@ -0,0 +1,357 @@
+#include "Chip8Jit.hpp"
+#include "Chip8.hpp"
+
+#include <cstring>
+#include <initializer_list>
+
+#if CHIP8_JIT
+#include <sys/mman.h>
+#endif
+
+namespace {
+
+/*
+ * Minimal x86-64 emitter. Register usage inside a block (System V arguments):
+ *   rdi = V registers, rsi = &I, rdx = remaining budget, rcx = &PC, r8 = memory
+ *   r11 = budget at entry, eax / r9d / r10d = scratch
+ */
+class Emitter {
+public:
+    explicit Emitter(uint8_t *code) : code_(code), size_(0) {}
+
+    size_t size(void) const { return size_; }
+
+    void bytes(std::initializer_list<uint8_t> values) {
+        for (auto value : values) {
+            code_[size_++] = value;
+        }
+    }
+
+    void imm16(uint16_t value) {
+        bytes({static_cast<uint8_t>(value), static_cast<uint8_t>(value >> 8)});
+    }
+
+    void imm32(uint32_t value) {
+        imm16(static_cast<uint16_t>(value));
+        imm16(static_cast<uint16_t>(value >> 16));
+    }
+
+    // movzx eax, byte [rdi + x]
+    void loadEax(uint8_t x) { bytes({0x0F, 0xB6, 0x47, x}); }
+    // movzx r9d, byte [rdi + y]
+    void loadR9(uint8_t y) { bytes({0x44, 0x0F, 0xB6, 0x4F, y}); }
+    // mov byte [rdi + x], al
+    void storeAl(uint8_t x) { bytes({0x88, 0x47, x}); }
+    // mov word [rcx], pc
+    void storePc(uint16_t pc) { bytes({0x66, 0xC7, 0x01}); imm16(pc); }
+    // dec rdx
+    void decBudget(void) { bytes({0x48, 0xFF, 0xCA}); }
+
+    // Emits a rel32 jump/jcc and returns the offset to patch
+    size_t jumpRel32(std::initializer_list<uint8_t> opcode) {
+        bytes(opcode);
+        auto patch = size_;
+        imm32(0);
+        return patch;
+    }
+
+    void patchRel32(size_t patch, size_t target) {
+        auto rel = static_cast<uint32_t>(static_cast<int32_t>(target) - static_cast<int32_t>(patch + 4));
+        std::memcpy(&code_[patch], &rel, sizeof(rel));
+    }
+
+private:
+    uint8_t *code_;
+    size_t size_;
+};
+
+}  // namespace
+
+Chip8Jit::Chip8Jit() : code_(nullptr), code_used_(0) {
+#if CHIP8_JIT
+    void *code = mmap(nullptr, kCodeBufferSize, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code != MAP_FAILED) {
+        code_ = static_cast<uint8_t *>(code);
+    }
+#endif
+    std::memset(blocks_, 0, sizeof(blocks_));
+    std::memset(coverage_, 0, sizeof(coverage_));
+}
+
+Chip8Jit::~Chip8Jit() {
+#if CHIP8_JIT
+    if (code_) {
+        munmap(code_, kCodeBufferSize);
+    }
+#endif
+}
+
+Chip8Jit::BlockFn Chip8Jit::lookup(const Chip8 &chip8, uint16_t address) {
+    address &= (kAddressSpace - 1);
+    auto &block = blocks_[address];
+    if (block.end) {
+        return block.fn;
+    }
+
+    // Start over when the code buffer cannot hold another block of maximum size
+    if (code_used_ + kMaxBlockCodeSize > kCodeBufferSize) {
+        flush();
+    }
+
+    uint16_t end = 0;
+    block.fn = translate(chip8, address, &end);
+    // Untranslatable addresses are cached too (fn == nullptr), covering their instruction
+    block.end = end;
+    for (auto i = address; i < end; ++i) {
+        ++coverage_[i];
+    }
+
+    return block.fn;
+}
+
+void Chip8Jit::flush(void) {
+    std::memset(blocks_, 0, sizeof(blocks_));
+    std::memset(coverage_, 0, sizeof(coverage_));
+    code_used_ = 0;
+}
+
+void Chip8Jit::invalidateRange(uint16_t address) {
+    address &= (kAddressSpace - 1);
+    // A block covering address can start at most kMaxBlockInstructions instructions before it
+    size_t first = address >= 2 * kMaxBlockInstructions ? address - 2 * kMaxBlockInstructions : 0;
+    for (size_t start = first; start <= address; ++start) {
+        if (blocks_[start].end > address) {
+            dropBlock(start);
+        }
+    }
+}
+
+void Chip8Jit::dropBlock(uint16_t address) {
+    auto &block = blocks_[address];
+    for (auto i = address; i < block.end; ++i) {
+        --coverage_[i];
+    }
+    // The native code is not reclaimed until the next flush()
+    block.fn = nullptr;
+    block.end = 0;
+}
+
+Chip8Jit::BlockFn Chip8Jit::translate(const Chip8 &chip8, uint16_t address, uint16_t *end) {
+    *end = address + 2u <= kAddressSpace ? address + 2 : kAddressSpace;
+    if (!code_) {
+        return nullptr;
+    }
+
+    Emitter e(code_ + code_used_);
+    // Each instruction adds at most two exits, the block end one more: no allocation while translating
+    size_t exit_patches[2 * kMaxBlockInstructions + 1];
+    size_t exit_count = 0;
+    auto addExit = [&](size_t patch) { exit_patches[exit_count++] = patch; };
+    uint16_t pc = address;
+    size_t translated = 0;
+
+    // mov r11, rdx (budget at entry, to compute the executed count on exit)
+    e.bytes({0x49, 0x89, 0xD3});
+    auto body = e.size();
+
+    // Runs after each translated instruction: stops at the budget, with PC pointing at the next one
+    auto checkBudget = [&](uint16_t next_pc) {
+        e.decBudget();
+        // jnz over the exit stub (storePc + jmp rel32 = 10 bytes)
+        e.bytes({0x75, 0x0A});
+        e.storePc(next_pc);
+        addExit(e.jumpRel32({0xE9}));
+    };
+
+    // Ends a block whose last instruction already stored the next PC
+    auto endWithStoredPc = [&](bool may_loop) {
+        e.decBudget();
+        addExit(e.jumpRel32({0x0F, 0x84}));
+        if (may_loop) {
+            // cmp word [rcx], address ; je body
+            e.bytes({0x66, 0x81, 0x39});
+            e.imm16(address);
+            e.patchRel32(e.jumpRel32({0x0F, 0x84}), body);
+        }
+        addExit(e.jumpRel32({0xE9}));
+    };
+
+    bool terminated = false;
+    // The size check keeps the block within the space lookup() reserved, whatever the instructions translated
+    while (!terminated && translated < kMaxBlockInstructions && pc + 1u < kAddressSpace &&
+           e.size() + kMaxInstructionCodeSize + kBlockOverheadSize <= kMaxBlockCodeSize) {
+        auto op = Chip8::predecode(chip8.readOpcode(pc), chip8.mode_, chip8.quirks_);
+        uint16_t next_pc = pc + 2;
+
+        switch (op.kind) {
+            case Chip8::kOpSetVx:
+                // mov byte [rdi + x], kk
+                e.bytes({0xC6, 0x47, op.x, op.kk});
+                break;
+            case Chip8::kOpAddToVx:
+                // add byte [rdi + x], kk
+                e.bytes({0x80, 0x47, op.x, op.kk});
+                break;
+            case Chip8::kOpSetVxToVy:
+                e.loadEax(op.y);
+                e.storeAl(op.x);
+                break;
+            case Chip8::kOpOrVxVy:
+            case Chip8::kOpAndVxVy:
+            case Chip8::kOpXorVxVy:
+                e.loadEax(op.x);
+                e.loadR9(op.y);
+                // or / and / xor eax, r9d
+                e.bytes({0x44, static_cast<uint8_t>(op.kind == Chip8::kOpOrVxVy ? 0x09 :
+                                                    op.kind == Chip8::kOpAndVxVy ? 0x21 : 0x31), 0xC8});
+                e.storeAl(op.x);
+                break;
+            case Chip8::kOpAddVxVy:
+                e.loadEax(op.x);
+                e.loadR9(op.y);
+                // add eax, r9d
+                e.bytes({0x44, 0x01, 0xC8});
+                e.storeAl(op.x);
+                // shr eax, 8 ; and eax, 1 ; mov [rdi + 15], al
+                e.bytes({0xC1, 0xE8, 0x08, 0x83, 0xE0, 0x01});
+                e.storeAl(0x0F);
+                break;
+            case Chip8::kOpSubVxVy:
+            case Chip8::kOpSubnVxVy: {
+                // VF is written first, then the operands are read again (as the interpreter does)
+                uint8_t a = op.kind == Chip8::kOpSubVxVy ? op.x : op.y;
+                uint8_t b = op.kind == Chip8::kOpSubVxVy ? op.y : op.x;
+                e.loadEax(a);
+                e.loadR9(b);
+                // cmp eax, r9d ; seta r10b ; mov [rdi + 15], r10b
+                e.bytes({0x44, 0x39, 0xC8, 0x41, 0x0F, 0x97, 0xC2, 0x44, 0x88, 0x57, 0x0F});
+                e.loadEax(a);
+                e.loadR9(b);
+                // sub eax, r9d
+                e.bytes({0x44, 0x29, 0xC8});
+                e.storeAl(op.x);
+                break;
+            }
+            case Chip8::kOpShiftRightVx:
+                e.loadEax(op.x);
+                // and eax, 1
+                e.bytes({0x83, 0xE0, 0x01});
+                e.storeAl(0x0F);
+                e.loadEax(op.x);
+                // shr eax, 1
+                e.bytes({0xD1, 0xE8});
+                e.storeAl(op.x);
+                break;
+            case Chip8::kOpShiftLeftVx:
+                e.loadEax(op.x);
+                // and eax, 0x80
+                e.bytes({0x25, 0x80, 0x00, 0x00, 0x00});
+                e.storeAl(0x0F);
+                e.loadEax(op.x);
+                // shl eax, 1
+                e.bytes({0xD1, 0xE0});
+                e.storeAl(op.x);
+                break;
+            case Chip8::kOpSetIndex:
+                // mov word [rsi], nnn
+                e.bytes({0x66, 0xC7, 0x06});
+                e.imm16(op.nnn);
+                break;
+            case Chip8::kOpAddToIndex:
+                e.loadEax(op.x);
+                // add word [rsi], ax
+                e.bytes({0x66, 0x01, 0x06});
+                break;
+            case Chip8::kOpLoadMemory:
+                // movzx eax, word [rsi]
+                e.bytes({0x0F, 0xB7, 0x06});
+                for (uint8_t i = 0; i <= op.x; ++i) {
+                    // lea r10d, [rax + i] ; and r10d, 0xFFF (addresses wrap at 4 KB)
+                    e.bytes({0x44, 0x8D, 0x50, i, 0x41, 0x81, 0xE2});
+                    e.imm32(kAddressSpace - 1);
+                    // movzx r9d, byte [r8 + r10] ; mov [rdi + i], r9b
+                    e.bytes({0x47, 0x0F, 0xB6, 0x0C, 0x10, 0x44, 0x88, 0x4F, i});
+                }
+                break;
+            case Chip8::kOpNop:
+                break;
+            case Chip8::kOpJump:
+                e.storePc(op.nnn);
+                endWithStoredPc(op.nnn == address);
+                terminated = true;
+                break;
+            case Chip8::kOpJumpToAddrPlusV0:
+            case Chip8::kOpJumpToAddrPlusVx:
+                // movzx eax, byte [rdi + 0 or x] ; add eax, nnn ; mov [rcx], ax
+                e.loadEax(op.kind == Chip8::kOpJumpToAddrPlusVx ? op.x : 0x00);
+                e.bytes({0x05});
+                e.imm32(op.nnn);
+                e.bytes({0x66, 0x89, 0x01});
+                endWithStoredPc(false);
+                terminated = true;
+                break;
+            case Chip8::kOpSkipIfEqual:
+            case Chip8::kOpSkipIfNotEqual:
+            case Chip8::kOpSkipIfVxVyEqual:
+            case Chip8::kOpSkipIfVxVyNotEqual: {
+                e.storePc(pc + 2);
+                if (op.kind == Chip8::kOpSkipIfEqual || op.kind == Chip8::kOpSkipIfNotEqual) {
+                    // cmp byte [rdi + x], kk
+                    e.bytes({0x80, 0x7F, op.x, op.kk});
+                } else {
+                    // movzx eax, byte [rdi + x] ; cmp al, byte [rdi + y]
+                    e.loadEax(op.x);
+                    e.bytes({0x3A, 0x47, op.y});
+                }
+                bool skip_if_equal = op.kind == Chip8::kOpSkipIfEqual || op.kind == Chip8::kOpSkipIfVxVyEqual;
+                // jne / je over the second storePc (5 bytes)
+                e.bytes({static_cast<uint8_t>(skip_if_equal ? 0x75 : 0x74), 0x05});
+                e.storePc(pc + 4);
+                endWithStoredPc(pc + 2 == address || pc + 4 == address);
+                terminated = true;
+                break;
+            }
+            default:
+                // Interpreter only: the block ends right before this instruction
+                if (!translated) {
+                    return nullptr;
+                }
+                e.storePc(pc);
+                addExit(e.jumpRel32({0xE9}));
+                terminated = true;
+                next_pc = pc;
+                break;
+        }
+
+        if (next_pc != pc) {
+            ++translated;
+            pc = next_pc;
+            if (!terminated) {
+                checkBudget(pc);
+            }
+        }
+    }
+
+    if (!translated) {
+        return nullptr;
+    }
+
+    if (!terminated) {
+        // Reached the block size limit: PC already points at the next instruction
+        e.storePc(pc);
+        addExit(e.jumpRel32({0xE9}));
+    }
+
+    // Common exit: return the number of instructions executed (r11 - rdx)
+    auto exit_offset = e.size();
+    for (size_t i = 0; i < exit_count; ++i) {
+        e.patchRel32(exit_patches[i], exit_offset);
+    }
+    // mov rax, r11 ; sub rax, rdx ; ret
+    e.bytes({0x4C, 0x89, 0xD8, 0x48, 0x29, 0xD0, 0xC3});
+
+    auto fn = reinterpret_cast<BlockFn>(code_ + code_used_);
+    code_used_ += e.size();
+    *end = pc;
+    return fn;
+}
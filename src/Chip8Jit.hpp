@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+class Chip8;
+
+// CHIP8_JIT is set when the host can run the x86-64 basic-block recompiler
+#if defined(__x86_64__) && defined(__linux__)
+#define CHIP8_JIT 1
+#else
+#define CHIP8_JIT 0
+#endif
+
+/*
+ * Basic-block recompiler for the Chip8 core.
+ *
+ * A block starts at a PC and runs until a jump, skip or an instruction that must go through the
+ * interpreter (timers, keyboard, draw, calls, random, BCD/stores...). ALU, index and register load
+ * instructions are translated to native x86-64 code working on the Chip8 registers and memory.
+ * Translated blocks are cached by address and dropped when a memory write hits their range.
+ */
+class Chip8Jit {
+public:
+    /** Native block entry
+     *
+     * @param v pointer to V0 - VF
+     * @param i pointer to the I register
+     * @param budget maximum number of instructions to run (> 0)
+     * @param pc pointer to the program counter, updated when the block exits
+     * @param memory pointer to the CHIP-8 memory
+     *
+     * Returns the number of instructions executed
+     */
+    using BlockFn = uint64_t (*)(uint8_t *v, uint16_t *i, uint64_t budget, uint16_t *pc, uint8_t *memory);
+
+    Chip8Jit();
+    virtual ~Chip8Jit();
+
+    /** Returns the translated block starting at address, translating it on first use
+     *
+     * Returns nullptr if the instruction at address must be run by the interpreter
+     */
+    BlockFn lookup(const Chip8 &chip8, uint16_t address);
+
+    // Drops every block covering address (called on each memory write)
+    void invalidate(uint16_t address) {
+        if (coverage_[address & (kAddressSpace - 1)]) {
+            invalidateRange(address);
+        }
+    }
+
+    // Drops every translated block
+    void flush(void);
+
+private:
+    // Covers the 4 KB CHIP-8 address space
+    static constexpr size_t kAddressSpace = 4096;
+    static constexpr size_t kMaxBlockInstructions = 64;
+    // Largest translation of one instruction: Fx65 with x = F (3 + 16 * 20 bytes) and its budget check (15 bytes)
+    static constexpr size_t kMaxInstructionCodeSize = 3 + 16 * 20 + 15;
+    // Prologue (3 bytes), PC store and jump of the block end (10 bytes) and the common exit (7 bytes)
+    static constexpr size_t kBlockOverheadSize = 3 + 10 + 7;
+    static constexpr size_t kMaxBlockCodeSize = kMaxBlockInstructions * kMaxInstructionCodeSize + kBlockOverheadSize;
+    static constexpr size_t kCodeBufferSize = 1024 * 1024;
+
+    struct Block {
+        BlockFn fn;
+        // One past the last byte translated. 0 when there is no block at this address.
+        uint16_t end;
+    };
+
+    BlockFn translate(const Chip8 &chip8, uint16_t address, uint16_t *end);
+    void invalidateRange(uint16_t address);
+    void dropBlock(uint16_t address);
+
+    uint8_t *code_;
+    size_t code_used_;
+    Block blocks_[kAddressSpace];
+    // Number of blocks covering each byte address
+    uint8_t coverage_[kAddressSpace];
+};
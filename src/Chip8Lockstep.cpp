@@ -0,0 +1,707 @@
+#include "Chip8Lockstep.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <random>
+#include <type_traits>
+
+namespace {
+
+constexpr size_t kLanes = Chip8Lockstep::kLanes;
+
+/*
+ * A row holds one register for every lane. It is stored as an array of native vectors (16 bytes with
+ * SSE2 / NEON, 32 bytes with AVX2) so each operation maps to one SIMD instruction per vector: the
+ * compilers split wider generic vectors element by element for comparisons.
+ */
+#if defined(__GNUC__)
+#if !defined(__clang__)
+// The vectors only go through inline functions of this file, their calling convention does not matter
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+#if defined(__AVX2__)
+constexpr size_t kVectorBytes = 32;
+#define CHIP8_WIDEN_LOW 0, 32, 1, 33, 2, 34, 3, 35, 4, 36, 5, 37, 6, 38, 7, 39, \
+                        8, 40, 9, 41, 10, 42, 11, 43, 12, 44, 13, 45, 14, 46, 15, 47
+#define CHIP8_WIDEN_HIGH 16, 48, 17, 49, 18, 50, 19, 51, 20, 52, 21, 53, 22, 54, 23, 55, \
+                         24, 56, 25, 57, 26, 58, 27, 59, 28, 60, 29, 61, 30, 62, 31, 63
+#else
+constexpr size_t kVectorBytes = 16;
+#define CHIP8_WIDEN_LOW 0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23
+#define CHIP8_WIDEN_HIGH 8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31
+#endif
+
+// GCC/Clang vector extensions
+template <typename E> struct Native;
+template <> struct Native<uint8_t> { typedef uint8_t type __attribute__((vector_size(kVectorBytes))); };
+template <> struct Native<int8_t> { typedef int8_t type __attribute__((vector_size(kVectorBytes))); };
+template <> struct Native<uint16_t> { typedef uint16_t type __attribute__((vector_size(kVectorBytes))); };
+template <> struct Native<int16_t> { typedef int16_t type __attribute__((vector_size(kVectorBytes))); };
+
+// Vector comparisons already give -1 (all bits set) or 0 per lane
+template <typename M>
+inline M laneTrue(M mask) { return mask; }
+
+// Interleaves the first (low) or second (high) half of the lanes of a and b
+template <typename V>
+inline V interleaveLow(V a, V b) {
+#if defined(__clang__)
+    return __builtin_shufflevector(a, b, CHIP8_WIDEN_LOW);
+#else
+    return __builtin_shuffle(a, b, (typename Native<uint8_t>::type){CHIP8_WIDEN_LOW});
+#endif
+}
+
+template <typename V>
+inline V interleaveHigh(V a, V b) {
+#if defined(__clang__)
+    return __builtin_shufflevector(a, b, CHIP8_WIDEN_HIGH);
+#else
+    return __builtin_shuffle(a, b, (typename Native<uint8_t>::type){CHIP8_WIDEN_HIGH});
+#endif
+}
+#undef CHIP8_WIDEN_LOW
+#undef CHIP8_WIDEN_HIGH
+
+inline size_t lowestLane(uint32_t lanes) { return __builtin_ctz(lanes); }
+#else
+// No vector extensions: one lane per element, left to the auto-vectorizer
+template <typename E> struct Native { typedef E type; };
+
+inline int laneTrue(bool value) { return -static_cast<int>(value); }
+
+inline size_t lowestLane(uint32_t lanes) {
+    size_t lane = 0;
+    while (!(lanes & 1)) {
+        lanes >>= 1;
+        ++lane;
+    }
+    return lane;
+}
+#endif
+
+template <typename E>
+struct Row {
+    typedef typename Native<E>::type Vector;
+    static constexpr size_t kVectors = kLanes * sizeof(E) / sizeof(Vector);
+    Vector v[kVectors];
+};
+
+#define CHIP8_ROW_OP(op)                                                                    \
+    template <typename E>                                                                   \
+    inline Row<E> operator op(const Row<E> &a, const Row<E> &b) {                           \
+        Row<E> r;                                                                           \
+        for (size_t i = 0; i < Row<E>::kVectors; ++i) r.v[i] = a.v[i] op b.v[i];            \
+        return r;                                                                           \
+    }                                                                                       \
+    template <typename E>                                                                   \
+    inline Row<E> operator op(const Row<E> &a, typename std::common_type<E>::type b) {      \
+        Row<E> r;                                                                           \
+        for (size_t i = 0; i < Row<E>::kVectors; ++i) r.v[i] = a.v[i] op b;                 \
+        return r;                                                                           \
+    }
+CHIP8_ROW_OP(+)
+CHIP8_ROW_OP(-)
+CHIP8_ROW_OP(&)
+CHIP8_ROW_OP(|)
+CHIP8_ROW_OP(^)
+CHIP8_ROW_OP(<<)
+CHIP8_ROW_OP(>>)
+#undef CHIP8_ROW_OP
+
+// Comparisons give a mask row: -1 (all bits set) or 0 per lane
+#define CHIP8_ROW_CMP(op)                                                                   \
+    template <typename E>                                                                   \
+    inline Row<std::make_signed_t<E>> operator op(const Row<E> &a, const Row<E> &b) {       \
+        Row<std::make_signed_t<E>> r;                                                       \
+        for (size_t i = 0; i < Row<E>::kVectors; ++i) r.v[i] = laneTrue(a.v[i] op b.v[i]); \
+        return r;                                                                           \
+    }                                                                                       \
+    template <typename E>                                                                   \
+    inline Row<std::make_signed_t<E>> operator op(const Row<E> &a, typename std::common_type<E>::type b) { \
+        Row<std::make_signed_t<E>> r;                                                       \
+        for (size_t i = 0; i < Row<E>::kVectors; ++i) r.v[i] = laneTrue(a.v[i] op b);      \
+        return r;                                                                           \
+    }
+CHIP8_ROW_CMP(==)
+CHIP8_ROW_CMP(!=)
+CHIP8_ROW_CMP(>)
+CHIP8_ROW_CMP(<)
+#undef CHIP8_ROW_CMP
+
+template <typename E>
+inline Row<E> operator~(const Row<E> &a) {
+    Row<E> r;
+    for (size_t i = 0; i < Row<E>::kVectors; ++i) r.v[i] = ~a.v[i];
+    return r;
+}
+
+typedef Row<uint8_t> Bytes;
+typedef Row<int8_t> Mask8;
+typedef Row<uint16_t> Words;
+typedef Row<int16_t> Mask16;
+
+/*
+ * Rows are only moved vector by vector: copying a whole row at once goes through general purpose
+ * registers, and the vector loads that follow stall on store forwarding.
+ */
+
+// Same bits, unsigned lanes (a cast between vectors of the same size keeps the bits)
+inline Bytes asBytes(const Mask8 &mask) {
+    Bytes r;
+    for (size_t i = 0; i < Bytes::kVectors; ++i) r.v[i] = (Bytes::Vector)mask.v[i];
+    return r;
+}
+
+inline Words asWords(const Mask16 &mask) {
+    Words r;
+    for (size_t i = 0; i < Words::kVectors; ++i) r.v[i] = (Words::Vector)mask.v[i];
+    return r;
+}
+
+#if defined(__GNUC__)
+// Zero extends each lane (little-endian: the low byte of a 16-bit lane comes first)
+inline Words widen(const Bytes &value) {
+    Words r;
+    Bytes::Vector zero = {};
+    for (size_t i = 0; i < Bytes::kVectors; ++i) {
+        r.v[2 * i] = (Words::Vector)interleaveLow(value.v[i], zero);
+        r.v[2 * i + 1] = (Words::Vector)interleaveHigh(value.v[i], zero);
+    }
+    return r;
+}
+
+// Sign extends each lane: -1 stays -1
+inline Mask16 widen(const Mask8 &mask) {
+    Mask16 r;
+    for (size_t i = 0; i < Mask8::kVectors; ++i) {
+        r.v[2 * i] = (Mask16::Vector)interleaveLow(mask.v[i], mask.v[i]);
+        r.v[2 * i + 1] = (Mask16::Vector)interleaveHigh(mask.v[i], mask.v[i]);
+    }
+    return r;
+}
+#else
+inline Words widen(const Bytes &value) {
+    Words r;
+    for (size_t i = 0; i < kLanes; ++i) r.v[i] = value.v[i];
+    return r;
+}
+
+inline Mask16 widen(const Mask8 &mask) {
+    Mask16 r;
+    for (size_t i = 0; i < kLanes; ++i) r.v[i] = mask.v[i];
+    return r;
+}
+#endif
+
+inline Bytes broadcast(uint8_t value) {
+    Bytes r = {};
+    return r + value;
+}
+
+inline Words broadcast(uint16_t value) {
+    Words r = {};
+    return r + value;
+}
+
+template <typename E>
+inline Row<E> load(const E *row) {
+    Row<E> r;
+    for (size_t i = 0; i < Row<E>::kVectors; ++i) {
+        std::memcpy(&r.v[i], reinterpret_cast<const uint8_t *>(row) + i * sizeof(r.v[i]), sizeof(r.v[i]));
+    }
+    return r;
+}
+
+template <typename E>
+inline void store(E *row, const Row<E> &value) {
+    for (size_t i = 0; i < Row<E>::kVectors; ++i) {
+        std::memcpy(reinterpret_cast<uint8_t *>(row) + i * sizeof(value.v[i]), &value.v[i], sizeof(value.v[i]));
+    }
+}
+
+// Lanes with their bit set in the mask take value, the others keep row
+inline Bytes select(const Mask8 &mask, const Bytes &value, const Bytes &row) {
+    return (value & asBytes(mask)) | (row & ~asBytes(mask));
+}
+
+inline Words select(const Mask16 &mask, const Words &value, const Words &row) {
+    return (value & asWords(mask)) | (row & ~asWords(mask));
+}
+
+// Bit of each lane in its byte of the lane bitmap
+inline Bytes laneBits(void) {
+    uint8_t bits[kLanes];
+    for (size_t lane = 0; lane < kLanes; ++lane) {
+        bits[lane] = static_cast<uint8_t>(1 << (lane % 8));
+    }
+    return load(bits);
+}
+
+const Bytes kLaneBits = laneBits();
+// Every lane set. The lanes past Chip8Lockstep::lanes() are never read, so they can be written too.
+const Mask8 kAllLanes = broadcast(static_cast<uint8_t>(0)) == static_cast<uint8_t>(0);
+const Mask16 kAllLanes16 = broadcast(static_cast<uint16_t>(0)) == static_cast<uint16_t>(0);
+
+inline Mask8 laneMask(uint32_t lanes) {
+    // Copies byte N of the bitmap into the lanes 8N to 8N + 7, then keeps the bit of each lane
+    uint64_t spread[kLanes / 8];
+    for (size_t i = 0; i < kLanes / 8; ++i) {
+        spread[i] = ((lanes >> (i * 8)) & 0xFF) * 0x0101010101010101ULL;
+    }
+    auto bytes = load(reinterpret_cast<const uint8_t *>(spread));
+    return (bytes & kLaneBits) != static_cast<uint8_t>(0);
+}
+
+// True when no lane of the mask is set
+inline bool none(const Mask16 &mask) {
+    auto any = mask.v[0];
+    for (size_t i = 1; i < Mask16::kVectors; ++i) {
+        any |= mask.v[i];
+    }
+    uint64_t words[sizeof(any) / sizeof(uint64_t)];
+    std::memcpy(words, &any, sizeof(any));
+    uint64_t bits = 0;
+    for (auto word : words) {
+        bits |= word;
+    }
+    return !bits;
+}
+
+}  // namespace
+
+Chip8Lockstep::Chip8Lockstep(size_t lanes) :
+    lanes_(lanes),
+    all_lanes_(0),
+    parked_(0),
+    shared_code_(false),
+    written_pages_(0),
+    cycles_per_frame_(Chip8::kInstructionsPerFrame),
+    steps_(0),
+    frames_(0),
+    groups_(0),
+    wall_time_s_(0.0) {
+    if (lanes_ == 0 || lanes_ > kLanes) {
+        throw Chip8::Chip8Exception("Invalid number of lanes: " + std::to_string(lanes));
+    }
+    all_lanes_ = lanes_ == 32 ? ~0U : (1U << lanes_) - 1;
+
+    std::memset(V_, 0, sizeof(V_));
+    std::memset(I_, 0, sizeof(I_));
+    std::memset(PC_, 0, sizeof(PC_));
+    std::memset(DT_, 0, sizeof(DT_));
+    std::memset(ST_, 0, sizeof(ST_));
+    std::memset(SP_, 0, sizeof(SP_));
+    std::memset(stack_, 0, sizeof(stack_));
+    std::memset(wait_key_register_, 0, sizeof(wait_key_register_));
+    std::memset(keys_, 0, sizeof(keys_));
+    std::memset(wait_cycles_, 0, sizeof(wait_cycles_));
+    std::memset(memory_, 0, sizeof(memory_));
+    std::memset(screen_buffer_, 0, sizeof(screen_buffer_));
+    for (size_t lane = 0; lane < kLanes; ++lane) {
+        std::memcpy(&memory_[lane][Chip8::kSpritesMemLocation], Chip8::kHexSprites, sizeof(Chip8::kHexSprites));
+        std::random_device device;
+        rng_[lane].seed((static_cast<uint64_t>(device()) << 32) | device());
+    }
+}
+
+size_t Chip8Lockstep::lanes(void) const {
+    return lanes_;
+}
+
+void Chip8Lockstep::loadRom(const std::vector<uint8_t> &rom) {
+    for (size_t lane = 0; lane < lanes_; ++lane) {
+        loadRom(lane, rom);
+    }
+    shared_code_ = true;
+    written_pages_ = 0;
+}
+
+void Chip8Lockstep::loadRom(size_t lane, const std::vector<uint8_t> &rom) {
+    if (rom.size() > Chip8::kMemorySize - Chip8::kMemoryStartOffsetDefault) {
+        throw Chip8::Chip8Exception("File too large: " + std::to_string(rom.size()) +  " bytes");
+    }
+
+    PC_[lane] = Chip8::kMemoryStartOffsetDefault;
+    std::memcpy(&memory_[lane][Chip8::kMemoryStartOffsetDefault], rom.data(), rom.size());
+    shared_code_ = false;
+}
+
+void Chip8Lockstep::seed(size_t lane, uint64_t value) {
+    rng_[lane].seed(value);
+}
+
+void Chip8Lockstep::setKeys(size_t lane, uint16_t keys) {
+    keys_[lane] = keys;
+}
+
+void Chip8Lockstep::setCyclesPerFrame(uint64_t cycles) {
+    if (!cycles) {
+        throw Chip8::Chip8Exception("A frame needs at least one cycle");
+    }
+    cycles_per_frame_ = cycles;
+}
+
+Chip8::RunStats Chip8Lockstep::run(uint64_t max_instructions, uint64_t max_frames) {
+    steps_ = 0;
+    frames_ = 0;
+    groups_ = 0;
+    std::memset(wait_cycles_, 0, sizeof(wait_cycles_));
+    auto start_time = std::chrono::steady_clock::now();
+
+    resumeParked();
+    while ((!max_instructions || steps_ < max_instructions) &&
+           (!max_frames || frames_ < max_frames)) {
+        step();
+        ++steps_;
+
+        // Same virtual 60 Hz frames as Chip8::runHeadless()
+        if (steps_ % cycles_per_frame_ == 0) {
+            tick();
+            ++frames_;
+            resumeParked();
+        }
+    }
+
+    std::chrono::duration<double> wall_time = std::chrono::steady_clock::now() - start_time;
+    wall_time_s_ = wall_time.count();
+
+    Chip8::RunStats stats = {};
+    for (size_t lane = 0; lane < lanes_; ++lane) {
+        auto lane_stats = laneStats(lane);
+        stats.instructions += lane_stats.instructions;
+        stats.wait_cycles += lane_stats.wait_cycles;
+    }
+    stats.frames = frames_;
+    stats.wall_time_s = wall_time_s_;
+    return stats;
+}
+
+Chip8::RunStats Chip8Lockstep::laneStats(size_t lane) const {
+    Chip8::RunStats stats = {};
+    stats.instructions = steps_ - wait_cycles_[lane];
+    stats.wait_cycles = wait_cycles_[lane];
+    stats.frames = frames_;
+    stats.wall_time_s = wall_time_s_;
+    return stats;
+}
+
+uint64_t Chip8Lockstep::groups(void) const {
+    return groups_;
+}
+
+uint64_t Chip8Lockstep::frameHash(size_t lane) const {
+    return Chip8::hashFrame(screen_buffer_[lane]);
+}
+
+void Chip8Lockstep::dumpRegisters(size_t lane, std::ostream &out) const {
+    // Same format as Chip8::dumpRegisters()
+    auto flags = out.flags();
+    auto fill = out.fill();
+
+    out << std::hex << std::uppercase << std::setfill('0') << "V=";
+    for (size_t i = 0; i < 16; ++i) {
+        out << std::setw(2) << int(V_[i][lane]);
+    }
+    out << " I=" << std::setw(3) << I_[lane] << " PC=" << std::setw(3) << PC_[lane]
+        << " DT=" << std::setw(2) << int(DT_[lane]) << " ST=" << std::setw(2) << int(ST_[lane]);
+
+    out.flags(flags);
+    out.fill(fill);
+}
+
+void Chip8Lockstep::step(void) {
+    constexpr uint16_t kAddressMask = Chip8::kMemorySize - 1;
+    auto running = all_lanes_ & ~parked_;
+
+    for (auto lanes = parked_; lanes; lanes &= lanes - 1) {
+        ++wait_cycles_[lowestLane(lanes)];
+    }
+    if (!running) {
+        return;
+    }
+
+    auto running_mask = running == all_lanes_ ? kAllLanes16 : widen(laneMask(running));
+    auto pc = load(PC_);
+    auto leader = lowestLane(running);
+    uint16_t leader_pc = PC_[leader] & kAddressMask;
+    uint16_t next_pc = (leader_pc + 1) & kAddressMask;
+
+    // Fast path: one fetch when every lane is at the same PC, in code that is still the same in all lanes
+    uint64_t pages = (1ULL << (leader_pc / 64)) | (1ULL << (next_pc / 64));
+    if (shared_code_ && !(written_pages_ & pages) && none(((pc & kAddressMask) != leader_pc) & running_mask)) {
+        store(PC_, pc + (asWords(running_mask) & 2));
+        ++groups_;
+        execute(static_cast<uint16_t>((memory_[leader][leader_pc] << 8) | memory_[leader][next_pc]), running);
+        return;
+    }
+
+    // Each lane fetches from its own memory: code may have been overwritten differently per lane
+    uint16_t opcodes[kLanes];
+    for (size_t lane = 0; lane < lanes_; ++lane) {
+        opcodes[lane] = static_cast<uint16_t>((memory_[lane][PC_[lane] & kAddressMask] << 8) |
+                                              memory_[lane][(PC_[lane] + 1) & kAddressMask]);
+    }
+    store(PC_, pc + (asWords(running_mask) & 2));
+
+    // Group the lanes by opcode: a single group as long as the lanes do not diverge
+    auto pending = running;
+    while (pending) {
+        auto opcode = opcodes[lowestLane(pending)];
+        uint32_t group = 0;
+        for (auto lanes = pending; lanes; lanes &= lanes - 1) {
+            auto lane = lowestLane(lanes);
+            if (opcodes[lane] == opcode) {
+                group |= 1U << lane;
+            }
+        }
+        pending &= ~group;
+        ++groups_;
+        execute(opcode, group);
+    }
+}
+
+void Chip8Lockstep::execute(uint16_t opcode, uint32_t group) {
+    uint8_t x = static_cast<uint8_t>((opcode >> 8) & 0x000F);
+    uint8_t y = static_cast<uint8_t>((opcode >> 4) & 0x000F);
+    uint8_t kk = static_cast<uint8_t>(opcode & 0x00FF);
+    uint16_t nnn = opcode & 0x0FFF;
+    uint8_t n = static_cast<uint8_t>(opcode & 0x000F);
+
+    // No divergence: every lane runs, the masks are constant
+    bool all = group == all_lanes_;
+    auto mask = all ? kAllLanes : laneMask(group);
+    auto mask16 = [&mask, all]() { return all ? kAllLanes16 : widen(mask); };
+
+    // Register rows are reloaded by each statement: an operation may write VF before reading Vx / Vy
+    auto V = [this](uint8_t r) { return load(V_[r]); };
+    auto setV = [this, &mask](uint8_t r, const Bytes &value) { store(V_[r], select(mask, value, load(V_[r]))); };
+    auto setRow = [&mask](uint8_t *row, const Bytes &value) { store(row, select(mask, value, load(row))); };
+    auto setRow16 = [&mask16](uint16_t *row, const Words &value) { store(row, select(mask16(), value, load(row))); };
+    auto skipIf = [this, &mask](const Mask8 &condition) {
+        store(PC_, load(PC_) + (asWords(widen(condition & mask)) & 2));
+    };
+    auto scalar = [this, opcode, group]() {
+        for (auto lanes = group; lanes; lanes &= lanes - 1) {
+            executeScalar(opcode, lowestLane(lanes));
+        }
+    };
+
+    switch ((opcode >> 12) & 0x000F) {
+        case Chip8::kJump:
+            setRow16(PC_, broadcast(nnn));
+            break;
+        case Chip8::kSkipIfEqual:
+            skipIf(V(x) == kk);
+            break;
+        case Chip8::kSkipIfNotEqual:
+            skipIf(V(x) != kk);
+            break;
+        case Chip8::kSkipIfVxVyEqual:
+            skipIf(V(x) == V(y));
+            break;
+        case Chip8::kSetVxReg:
+            setV(x, broadcast(kk));
+            break;
+        case Chip8::kAddValueToVxReg:
+            setV(x, V(x) + kk);
+            break;
+        case Chip8::kVRegOperation:
+            switch (n) {
+                case 0x00:
+                    setV(x, V(y));
+                    break;
+                case 0x01:
+                    setV(x, V(x) | V(y));
+                    break;
+                case 0x02:
+                    setV(x, V(x) & V(y));
+                    break;
+                case 0x03:
+                    setV(x, V(x) ^ V(y));
+                    break;
+                case 0x04: {
+                    auto sum = V(x) + V(y);
+                    auto carry = asBytes(sum < V(x)) & 1;
+                    setV(x, sum);
+                    setV(0xF, carry);
+                    break;
+                }
+                case 0x05:
+                    setV(0xF, asBytes(V(x) > V(y)) & 1);
+                    setV(x, V(x) - V(y));
+                    break;
+                case 0x06:
+                    setV(0xF, V(x) & 0x01);
+                    setV(x, V(x) >> 1);
+                    break;
+                case 0x07:
+                    setV(0xF, asBytes(V(y) > V(x)) & 1);
+                    setV(x, V(y) - V(x));
+                    break;
+                case 0x0E:
+                    setV(0xF, V(x) & 0x80);
+                    setV(x, V(x) << 1);
+                    break;
+                default:
+                    break;
+            }
+            break;
+        case Chip8::kSkipIfVxVyNotEqual:
+            skipIf(V(x) != V(y));
+            break;
+        case Chip8::kSetIndexRegI:
+            setRow16(I_, broadcast(nnn));
+            break;
+        case Chip8::kJumpToAddrPlusV0:
+            setRow16(PC_, widen(V(0)) + nnn);
+            break;
+        case Chip8::kMisc:
+            switch (kk) {
+                case Chip8::kMiscDelayTimerValue:
+                    setV(x, load(DT_));
+                    break;
+                case Chip8::kMiscSetDelayTimer:
+                    setRow(DT_, V(x));
+                    break;
+                case Chip8::kMiscSetSoundTimer:
+                    setRow(ST_, V(x));
+                    break;
+                case Chip8::kMiscAddToIndex:
+                    setRow16(I_, load(I_) + widen(V(x)));
+                    break;
+                case Chip8::kMiscWaitForKey:
+                case Chip8::kMiscFontChar:
+                case Chip8::kMiscStoreBcd:
+                case Chip8::kMiscStoreMemory:
+                case Chip8::kMiscLoadMemory:
+                    scalar();
+                    break;
+                default:
+                    break;
+            }
+            break;
+        default:
+            // Screen, stack, random, keyboard: one lane at a time
+            scalar();
+            break;
+    }
+}
+
+void Chip8Lockstep::executeScalar(uint16_t opcode, size_t lane) {
+    constexpr uint16_t kAddressMask = Chip8::kMemorySize - 1;
+    uint8_t x = static_cast<uint8_t>((opcode >> 8) & 0x000F);
+    uint8_t y = static_cast<uint8_t>((opcode >> 4) & 0x000F);
+    uint8_t kk = static_cast<uint8_t>(opcode & 0x00FF);
+    uint16_t nnn = opcode & 0x0FFF;
+    uint8_t n = static_cast<uint8_t>(opcode & 0x000F);
+    auto &pc = PC_[lane];
+    auto &index = I_[lane];
+    auto *memory = memory_[lane];
+
+    switch ((opcode >> 12) & 0x000F) {
+        case 0x00:
+            if (opcode == Chip8::kClearScreen) {
+                std::memset(screen_buffer_[lane], 0, sizeof(screen_buffer_[lane]));
+            } else if (opcode == Chip8::kReturn) {
+                --SP_[lane];
+                pc = stack_[lane][SP_[lane] % kStackDepth];
+            }
+            break;
+        case Chip8::kCall:
+            stack_[lane][SP_[lane] % kStackDepth] = pc;
+            ++SP_[lane];
+            pc = nnn;
+            break;
+        case Chip8::kSetRandom:
+            V_[x][lane] = rng_[lane].nextByte() & kk;
+            break;
+        case Chip8::kDisplayDraw: {
+            // Same clipping and collision rules as Chip8::displayDraw()
+            uint8_t display_x_pos = V_[x][lane] % Chip8::kDisplayWidth;
+            uint8_t display_y_pos = V_[y][lane] % Chip8::kDisplayHeight;
+            V_[0xF][lane] = 0x00;
+            for (uint32_t i = 0; i < n && display_y_pos < Chip8::kDisplayHeight; ++i, ++display_y_pos) {
+                uint64_t sprite_row = (static_cast<uint64_t>(memory[(index + i) & kAddressMask])
+                                       << (Chip8::kDisplayWidth - 8)) >> display_x_pos;
+                auto &screen_row = screen_buffer_[lane][display_y_pos];
+                if (screen_row & sprite_row) {
+                    V_[0xF][lane] = 0x01;
+                }
+                screen_row ^= sprite_row;
+            }
+            break;
+        }
+        case Chip8::kSkipNetIfKey: {
+            bool pressed = (keys_[lane] >> (V_[x][lane] & 0x0F)) & 0x01;
+            if ((y == 0x09 && n == 0x0E && pressed) || (y == 0x0A && n == 0x01 && !pressed)) {
+                pc += 2;
+            }
+            break;
+        }
+        case Chip8::kMisc:
+            switch (kk) {
+                case Chip8::kMiscWaitForKey:
+                    if (keys_[lane]) {
+                        V_[x][lane] = static_cast<uint8_t>(lowestLane(keys_[lane]));
+                    } else {
+                        parked_ |= 1U << lane;
+                        wait_key_register_[lane] = x;
+                    }
+                    break;
+                case Chip8::kMiscFontChar:
+                    index = memory[(V_[x][lane] * 5) & kAddressMask];
+                    break;
+                case Chip8::kMiscStoreBcd: {
+                    markWritten(index, 3);
+                    uint8_t value = V_[x][lane];
+                    memory[(index + 2) & kAddressMask] = value % 10;
+                    value /= 10;
+                    memory[(index + 1) & kAddressMask] = value % 10;
+                    value /= 10;
+                    memory[index & kAddressMask] = value % 10;
+                    break;
+                }
+                case Chip8::kMiscStoreMemory:
+                    markWritten(index, x + 1);
+                    for (uint8_t i = 0; i <= x; ++i) {
+                        memory[(index + i) & kAddressMask] = V_[i][lane];
+                    }
+                    break;
+                case Chip8::kMiscLoadMemory:
+                    for (uint8_t i = 0; i <= x; ++i) {
+                        V_[i][lane] = memory[(index + i) & kAddressMask];
+                    }
+                    break;
+                default:
+                    break;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+void Chip8Lockstep::markWritten(uint16_t address, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        written_pages_ |= 1ULL << (((address + i) & (Chip8::kMemorySize - 1)) / 64);
+    }
+}
+
+void Chip8Lockstep::tick(void) {
+    // Adding the -1 / 0 mask decrements the timers that are not 0 yet
+    store(DT_, load(DT_) + asBytes(load(DT_) != 0));
+    store(ST_, load(ST_) + asBytes(load(ST_) != 0));
+}
+
+void Chip8Lockstep::resumeParked(void) {
+    for (auto lanes = parked_; lanes; lanes &= lanes - 1) {
+        auto lane = lowestLane(lanes);
+        if (keys_[lane]) {
+            V_[wait_key_register_[lane]][lane] = static_cast<uint8_t>(lowestLane(keys_[lane]));
+            parked_ &= ~(1U << lane);
+        }
+    }
+}
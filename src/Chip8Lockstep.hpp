@@ -0,0 +1,101 @@
+#pragma once
+
+#include "Chip8.hpp"
+#include "Xoshiro256.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+/*
+ * Runs up to kLanes independent headless CHIP-8 machines in lockstep.
+ *
+ * The registers are stored as structure-of-arrays (one row of kLanes values per register), so an
+ * instruction is executed for every lane at once with vector operations: ALU, skips, jumps, index and
+ * timer instructions update whole rows under a lane mask. Each step, the lanes are grouped by opcode
+ * (not by PC), so lanes that diverged but run the same instruction still share one dispatch. While all
+ * the lanes are at the same PC in code no lane wrote to, the opcode is fetched once for all. Memory,
+ * draw, call/return, random and keyboard instructions go through a scalar loop over the lanes of the
+ * group.
+ *
+ * Every lane produces the same state as a scalar Chip8 running headless with the same rom and seed.
+ * There is no keyboard: each lane has a fixed key bitmap (setKeys), Fx0A takes its lowest key and
+ * parks the lane while the bitmap is empty. Unknown opcodes are silently ignored.
+ */
+class Chip8Lockstep {
+public:
+    // One 256-bit vector of 8-bit registers
+    static constexpr size_t kLanes = 32;
+
+    // lanes: number of machines run (1 - kLanes)
+    explicit Chip8Lockstep(size_t lanes);
+    virtual ~Chip8Lockstep() {}
+
+    size_t lanes(void) const;
+    // Loads the same rom in every lane
+    void loadRom(const std::vector<uint8_t> &rom);
+    void loadRom(size_t lane, const std::vector<uint8_t> &rom);
+    void seed(size_t lane, uint64_t value);
+    // Bit N set when key N is held down, for the whole run
+    void setKeys(size_t lane, uint16_t keys);
+    // Instructions per 60 Hz frame (default: Chip8::kInstructionsPerFrame). Every instruction takes one cycle.
+    void setCyclesPerFrame(uint64_t cycles);
+
+    /** Runs every lane until one of the budgets is reached, same budgets as Chip8::runHeadless()
+     *
+     * Returns the totals over all lanes (instructions and wait cycles are summed)
+     */
+    Chip8::RunStats run(uint64_t max_instructions, uint64_t max_frames);
+    // Stats of a single lane for the last run
+    Chip8::RunStats laneStats(size_t lane) const;
+    // Number of grouped dispatches in the last run: steps when the lanes never diverge
+    uint64_t groups(void) const;
+
+    uint64_t frameHash(size_t lane) const;
+    void dumpRegisters(size_t lane, std::ostream &out) const;
+
+private:
+    // Depth of the call stack of each lane, SP wraps around it like in Chip8
+    static constexpr size_t kStackDepth = Chip8::kStackDepth;
+
+    void step(void);
+    void execute(uint16_t opcode, uint32_t group);
+    void executeScalar(uint16_t opcode, size_t lane);
+    void markWritten(uint16_t address, size_t size);
+    void tick(void);
+    void resumeParked(void);
+
+    size_t lanes_;
+    // Bit N set for lane N, for every lane in use
+    uint32_t all_lanes_;
+    // Lanes parked on Fx0A
+    uint32_t parked_;
+    // Every lane was loaded with the same rom
+    bool shared_code_;
+    // Bit N set once a lane wrote into the 64-byte page N: lanes may hold different code there
+    uint64_t written_pages_;
+
+    // Structure-of-arrays registers, one row per register
+    alignas(32) uint8_t V_[16][kLanes];
+    alignas(32) uint16_t I_[kLanes];
+    alignas(32) uint16_t PC_[kLanes];
+    alignas(32) uint8_t DT_[kLanes];
+    alignas(32) uint8_t ST_[kLanes];
+
+    // Per lane state only touched by the scalar instructions
+    uint8_t SP_[kLanes];
+    uint16_t stack_[kLanes][kStackDepth];
+    uint8_t wait_key_register_[kLanes];
+    uint16_t keys_[kLanes];
+    uint64_t wait_cycles_[kLanes];
+    uint8_t memory_[kLanes][Chip8::kMemorySize];
+    uint64_t screen_buffer_[kLanes][Chip8::kDisplayHeight];
+    Xoshiro256 rng_[kLanes];
+
+    uint64_t cycles_per_frame_;
+    uint64_t steps_;
+    uint64_t frames_;
+    uint64_t groups_;
+    double wall_time_s_;
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+/*
+ * Behavior variants of the CHIP-8 interpreters, as compile-time policies for the switch interpreter of Chip8
+ * (Chip8::Quirks picks one). Every member is a constexpr bool, so the branches on them are folded away by the
+ * compiler.
+ *
+ *     kShiftUsesVy          8xy6 / 8xyE shift Vy into Vx (instead of shifting Vx in place)
+ *     kLoadStoreIncrementsI Fx55 / Fx65 leave I at I + x + 1 (instead of unchanged)
+ *     kJumpUsesVx           Bxnn jumps to xnn + Vx (instead of Bnnn to nnn + V0)
+ *     kLogicResetsVf        8xy1 / 8xy2 / 8xy3 clear VF
+ */
+
+// Original COSMAC VIP interpreter
+struct CosmacVipQuirks {
+    static constexpr bool kShiftUsesVy = true;
+    static constexpr bool kLoadStoreIncrementsI = true;
+    static constexpr bool kJumpUsesVx = false;
+    static constexpr bool kLogicResetsVf = true;
+};
+
+// SUPER-CHIP 1.1 (HP48)
+struct SuperChipQuirks {
+    static constexpr bool kShiftUsesVy = false;
+    static constexpr bool kLoadStoreIncrementsI = false;
+    static constexpr bool kJumpUsesVx = true;
+    static constexpr bool kLogicResetsVf = false;
+};
+
+// What most modern roms expect, and what every engine of Chip8 implements
+struct ModernQuirks {
+    static constexpr bool kShiftUsesVy = false;
+    static constexpr bool kLoadStoreIncrementsI = false;
+    static constexpr bool kJumpUsesVx = false;
+    static constexpr bool kLogicResetsVf = false;
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "Chip8.hpp"
+#include "IDisplay.hpp"
+
+#include <cstdint>
+#include <vector>
+
+// Display that keeps a hash of every frame instead of its pixels. Used to compare headless runs against goldens.
+class HashingDisplay final : public IDisplay {
+public:
+    // Frame number (0 = first render) and hash of a frame that differs from the one before it
+    struct Change {
+        uint64_t frame;
+        uint64_t hash;
+
+        bool operator==(const Change &other) const { return frame == other.frame && hash == other.hash; }
+        bool operator!=(const Change &other) const { return !(*this == other); }
+    };
+
+    HashingDisplay() : frames_(0) {}
+    virtual ~HashingDisplay() {}
+
+    void renderPacked(const uint64_t *screen_rows, uint32_t width, uint32_t height, uint64_t dirty_rows) override {
+        renderPlanes(screen_rows, width, height, 1, dirty_rows);
+    }
+
+    // Same hash as Chip8::frameHash() for the frame rendered
+    void renderPlanes(const uint64_t *screen_rows, uint32_t width, uint32_t height, uint32_t planes,
+                      uint64_t dirty_rows) override {
+        // An identical frame (no dirty row) keeps the previous hash
+        if (dirty_rows || changes_.empty()) {
+            auto hash = Chip8::hashFrame(screen_rows, static_cast<size_t>(width / 64) * height * planes);
+            if (changes_.empty() || changes_.back().hash != hash) {
+                changes_.push_back({frames_, hash});
+            }
+        }
+        ++frames_;
+    }
+
+    // Frames rendered so far
+    uint64_t frames(void) const { return frames_; }
+    const std::vector<Change> &changes(void) const { return changes_; }
+
+private:
+    uint64_t frames_;
+    std::vector<Change> changes_;
+};
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+
+class IAudio {
+public:
+    IAudio() {}
+    virtual ~IAudio() {}
+
+    /** Sounds the buzzer, called on each 60 Hz tick while the sound timer runs
+     * 
+     * Called from the CPU thread, must not block
+     */
+    virtual void buzzerOn(void) {};
+
+    /** Silences the buzzer, called on each 60 Hz tick while the sound timer is 0
+     * 
+     */
+    virtual void buzzerOff(void) {};
+
+    /** Replaces the buzzer tone with a 1-bit sample pattern (XO-CHIP F002 / Fx3A)
+     * 
+     * @param pattern 16 bytes, 128 samples played in a loop, the first one in the MSB of the first byte,
+     *                or nullptr to go back to the default square wave
+     * @param rate in samples per second
+     * 
+     * Called from the CPU thread, must not block
+     */
+    virtual void setPattern(const uint8_t *pattern, float rate) {};
+};
@@ -1,7 +1,9 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <exception>
+#include <vector>
 
 class IDisplay {
 public:
@@ -24,8 +26,51 @@ public:
      */
     virtual void render(uint8_t *screen_buffer) {};
 
+    /** Renders a bit-packed frame on the screen
+     * 
+     * @param screen_rows one bit per pixel, width / 64 words per row, leftmost pixel in the MSB
+     * @param width in pixels (multiple of 64)
+     * @param height in pixels
+     * @param dirty_rows bit N set when row N changed since the previous call (0 = identical frame)
+     * 
+     * The default implementation expands the pixels to one byte each and calls render()
+     */
+    virtual void renderPacked(const uint64_t *screen_rows, uint32_t width, uint32_t height, uint64_t dirty_rows) {
+        expanded_.resize(static_cast<size_t>(width) * height);
+        for (uint32_t i = 0; i < expanded_.size(); ++i) {
+            expanded_[i] = (screen_rows[i / 64] >> (63 - (i % 64))) & 0x01;
+        }
+        render(expanded_.data());
+    };
+
+    /** Renders a frame made of several bit-planes, the color of a pixel indexed by its bits in each plane
+     * 
+     * @param screen_rows the planes one after the other, each laid out as in renderPacked()
+     * @param width in pixels (multiple of 64)
+     * @param height in pixels
+     * @param planes number of planes
+     * @param dirty_rows bit N set when row N changed in any plane since the previous call
+     * 
+     * The default implementation renders the union of the planes through renderPacked()
+     */
+    virtual void renderPlanes(const uint64_t *screen_rows, uint32_t width, uint32_t height, uint32_t planes,
+                              uint64_t dirty_rows) {
+        size_t plane_words = static_cast<size_t>(width / 64) * height;
+        merged_.assign(screen_rows, screen_rows + plane_words);
+        for (uint32_t plane = 1; plane < planes; ++plane) {
+            for (size_t i = 0; i < plane_words; ++i) {
+                merged_[i] |= screen_rows[plane * plane_words + i];
+            }
+        }
+        renderPacked(merged_.data(), width, height, dirty_rows);
+    };
+
     /** Clears the entire screen
      * 
      */
     virtual void clear(void) {};
+
+private:
+    std::vector<uint8_t> expanded_;
+    std::vector<uint64_t> merged_;
 };
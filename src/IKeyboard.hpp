@@ -1,10 +1,15 @@
 #pragma once
 
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
 class IKeyboard {
 public:
     IKeyboard() {}
     virtual ~IKeyboard() {}
 
+    // Key-down / key-up edge of a CHIP-8 key
     struct Key {
         enum class State {
             kReleased = 1,
@@ -12,9 +17,37 @@ public:
         };
 
         State state;
-        char value;
+        // CHIP-8 hex key (0x0 - 0xF)
+        uint8_t value;
     };
 
-    virtual Key getKey(void) = 0;
+    /** Returns the keys currently held down
+     * 
+     * Bit N is set while the CHIP-8 key N is pressed
+     */
+    virtual uint16_t pressedKeys(void) = 0;
+
+    /** Pops the oldest key edge
+     * 
+     * @param key receives the edge
+     * 
+     * Returns false when there is no pending edge
+     */
+    virtual bool getKeyEvent(Key *key) = 0;
+
     virtual bool quitClicked(void) = 0;
+
+    // True while the user holds the rewind key: the session plays its history backwards
+    virtual bool rewindHeld(void) { return false; }
+
+    /** Sleeps until deadline, or less if a key edge or a quit request arrives
+     * 
+     * @param deadline latest wake up time
+     * 
+     * Returns true when woken up by an event that happened since the previous call
+     */
+    virtual bool waitForEvent(std::chrono::steady_clock::time_point deadline) {
+        std::this_thread::sleep_until(deadline);
+        return false;
+    }
 };
@@ -0,0 +1,181 @@
+#include "Movie.hpp"
+
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+static const char kMovieMagic[] = "achip8emu-movie";
+static constexpr int kMovieVersion = 2;
+
+Movie::Movie() :
+    seed_(0),
+    rom_hash_(0),
+    end_(0) {}
+
+void Movie::setSeed(uint64_t seed) {
+    seed_ = seed;
+}
+
+uint64_t Movie::seed(void) const {
+    return seed_;
+}
+
+void Movie::setRomHash(uint64_t hash) {
+    rom_hash_ = hash;
+}
+
+uint64_t Movie::romHash(void) const {
+    return rom_hash_;
+}
+
+void Movie::setMode(const std::string &mode) {
+    mode_ = mode;
+}
+
+const std::string &Movie::mode(void) const {
+    return mode_;
+}
+
+void Movie::setQuirks(const std::string &quirks) {
+    quirks_ = quirks;
+}
+
+const std::string &Movie::quirks(void) const {
+    return quirks_;
+}
+
+void Movie::addTick(uint64_t instruction) {
+    Event event = {};
+    event.type = Event::Type::kTick;
+    event.instruction = instruction;
+    events_.push_back(event);
+}
+
+void Movie::addKeys(uint64_t instruction, uint16_t keys, const IKeyboard::Key *edge) {
+    Event event = {};
+    event.type = Event::Type::kKeys;
+    event.instruction = instruction;
+    event.keys = keys;
+    if (edge) {
+        event.has_edge = true;
+        event.edge = *edge;
+    }
+    events_.push_back(event);
+}
+
+void Movie::setEnd(uint64_t instruction) {
+    end_ = instruction;
+}
+
+uint64_t Movie::end(void) const {
+    return end_;
+}
+
+const std::vector<Movie::Event> &Movie::events(void) const {
+    return events_;
+}
+
+void Movie::save(const std::string &path) const {
+    std::ofstream f(path.c_str(), std::ios::out | std::ios::trunc);
+    if (!f.good()) {
+        throw std::runtime_error("Failed to write movie " + path);
+    }
+
+    f << kMovieMagic << " " << kMovieVersion << "\n";
+    f << "seed " << seed_ << "\n";
+    f << "rom " << std::hex << std::setfill('0') << std::setw(16) << rom_hash_ << std::dec << "\n";
+    f << "mode " << mode_ << "\n";
+    f << "quirks " << quirks_ << "\n";
+    for (const auto &event : events_) {
+        if (event.type == Event::Type::kTick) {
+            f << "t " << event.instruction << "\n";
+            continue;
+        }
+
+        f << "k " << event.instruction << " " << std::hex << std::uppercase << std::setw(4) << event.keys;
+        if (event.has_edge) {
+            f << " " << (event.edge.state == IKeyboard::Key::State::kPressed ? '+' : '-') << int(event.edge.value);
+        }
+        f << std::dec << std::nouppercase << "\n";
+    }
+    f << "end " << end_ << "\n";
+
+    if (!f.good()) {
+        throw std::runtime_error("Failed to write movie " + path);
+    }
+}
+
+Movie Movie::load(const std::string &path) {
+    std::ifstream f(path.c_str(), std::ios::in);
+    if (!f.good()) {
+        throw std::runtime_error("Failed to load movie " + path);
+    }
+
+    Movie movie;
+    std::string line;
+    std::string magic;
+    int version = 0;
+    if (!std::getline(f, line) || !(std::istringstream(line) >> magic >> version) || magic != kMovieMagic ||
+        version != kMovieVersion) {
+        throw std::runtime_error("Not a movie: " + path);
+    }
+
+    bool ended = false;
+    for (size_t number = 2; std::getline(f, line); ++number) {
+        std::istringstream fields(line);
+        std::string tag;
+        if (!(fields >> tag)) {
+            continue;
+        }
+
+        bool ok = true;
+        if (tag == "seed") {
+            ok = static_cast<bool>(fields >> movie.seed_);
+        } else if (tag == "rom") {
+            ok = static_cast<bool>(fields >> std::hex >> movie.rom_hash_);
+        } else if (tag == "mode") {
+            ok = static_cast<bool>(fields >> movie.mode_);
+        } else if (tag == "quirks") {
+            ok = static_cast<bool>(fields >> movie.quirks_);
+        } else if (tag == "end") {
+            ok = static_cast<bool>(fields >> movie.end_);
+            ended = true;
+        } else if (tag == "t") {
+            uint64_t instruction = 0;
+            ok = static_cast<bool>(fields >> instruction);
+            movie.addTick(instruction);
+        } else if (tag == "k") {
+            uint64_t instruction = 0;
+            unsigned keys = 0;
+            std::string edge;
+            ok = static_cast<bool>(fields >> instruction >> std::hex >> keys >> std::dec) && keys <= 0xFFFF;
+            if (ok && fields >> edge) {
+                // Edge: '+' or '-' and the key in hex
+                IKeyboard::Key key;
+                unsigned value = 0;
+                std::istringstream key_value(edge.substr(1));
+                ok = (edge[0] == '+' || edge[0] == '-') && (key_value >> std::hex >> value) && value <= 0x0F;
+                key.state = edge[0] == '+' ? IKeyboard::Key::State::kPressed : IKeyboard::Key::State::kReleased;
+                key.value = static_cast<uint8_t>(value);
+                movie.addKeys(instruction, static_cast<uint16_t>(keys), &key);
+            } else {
+                movie.addKeys(instruction, static_cast<uint16_t>(keys), nullptr);
+            }
+        } else {
+            ok = false;
+        }
+
+        // Events must come in instruction order
+        auto count = movie.events_.size();
+        bool ordered = count < 2 || movie.events_[count - 1].instruction >= movie.events_[count - 2].instruction;
+        if (!ok || !ordered) {
+            throw std::runtime_error(path + ":" + std::to_string(number) + ": invalid movie line \"" + line + "\"");
+        }
+    }
+
+    if (!ended || movie.mode_.empty() || movie.quirks_.empty()) {
+        throw std::runtime_error("Truncated movie: " + path);
+    }
+    return movie;
+}
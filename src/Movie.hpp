@@ -0,0 +1,72 @@
+#pragma once
+
+#include "IKeyboard.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * Recording of a session: the random seed and the machine (mode and quirks), plus every 60 Hz tick and every
+ * input change, timestamped by the number of instructions executed before it. Replaying it on the same rom and
+ * machine reproduces the run exactly, whatever the engine and the host speed.
+ *
+ * Files are plain text, one event per line:
+ *     achip8emu-movie 2
+ *     seed <decimal>
+ *     rom <16 hex digits hash>
+ *     mode <chip8|schip|xochip>            instruction set
+ *     quirks <modern|vip|schip>            quirks policy
+ *     t <instruction>                      tick
+ *     k <instruction> <4 hex digits> [+K|-K] keys held, and the hex key K pressed (+) or released (-)
+ *     end <instruction>
+ */
+class Movie {
+public:
+    struct Event {
+        enum class Type : uint8_t {
+            kTick,
+            kKeys
+        };
+
+        Type type;
+        uint64_t instruction;
+        // kKeys: keys held from this event on (bit N = key N)
+        uint16_t keys;
+        // kKeys: the key edge delivered with this event, if any
+        bool has_edge;
+        IKeyboard::Key edge;
+    };
+
+    Movie();
+    virtual ~Movie() {}
+
+    void setSeed(uint64_t seed);
+    uint64_t seed(void) const;
+    void setRomHash(uint64_t hash);
+    uint64_t romHash(void) const;
+    // Names of the Chip8::Mode and Chip8::Quirks of the recording (Chip8::name())
+    void setMode(const std::string &mode);
+    const std::string &mode(void) const;
+    void setQuirks(const std::string &quirks);
+    const std::string &quirks(void) const;
+
+    void addTick(uint64_t instruction);
+    void addKeys(uint64_t instruction, uint16_t keys, const IKeyboard::Key *edge);
+    // Instruction count at which the recording stopped
+    void setEnd(uint64_t instruction);
+    uint64_t end(void) const;
+    const std::vector<Event> &events(void) const;
+
+    // Throw std::runtime_error on I/O or format errors
+    void save(const std::string &path) const;
+    static Movie load(const std::string &path);
+
+private:
+    uint64_t seed_;
+    uint64_t rom_hash_;
+    std::string mode_;
+    std::string quirks_;
+    uint64_t end_;
+    std::vector<Event> events_;
+};
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "IDisplay.hpp"
+
+// Display that discards every frame. Used to run the core headless (no SDL window).
+class NullDisplay final : public IDisplay {
+public:
+    NullDisplay() {}
+    virtual ~NullDisplay() {}
+
+    void draw(uint32_t x_pos, uint32_t y_pos) override {}
+    void render(uint8_t *screen_buffer) override {}
+    void renderPacked(const uint64_t *screen_rows, uint32_t width, uint32_t height, uint64_t dirty_rows) override {}
+    void renderPlanes(const uint64_t *screen_rows, uint32_t width, uint32_t height, uint32_t planes,
+                      uint64_t dirty_rows) override {}
+    void clear(void) override {}
+};
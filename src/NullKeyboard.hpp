@@ -0,0 +1,14 @@
+#pragma once
+
+#include "IKeyboard.hpp"
+
+// Keyboard that never reports a key press nor a quit request. Used to run the core headless.
+class NullKeyboard final : public IKeyboard {
+public:
+    NullKeyboard() {}
+    virtual ~NullKeyboard() {}
+
+    uint16_t pressedKeys(void) override { return 0; }
+    bool getKeyEvent(Key *key) override { return false; }
+    bool quitClicked(void) override { return false; }
+};
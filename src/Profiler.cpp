@@ -0,0 +1,438 @@
+#include "Profiler.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace {
+
+struct ClassInfo {
+    const char *name;
+    Profiler::Group group;
+};
+
+// Indexed by Profiler::OpClass
+const ClassInfo kClassInfo[] = {
+    {"CLS", Profiler::Group::kDraw},
+    {"RET", Profiler::Group::kFlow},
+    {"SYS addr", Profiler::Group::kOther},
+    {"JP addr", Profiler::Group::kFlow},
+    {"CALL addr", Profiler::Group::kFlow},
+    {"SE Vx, byte", Profiler::Group::kFlow},
+    {"SNE Vx, byte", Profiler::Group::kFlow},
+    {"SE Vx, Vy", Profiler::Group::kFlow},
+    {"LD Vx, byte", Profiler::Group::kAlu},
+    {"ADD Vx, byte", Profiler::Group::kAlu},
+    {"LD Vx, Vy", Profiler::Group::kAlu},
+    {"OR Vx, Vy", Profiler::Group::kAlu},
+    {"AND Vx, Vy", Profiler::Group::kAlu},
+    {"XOR Vx, Vy", Profiler::Group::kAlu},
+    {"ADD Vx, Vy", Profiler::Group::kAlu},
+    {"SUB Vx, Vy", Profiler::Group::kAlu},
+    {"SHR Vx", Profiler::Group::kAlu},
+    {"SUBN Vx, Vy", Profiler::Group::kAlu},
+    {"SHL Vx", Profiler::Group::kAlu},
+    {"SNE Vx, Vy", Profiler::Group::kFlow},
+    {"LD I, addr", Profiler::Group::kMemory},
+    {"JP V0, addr", Profiler::Group::kFlow},
+    {"RND Vx, byte", Profiler::Group::kAlu},
+    {"DRW Vx, Vy, n", Profiler::Group::kDraw},
+    {"SKP Vx", Profiler::Group::kInput},
+    {"SKNP Vx", Profiler::Group::kInput},
+    {"LD Vx, DT", Profiler::Group::kTimer},
+    {"LD Vx, K", Profiler::Group::kInput},
+    {"LD DT, Vx", Profiler::Group::kTimer},
+    {"LD ST, Vx", Profiler::Group::kTimer},
+    {"ADD I, Vx", Profiler::Group::kMemory},
+    {"LD F, Vx", Profiler::Group::kMemory},
+    {"LD B, Vx", Profiler::Group::kMemory},
+    {"LD [I], Vx", Profiler::Group::kMemory},
+    {"LD Vx, [I]", Profiler::Group::kMemory},
+    {"SCD nibble", Profiler::Group::kDraw},
+    {"SCR", Profiler::Group::kDraw},
+    {"SCL", Profiler::Group::kDraw},
+    {"EXIT", Profiler::Group::kFlow},
+    {"LOW", Profiler::Group::kDraw},
+    {"HIGH", Profiler::Group::kDraw},
+    {"LD HF, Vx", Profiler::Group::kMemory},
+    {"LD R, Vx", Profiler::Group::kMemory},
+    {"LD Vx, R", Profiler::Group::kMemory},
+    {"SCU nibble", Profiler::Group::kDraw},
+    {"SAVE Vx - Vy", Profiler::Group::kMemory},
+    {"LOAD Vx - Vy", Profiler::Group::kMemory},
+    {"LD I, long", Profiler::Group::kMemory},
+    {"PLANE n", Profiler::Group::kDraw},
+    {"AUDIO", Profiler::Group::kTimer},
+    {"PITCH Vx", Profiler::Group::kTimer},
+    {"unknown", Profiler::Group::kOther}
+};
+static_assert(sizeof(kClassInfo) / sizeof(kClassInfo[0]) == static_cast<size_t>(Profiler::OpClass::kCount),
+              "one entry per opcode class");
+
+const char *const kGroupNames[] = {"draw", "alu", "flow", "memory", "timer", "input", "other"};
+static_assert(sizeof(kGroupNames) / sizeof(kGroupNames[0]) == static_cast<size_t>(Profiler::Group::kCount),
+              "one entry per group");
+
+std::string hex(uint16_t value, int width) {
+    std::ostringstream out;
+    out << std::hex << std::uppercase << std::setfill('0') << std::setw(width) << value;
+    return out.str();
+}
+
+}
+
+Profiler::Profiler() : memory_size_(kDefaultMemorySize), address_width_(3) {
+    clear();
+}
+
+Profiler::OpClass Profiler::classify(uint16_t opcode) {
+    uint8_t n = opcode & 0x000F;
+    uint8_t kk = opcode & 0x00FF;
+
+    switch (opcode >> 12) {
+        case 0x0:
+            switch (opcode & 0xFFF0) {
+                case 0x00C0:
+                    return OpClass::kScd;
+                case 0x00D0:
+                    return OpClass::kScu;
+                default:
+                    break;
+            }
+            switch (opcode) {
+                case 0x00E0:
+                    return OpClass::kCls;
+                case 0x00EE:
+                    return OpClass::kRet;
+                case 0x00FB:
+                    return OpClass::kScr;
+                case 0x00FC:
+                    return OpClass::kScl;
+                case 0x00FD:
+                    return OpClass::kExit;
+                case 0x00FE:
+                    return OpClass::kLow;
+                case 0x00FF:
+                    return OpClass::kHigh;
+                default:
+                    return OpClass::kSys;
+            }
+        case 0x1:
+            return OpClass::kJp;
+        case 0x2:
+            return OpClass::kCall;
+        case 0x3:
+            return OpClass::kSeVxKk;
+        case 0x4:
+            return OpClass::kSneVxKk;
+        case 0x5:
+            switch (n) {
+                case 0x0:
+                    return OpClass::kSeVxVy;
+                case 0x2:
+                    return OpClass::kSaveRange;
+                case 0x3:
+                    return OpClass::kLoadRange;
+                default:
+                    return OpClass::kUnknown;
+            }
+        case 0x6:
+            return OpClass::kLdVxKk;
+        case 0x7:
+            return OpClass::kAddVxKk;
+        case 0x8:
+            switch (n) {
+                case 0x0:
+                    return OpClass::kLdVxVy;
+                case 0x1:
+                    return OpClass::kOr;
+                case 0x2:
+                    return OpClass::kAnd;
+                case 0x3:
+                    return OpClass::kXor;
+                case 0x4:
+                    return OpClass::kAddVxVy;
+                case 0x5:
+                    return OpClass::kSub;
+                case 0x6:
+                    return OpClass::kShr;
+                case 0x7:
+                    return OpClass::kSubn;
+                case 0xE:
+                    return OpClass::kShl;
+                default:
+                    return OpClass::kUnknown;
+            }
+        case 0x9:
+            return n ? OpClass::kUnknown : OpClass::kSneVxVy;
+        case 0xA:
+            return OpClass::kLdI;
+        case 0xB:
+            return OpClass::kJpV0;
+        case 0xC:
+            return OpClass::kRnd;
+        case 0xD:
+            return OpClass::kDrw;
+        case 0xE:
+            if (kk == 0x9E) {
+                return OpClass::kSkp;
+            }
+            return kk == 0xA1 ? OpClass::kSknp : OpClass::kUnknown;
+        default:
+            if (opcode == 0xF000) {
+                return OpClass::kLdILong;
+            }
+            if (opcode == 0xF002) {
+                return OpClass::kAudio;
+            }
+            switch (kk) {
+                case 0x01:
+                    return OpClass::kPlane;
+                case 0x07:
+                    return OpClass::kLdVxDt;
+                case 0x0A:
+                    return OpClass::kLdVxK;
+                case 0x15:
+                    return OpClass::kLdDtVx;
+                case 0x18:
+                    return OpClass::kLdStVx;
+                case 0x1E:
+                    return OpClass::kAddIVx;
+                case 0x29:
+                    return OpClass::kLdFVx;
+                case 0x33:
+                    return OpClass::kLdBVx;
+                case 0x55:
+                    return OpClass::kLdIVx;
+                case 0x65:
+                    return OpClass::kLdVxI;
+                case 0x30:
+                    return OpClass::kLdHfVx;
+                case 0x3A:
+                    return OpClass::kPitch;
+                case 0x75:
+                    return OpClass::kLdRVx;
+                case 0x85:
+                    return OpClass::kLdVxR;
+                default:
+                    return OpClass::kUnknown;
+            }
+    }
+}
+
+Profiler::Group Profiler::group(OpClass op_class) {
+    return kClassInfo[static_cast<size_t>(op_class)].group;
+}
+
+const char *Profiler::name(OpClass op_class) {
+    return kClassInfo[static_cast<size_t>(op_class)].name;
+}
+
+const char *Profiler::name(Group group) {
+    return kGroupNames[static_cast<size_t>(group)];
+}
+
+uint64_t Profiler::ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+bool Profiler::sampleNext(void) {
+    if (--sample_countdown_) {
+        return false;
+    }
+    // xorshift32, intervals uniform in [1, 2 * kSampleInterval - 1]
+    sample_state_ ^= sample_state_ << 13;
+    sample_state_ ^= sample_state_ >> 17;
+    sample_state_ ^= sample_state_ << 5;
+    sample_countdown_ = 1 + sample_state_ % (2 * kSampleInterval - 1);
+    return true;
+}
+
+void Profiler::recordTime(uint16_t opcode, uint64_t ticks) {
+    auto op_class = static_cast<size_t>(classify(opcode));
+    ++class_samples_[op_class];
+    class_ticks_[op_class] += ticks > overhead_ticks_ ? ticks - overhead_ticks_ : 0;
+}
+
+void Profiler::record(uint16_t address, uint16_t opcode) {
+    auto op_class = classify(opcode);
+    ++instructions_;
+    ++class_counts_[static_cast<size_t>(op_class)];
+    ++address_counts_[address & (address_counts_.size() - 1)];
+    // The call belongs to the caller, the return to the callee
+    ++frames_[current_frame_].instructions;
+
+    if (op_class == OpClass::kCall) {
+        uint16_t target = opcode & 0x0FFF;
+        ++call_edges_[(static_cast<uint32_t>(address) << 16) | target];
+        if (depth_ >= kMaxCallDepth) {
+            ++overflow_depth_;
+            return;
+        }
+
+        auto &children = frames_[current_frame_].children;
+        auto child = children.find(target);
+        size_t next_frame;
+        if (child != children.end()) {
+            next_frame = child->second;
+        } else {
+            // push_back() may move the frames, children with them
+            next_frame = frames_.size();
+            children.emplace(target, next_frame);
+            frames_.push_back({target, current_frame_, 0, {}});
+        }
+        current_frame_ = next_frame;
+        ++depth_;
+    } else if (op_class == OpClass::kRet) {
+        if (overflow_depth_) {
+            --overflow_depth_;
+        } else if (depth_) {
+            // A return with nothing called (stack manipulations) stays in the entry frame
+            current_frame_ = frames_[current_frame_].parent;
+            --depth_;
+        }
+    }
+}
+
+void Profiler::clear(void) {
+    instructions_ = 0;
+    class_counts_.fill(0);
+    class_samples_.fill(0);
+    class_ticks_.fill(0);
+    sample_countdown_ = kSampleInterval;
+    sample_state_ = 0x9E3779B9;
+    address_counts_.assign(memory_size_, 0);
+    call_edges_.clear();
+    frames_.clear();
+    frames_.push_back({0, 0, 0, {}});
+    current_frame_ = 0;
+    depth_ = 0;
+    overflow_depth_ = 0;
+
+    // The cheapest of a few tries: the others were interrupted
+    overhead_ticks_ = ~0ull;
+    for (int i = 0; i < 64; ++i) {
+        uint64_t start = ticks();
+        overhead_ticks_ = std::min(overhead_ticks_, ticks() - start);
+    }
+    start_time_ = std::chrono::steady_clock::now();
+    start_ticks_ = ticks();
+}
+
+void Profiler::setMemorySize(size_t bytes) {
+    memory_size_ = bytes;
+    address_width_ = bytes > 0x1000 ? 4 : 3;
+    clear();
+}
+
+uint64_t Profiler::instructions(void) const {
+    return instructions_;
+}
+
+uint64_t Profiler::count(OpClass op_class) const {
+    return class_counts_[static_cast<size_t>(op_class)];
+}
+
+uint64_t Profiler::samples(OpClass op_class) const {
+    return class_samples_[static_cast<size_t>(op_class)];
+}
+
+uint64_t Profiler::timeNs(OpClass op_class) const {
+    auto i = static_cast<size_t>(op_class);
+    if (!class_samples_[i]) {
+        return 0;
+    }
+    // Both clocks ran since clear(); steady_clock ns per tick is 1 when ticks() falls back to it
+    double elapsed_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start_time_)
+                            .count();
+    uint64_t elapsed_ticks = ticks() - start_ticks_;
+    double ns_per_tick = elapsed_ticks ? elapsed_ns / elapsed_ticks : 1.0;
+    return static_cast<uint64_t>(static_cast<double>(class_ticks_[i]) * class_counts_[i] / class_samples_[i] *
+                                 ns_per_tick);
+}
+
+uint64_t Profiler::timeNs(Group group) const {
+    uint64_t time_ns = 0;
+    for (size_t i = 0; i < class_counts_.size(); ++i) {
+        if (kClassInfo[i].group == group) {
+            time_ns += timeNs(static_cast<OpClass>(i));
+        }
+    }
+    return time_ns;
+}
+
+void Profiler::writeJson(std::ostream &out) const {
+    out << "{\n  \"instructions\": " << instructions_ << ",\n";
+
+    out << "  \"groups\": {";
+    for (size_t i = 0; i < static_cast<size_t>(Group::kCount); ++i) {
+        auto group = static_cast<Group>(i);
+        uint64_t count = 0;
+        for (size_t j = 0; j < class_counts_.size(); ++j) {
+            count += kClassInfo[j].group == group ? class_counts_[j] : 0;
+        }
+        out << (i ? ",\n" : "\n") << "    \"" << name(group) << "\": {\"count\": " << count
+            << ", \"time_ns\": " << timeNs(group) << "}";
+    }
+    out << "\n  },\n";
+
+    out << "  \"opcodes\": [";
+    bool first = true;
+    for (size_t i = 0; i < class_counts_.size(); ++i) {
+        if (!class_counts_[i]) {
+            continue;
+        }
+        out << (first ? "\n" : ",\n") << "    {\"class\": \"" << kClassInfo[i].name << "\", \"group\": \""
+            << name(kClassInfo[i].group) << "\", \"count\": " << class_counts_[i] << ", \"samples\": "
+            << class_samples_[i] << ", \"time_ns\": " << timeNs(static_cast<OpClass>(i)) << "}";
+        first = false;
+    }
+    out << "\n  ],\n";
+
+    out << "  \"addresses\": [";
+    first = true;
+    for (size_t address = 0; address < address_counts_.size(); ++address) {
+        if (!address_counts_[address]) {
+            continue;
+        }
+        out << (first ? "\n" : ",\n") << "    {\"address\": \"0x" << hex(address, address_width_) << "\", \"count\": "
+            << address_counts_[address] << "}";
+        first = false;
+    }
+    out << "\n  ],\n";
+
+    out << "  \"calls\": [";
+    first = true;
+    for (const auto &edge : call_edges_) {
+        out << (first ? "\n" : ",\n") << "    {\"from\": \"0x" << hex(edge.first >> 16, address_width_)
+            << "\", \"to\": \"0x" << hex(edge.first & 0xFFFF, address_width_) << "\", \"count\": " << edge.second
+            << "}";
+        first = false;
+    }
+    out << "\n  ]\n}\n";
+}
+
+void Profiler::writeCollapsed(std::ostream &out) const {
+    for (size_t i = 0; i < frames_.size(); ++i) {
+        if (!frames_[i].instructions) {
+            continue;
+        }
+
+        // Walk up to the entry frame, then print root first
+        std::string stack;
+        for (auto frame = i; frame; frame = frames_[frame].parent) {
+            stack = ";sub_" + hex(frames_[frame].address, address_width_) + stack;
+        }
+        out << "rom" << stack << " " << frames_[i].instructions << "\n";
+    }
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <vector>
+
+/*
+ * Execution profile of a rom: instruction counts per opcode class and per address, host time per opcode
+ * class (so drawing can be told apart from ALU work), and the call graph followed through 2nnn / 00EE.
+ *
+ * Chip8 feeds it one instruction at a time while it is attached (Chip8::setProfiler()). When no profiler
+ * is attached, the engines run untouched.
+ *
+ * Reading a clock costs more than most instructions, so only about one instruction in kSampleInterval is
+ * timed, at random intervals (a fixed one would keep timing the same instruction of a loop). The time of a
+ * class is its sampled ticks scaled by count / samples, less the cost of the two clock reads, measured in
+ * clear(). Ticks come from the time stamp counter on x86 and are converted to ns against steady_clock.
+ */
+class Profiler {
+public:
+    // Instruction classes, by mnemonic
+    enum class OpClass : uint8_t {
+        kCls,
+        kRet,
+        kSys,
+        kJp,
+        kCall,
+        kSeVxKk,
+        kSneVxKk,
+        kSeVxVy,
+        kLdVxKk,
+        kAddVxKk,
+        kLdVxVy,
+        kOr,
+        kAnd,
+        kXor,
+        kAddVxVy,
+        kSub,
+        kShr,
+        kSubn,
+        kShl,
+        kSneVxVy,
+        kLdI,
+        kJpV0,
+        kRnd,
+        kDrw,
+        kSkp,
+        kSknp,
+        kLdVxDt,
+        kLdVxK,
+        kLdDtVx,
+        kLdStVx,
+        kAddIVx,
+        kLdFVx,
+        kLdBVx,
+        kLdIVx,
+        kLdVxI,
+        // SUPER-CHIP
+        kScd,
+        kScr,
+        kScl,
+        kExit,
+        kLow,
+        kHigh,
+        kLdHfVx,
+        kLdRVx,
+        kLdVxR,
+        // XO-CHIP
+        kScu,
+        kSaveRange,
+        kLoadRange,
+        kLdILong,
+        kPlane,
+        kAudio,
+        kPitch,
+        kUnknown,
+        kCount
+    };
+
+    // Coarser grouping of the classes, for the time split
+    enum class Group : uint8_t {
+        kDraw,
+        kAlu,
+        kFlow,
+        kMemory,
+        kTimer,
+        kInput,
+        kOther,
+        kCount
+    };
+
+    // Calls nested deeper than this are attributed to the deepest frame (runaway recursion)
+    static constexpr size_t kMaxCallDepth = 64;
+    // Per-address counts of CHIP-8 and SUPER-CHIP memory, until setMemorySize()
+    static constexpr size_t kDefaultMemorySize = 4096;
+    // Mean instructions between two timed ones
+    static constexpr uint32_t kSampleInterval = 32;
+
+    Profiler();
+    virtual ~Profiler() {}
+
+    // The extended opcodes are classified whatever the mode: they are unknown to CHIP-8 roms anyway
+    static OpClass classify(uint16_t opcode);
+    static Group group(OpClass op_class);
+    static const char *name(OpClass op_class);
+    static const char *name(Group group);
+
+    // Host clock: the time stamp counter on x86, else steady_clock ns
+    static uint64_t ticks(void);
+
+    // True when the next instruction is to be timed with ticks() and passed to recordTime()
+    bool sampleNext(void);
+    // Counts the instruction opcode executed at address
+    void record(uint16_t address, uint16_t opcode);
+    // The sampled instruction opcode took ticks on the host, clock reads included
+    void recordTime(uint16_t opcode, uint64_t ticks);
+    void clear(void);
+    // Bytes of the address space, a power of 2 (Chip8 sets 64 KB for XO-CHIP). Clears the profile.
+    void setMemorySize(size_t bytes);
+
+    uint64_t instructions(void) const;
+    uint64_t count(OpClass op_class) const;
+    uint64_t samples(OpClass op_class) const;
+    // Estimated host time, from the samples
+    uint64_t timeNs(OpClass op_class) const;
+    uint64_t timeNs(Group group) const;
+
+    // Everything above, plus the per-address counts and the call edges
+    void writeJson(std::ostream &out) const;
+    /** One line per call stack, "rom;sub_2A0;sub_31C <instructions>", the input format of flamegraph.pl
+     * and of most flame graph viewers
+     */
+    void writeCollapsed(std::ostream &out) const;
+
+private:
+    // Node of the call tree: one per distinct call stack
+    struct Frame {
+        uint16_t address;
+        size_t parent;
+        uint64_t instructions;
+        std::map<uint16_t, size_t> children;
+    };
+
+    uint64_t instructions_;
+    std::array<uint64_t, static_cast<size_t>(OpClass::kCount)> class_counts_;
+    std::array<uint64_t, static_cast<size_t>(OpClass::kCount)> class_samples_;
+    std::array<uint64_t, static_cast<size_t>(OpClass::kCount)> class_ticks_;
+    // Instructions left before the next timed one, and the generator of the intervals
+    uint32_t sample_countdown_;
+    uint32_t sample_state_;
+    // Cost of two back to back ticks(), taken off each sample
+    uint64_t overhead_ticks_;
+    // Both clocks at clear(), for the ticks to ns rate
+    std::chrono::steady_clock::time_point start_time_;
+    uint64_t start_ticks_;
+    // Per byte address, instructions starting there
+    std::vector<uint64_t> address_counts_;
+    size_t memory_size_;
+    // Hex digits of an address in the outputs
+    int address_width_;
+    // (call site << 16 | target) -> calls
+    std::map<uint32_t, uint64_t> call_edges_;
+    // frames_[0] is the rom entry point
+    std::vector<Frame> frames_;
+    size_t current_frame_;
+    size_t depth_;
+    // Calls made past kMaxCallDepth, still to be returned from
+    size_t overflow_depth_;
+};
@@ -0,0 +1,212 @@
+#include "RewindBuffer.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+// LEB128: 7 bits per byte, the high bit set on every byte but the last
+void putVarint(std::vector<uint8_t> *out, size_t value) {
+    while (value >= 0x80) {
+        out->push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out->push_back(static_cast<uint8_t>(value));
+}
+
+size_t getVarint(const uint8_t **data) {
+    size_t value = 0;
+    for (size_t shift = 0;; shift += 7) {
+        auto byte = *(*data)++;
+        value |= static_cast<size_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return value;
+        }
+    }
+}
+
+}
+
+RewindBuffer::RewindBuffer(size_t capacity_bytes, size_t keyframe_interval) :
+    ring_(capacity_bytes),
+    keyframe_interval_(keyframe_interval),
+    head_(0),
+    bytes_used_(0),
+    since_keyframe_(0) {
+    if (!capacity_bytes || !keyframe_interval) {
+        throw std::invalid_argument("Rewind buffer needs a capacity and a keyframe interval");
+    }
+}
+
+void RewindBuffer::push(const std::vector<uint8_t> &state) {
+    bool keyframe = entries_.empty() || since_keyframe_ + 1 >= keyframe_interval_ || state.size() != last_.size();
+
+    size_t offset;
+    for (;;) {
+        encode(state, keyframe);
+        if (encoded_.size() > ring_.size()) {
+            // Cannot be stored at all: the history restarts with the next frame that fits
+            clear();
+            return;
+        }
+
+        offset = place(encoded_.size());
+        // Everything older was dropped to make room: a delta would have nothing to apply to
+        if (entries_.empty() && !keyframe) {
+            keyframe = true;
+            continue;
+        }
+        break;
+    }
+
+    std::memcpy(ring_.data() + offset, encoded_.data(), encoded_.size());
+    entries_.push_back({offset, encoded_.size(), state.size(), keyframe});
+    head_ = offset + encoded_.size();
+    bytes_used_ += encoded_.size();
+    since_keyframe_ = keyframe ? 0 : since_keyframe_ + 1;
+    last_ = state;
+}
+
+bool RewindBuffer::state(size_t frames_back, std::vector<uint8_t> *state) const {
+    if (frames_back >= entries_.size()) {
+        return false;
+    }
+
+    auto newest = entries_.size() - 1;
+    auto target = newest - frames_back;
+    // The oldest entry is always a keyframe
+    auto keyframe = target;
+    while (!entries_[keyframe].keyframe) {
+        --keyframe;
+    }
+
+    // A delta applied again undoes itself: walk back from the newest state when that is shorter and no
+    // keyframe (which does not hold the delta to its predecessor) is in the way
+    bool backwards = frames_back < target - keyframe;
+    for (auto i = target + 1; backwards && i <= newest; ++i) {
+        backwards = !entries_[i].keyframe;
+    }
+
+    if (backwards) {
+        *state = last_;
+        for (auto i = newest; i > target; --i) {
+            apply(entries_[i], state);
+        }
+    } else {
+        state->assign(entries_[keyframe].state_size, 0);
+        for (auto i = keyframe; i <= target; ++i) {
+            apply(entries_[i], state);
+        }
+    }
+    return true;
+}
+
+bool RewindBuffer::rewind(size_t frames_back, std::vector<uint8_t> *state) {
+    if (!this->state(frames_back, state)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < frames_back; ++i) {
+        bytes_used_ -= entries_.back().length;
+        entries_.pop_back();
+    }
+    head_ = entries_.back().offset + entries_.back().length;
+    since_keyframe_ = 0;
+    for (auto i = entries_.size() - 1; !entries_[i].keyframe; --i) {
+        ++since_keyframe_;
+    }
+    last_ = *state;
+    return true;
+}
+
+void RewindBuffer::clear(void) {
+    entries_.clear();
+    head_ = 0;
+    bytes_used_ = 0;
+    since_keyframe_ = 0;
+    last_.clear();
+}
+
+size_t RewindBuffer::frames(void) const {
+    return entries_.size();
+}
+
+size_t RewindBuffer::bytesUsed(void) const {
+    return bytes_used_;
+}
+
+size_t RewindBuffer::capacity(void) const {
+    return ring_.size();
+}
+
+void RewindBuffer::encode(const std::vector<uint8_t> &state, bool keyframe) {
+    // Keyframes are XORed against zeros, so both kinds decode the same way
+    auto byte = [&state, keyframe, this](size_t i) -> uint8_t { return keyframe ? state[i] : state[i] ^ last_[i]; };
+
+    encoded_.clear();
+    size_t i = 0;
+    while (i < state.size()) {
+        // (zero run, literal run, literal bytes)... the trailing zero run is implied by the state size
+        auto zeros = i;
+        while (zeros < state.size() && !byte(zeros)) {
+            ++zeros;
+        }
+        if (zeros == state.size()) {
+            break;
+        }
+        // A single zero is cheaper inside a literal run than as a new (zero run, literal run) pair
+        auto literals = zeros;
+        while (literals < state.size() &&
+               (byte(literals) || (literals + 1 < state.size() && byte(literals + 1)))) {
+            ++literals;
+        }
+
+        putVarint(&encoded_, zeros - i);
+        putVarint(&encoded_, literals - zeros);
+        for (auto j = zeros; j < literals; ++j) {
+            encoded_.push_back(byte(j));
+        }
+        i = literals;
+    }
+}
+
+void RewindBuffer::apply(const Entry &entry, std::vector<uint8_t> *state) const {
+    const uint8_t *data = ring_.data() + entry.offset;
+    const uint8_t *end = data + entry.length;
+    size_t i = 0;
+
+    while (data < end) {
+        i += getVarint(&data);
+        auto literals = getVarint(&data);
+        for (size_t j = 0; j < literals; ++j) {
+            (*state)[i++] ^= *data++;
+        }
+    }
+}
+
+size_t RewindBuffer::place(size_t length) {
+    auto evictOldest = [this]() {
+        bytes_used_ -= entries_.front().length;
+        entries_.pop_front();
+    };
+
+    size_t offset = head_;
+    if (offset + length > ring_.size()) {
+        // No room before the end of the ring: the entry goes at the start, after dropping the (oldest)
+        // entries stored past head_
+        while (!entries_.empty() && entries_.front().offset >= head_) {
+            evictOldest();
+        }
+        offset = 0;
+    }
+
+    // The entries right after offset are the oldest ones
+    while (!entries_.empty() && entries_.front().offset >= offset && entries_.front().offset < offset + length) {
+        evictOldest();
+    }
+    // Deltas left without their keyframe are useless
+    while (!entries_.empty() && !entries_.front().keyframe) {
+        evictOldest();
+    }
+    return offset;
+}
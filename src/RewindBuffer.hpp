@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+/*
+ * History of per-frame save states in a fixed amount of memory.
+ *
+ * Each state is stored as the XOR against the previous one, run-length encoded (zero runs and literal
+ * bytes), so a frame that only touched a few bytes costs a few bytes. Every keyframe_interval frames, and
+ * whenever the state size changes, the full state is encoded instead (XOR against zeros). The encoded frames
+ * are packed in a single ring of capacity bytes: once it is full, the oldest keyframe and its deltas are
+ * dropped together.
+ *
+ * A state is rebuilt from the closest keyframe before it, or backwards from the newest state (XOR deltas
+ * undo themselves), so it never costs more than keyframe_interval deltas.
+ */
+class RewindBuffer {
+public:
+    // 5 s of 60 Hz frames
+    static constexpr size_t kDefaultKeyframeInterval = 300;
+
+    // capacity_bytes bounds the encoded history, it must hold at least a few full states
+    explicit RewindBuffer(size_t capacity_bytes, size_t keyframe_interval = kDefaultKeyframeInterval);
+    virtual ~RewindBuffer() {}
+
+    // Records the state of a new frame
+    void push(const std::vector<uint8_t> &state);
+
+    /** Rebuilds the state recorded frames_back frames before the newest one (0 = newest)
+     *
+     * Returns false when that frame is not in the buffer (anymore)
+     */
+    bool state(size_t frames_back, std::vector<uint8_t> *state) const;
+
+    /** Drops the frames_back newest frames and returns the state now newest, the next push() follows it
+     *
+     * Returns false (and drops nothing) when that frame is not in the buffer
+     */
+    bool rewind(size_t frames_back, std::vector<uint8_t> *state);
+
+    void clear(void);
+    // Frames held
+    size_t frames(void) const;
+    // Encoded bytes held
+    size_t bytesUsed(void) const;
+    size_t capacity(void) const;
+
+private:
+    struct Entry {
+        size_t offset;
+        size_t length;
+        // Size of the decoded state
+        size_t state_size;
+        bool keyframe;
+    };
+
+    void encode(const std::vector<uint8_t> &state, bool keyframe);
+    // XORs the encoded entry into state (sized by the caller)
+    void apply(const Entry &entry, std::vector<uint8_t> *state) const;
+    // Evicts the entries in the way of a new one, returns its offset
+    size_t place(size_t length);
+
+    std::vector<uint8_t> ring_;
+    size_t keyframe_interval_;
+    // Oldest first. They span ring_ contiguously (modulo its size) from front().offset to head_
+    std::deque<Entry> entries_;
+    size_t head_;
+    size_t bytes_used_;
+    // Frames pushed since the last keyframe
+    size_t since_keyframe_;
+    // Newest state, the base of the next delta
+    std::vector<uint8_t> last_;
+    // Encoding scratch, kept to avoid an allocation per frame
+    std::vector<uint8_t> encoded_;
+};
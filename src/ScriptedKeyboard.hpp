@@ -0,0 +1,61 @@
+#pragma once
+
+#include "IKeyboard.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/*
+ * Keyboard that plays a script of key edges, each one due at an instruction count. The emulator polls the keyboard
+ * once per frame: an edge is delivered at the first poll once its instruction is reached, so a script replays the
+ * same way on every engine for a given --cpf. The count does not move while the rom waits on Fx0A, so the edge it
+ * waits for must be due at or before the instruction it parked on.
+ */
+class ScriptedKeyboard final : public IKeyboard {
+public:
+    struct Event {
+        uint64_t instruction;
+        Key key;
+    };
+
+    // script in instruction order
+    explicit ScriptedKeyboard(const std::vector<Event> &script) : script_(script), applied_(0), delivered_(0),
+        keys_(0), clock_([]() { return uint64_t(0); }) {}
+    virtual ~ScriptedKeyboard() {}
+
+    // Instruction count of the run, e.g. [&chip8]() { return chip8.instructionCount(); }
+    void setClock(const std::function<uint64_t(void)> &clock) { clock_ = clock; }
+
+    uint16_t pressedKeys(void) override {
+        auto now = clock_();
+        while (applied_ < script_.size() && script_[applied_].instruction <= now) {
+            const auto &key = script_[applied_].key;
+            if (key.state == Key::State::kPressed) {
+                keys_ |= static_cast<uint16_t>(1u << key.value);
+            } else {
+                keys_ &= static_cast<uint16_t>(~(1u << key.value));
+            }
+            ++applied_;
+        }
+        return keys_;
+    }
+
+    // Edges applied by pressedKeys() and not popped yet
+    bool getKeyEvent(Key *key) override {
+        if (delivered_ == applied_) {
+            return false;
+        }
+        *key = script_[delivered_++].key;
+        return true;
+    }
+
+    bool quitClicked(void) override { return false; }
+
+private:
+    const std::vector<Event> script_;
+    size_t applied_;
+    size_t delivered_;
+    uint16_t keys_;
+    std::function<uint64_t(void)> clock_;
+};
@@ -0,0 +1,132 @@
+#include "SdlAudio.hpp"
+#include <cstring>
+
+constexpr uint64_t SdlAudio::kSquarePattern[2];
+
+SdlAudio::SdlAudio(uint16_t buffer_samples) :
+    device_(0),
+    sample_rate_(kSampleRate),
+    on_(false),
+    sequence_(0),
+    pattern_{{kSquarePattern[0]}, {kSquarePattern[1]}},
+    phase_step_(0),
+    phase_(0) {
+
+    if (!buffer_samples) {
+        throw SdlAudioException("Failed to initialize SDL audio: buffer size invalid (0)");
+    }
+
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0) {
+        throw SdlAudioException("Failed to initialize SDL audio: " + std::string(SDL_GetError()));
+    }
+
+    SDL_AudioSpec desired = {};
+    desired.freq = kSampleRate;
+    desired.format = AUDIO_S16SYS;
+    desired.channels = 1;
+    desired.samples = buffer_samples;
+    desired.callback = &SdlAudio::callback;
+    desired.userdata = this;
+    SDL_AudioSpec obtained = {};
+    // SDL converts the format and channels if the device needs it, only the rate is taken as is
+    device_ = SDL_OpenAudioDevice(nullptr, 0, &desired, &obtained, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+    if (!device_) {
+        SDL_QuitSubSystem(SDL_INIT_AUDIO);
+        throw SdlAudioException("Failed to open SDL audio device: " + std::string(SDL_GetError()));
+    }
+
+    sample_rate_ = obtained.freq;
+    phase_step_ = phaseStep(kSquareFrequency * kPatternSamples);
+    // The device starts paused, the callback runs from now on
+    SDL_PauseAudioDevice(device_, 0);
+}
+
+SdlAudio::SdlAudio(int sample_rate) :
+    device_(0),
+    sample_rate_(sample_rate),
+    on_(false),
+    sequence_(0),
+    pattern_{{kSquarePattern[0]}, {kSquarePattern[1]}},
+    phase_step_(0),
+    phase_(0) {
+    phase_step_ = phaseStep(kSquareFrequency * kPatternSamples);
+}
+
+std::unique_ptr<SdlAudio> SdlAudio::withoutDevice(int sample_rate) {
+    return std::unique_ptr<SdlAudio>(new SdlAudio(sample_rate));
+}
+
+SdlAudio::~SdlAudio() {
+    // Only the device constructor initializes SDL audio, and it always opens a device
+    if (device_) {
+        SDL_CloseAudioDevice(device_);
+        SDL_QuitSubSystem(SDL_INIT_AUDIO);
+    }
+}
+
+void SdlAudio::buzzerOn(void) {
+    on_.store(true, std::memory_order_relaxed);
+}
+
+void SdlAudio::buzzerOff(void) {
+    on_.store(false, std::memory_order_relaxed);
+}
+
+void SdlAudio::setPattern(const uint8_t *pattern, float rate) {
+    uint64_t words[2] = {kSquarePattern[0], kSquarePattern[1]};
+    uint32_t step = phaseStep(kSquareFrequency * kPatternSamples);
+    if (pattern) {
+        for (size_t half = 0; half < 2; ++half) {
+            words[half] = 0;
+            for (size_t i = 0; i < sizeof(uint64_t); ++i) {
+                words[half] = (words[half] << 8) | pattern[half * sizeof(uint64_t) + i];
+            }
+        }
+        step = phaseStep(rate);
+    }
+
+    // Single writer: odd sequence, tone, even sequence
+    uint32_t sequence = sequence_.load(std::memory_order_relaxed);
+    sequence_.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    pattern_[0].store(words[0], std::memory_order_relaxed);
+    pattern_[1].store(words[1], std::memory_order_relaxed);
+    phase_step_.store(step, std::memory_order_relaxed);
+    sequence_.store(sequence + 2, std::memory_order_release);
+}
+
+uint32_t SdlAudio::phaseStep(float rate) const {
+    // 2^32 per pattern, 2^25 per pattern sample
+    return static_cast<uint32_t>(static_cast<double>(rate) / sample_rate_ * (1u << 25));
+}
+
+void SdlAudio::mix(int16_t *samples, size_t count) {
+    if (!on_.load(std::memory_order_relaxed)) {
+        std::memset(samples, 0, count * sizeof(int16_t));
+        return;
+    }
+
+    uint64_t pattern[2];
+    uint32_t step;
+    uint32_t before;
+    uint32_t after;
+    do {
+        before = sequence_.load(std::memory_order_acquire);
+        pattern[0] = pattern_[0].load(std::memory_order_relaxed);
+        pattern[1] = pattern_[1].load(std::memory_order_relaxed);
+        step = phase_step_.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = sequence_.load(std::memory_order_relaxed);
+    } while ((before & 1) || before != after);
+
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t index = phase_ >> 25;
+        bool bit = (pattern[index >> 6] >> (63 - (index & 63))) & 0x01;
+        samples[i] = bit ? kAmplitude : -kAmplitude;
+        phase_ += step;
+    }
+}
+
+void SdlAudio::callback(void *userdata, Uint8 *stream, int len) {
+    static_cast<SdlAudio *>(userdata)->mix(reinterpret_cast<int16_t *>(stream), len / sizeof(int16_t));
+}
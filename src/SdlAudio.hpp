@@ -0,0 +1,82 @@
+#pragma once
+
+#include "IAudio.hpp"
+
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <string>
+#include <SDL2/SDL.h>
+
+// Buzzer played by an SDL audio device. The CPU thread only stores atomics, the SDL callback synthesizes the
+// samples from them: neither side locks nor allocates.
+class SdlAudio : public IAudio {
+public:
+    /** Opens and starts the default audio device (or the one of SDL_AUDIODRIVER, e.g. dummy or disk)
+     * 
+     * @param buffer_samples size of the device buffer, the latency is about buffer_samples / 48000 s
+     * 
+     * Throws SdlAudioException if the device can't be opened
+     */
+    explicit SdlAudio(uint16_t buffer_samples = kDefaultBufferSamples);
+    virtual ~SdlAudio();
+
+    /** Same synthesis without any device (and without SDL): the samples only come out of mix(), for tests
+     * 
+     * @param sample_rate rate mix() synthesizes at
+     */
+    static std::unique_ptr<SdlAudio> withoutDevice(int sample_rate);
+
+    class SdlAudioException : public std::exception {
+    public:
+        SdlAudioException(const std::string &err_msg) : err_msg_(err_msg) {} 
+        const char* what() const throw() { return err_msg_.c_str(); }
+    private:
+        const std::string err_msg_;
+    };
+
+    void buzzerOn(void) override;
+    void buzzerOff(void) override;
+    void setPattern(const uint8_t *pattern, float rate) override;
+
+    /** Synthesizes the next count samples (signed 16-bit mono), what the SDL callback runs
+     * 
+     */
+    void mix(int16_t *samples, size_t count);
+
+    // Rate obtained from the device
+    int sampleRate(void) const { return sample_rate_; }
+
+    // About 10 ms at 48 kHz
+    static constexpr uint16_t kDefaultBufferSamples = 512;
+
+private:
+    static constexpr int kSampleRate = 48000;
+    static constexpr int16_t kAmplitude = 4096;
+    // Default tone: 440 Hz square wave, one period per pattern (64 samples on, 64 off)
+    static constexpr float kSquareFrequency = 440.0f;
+    static constexpr uint64_t kSquarePattern[2] = {~0ull, 0};
+    static constexpr uint32_t kPatternSamples = 128;
+
+    // Device-less, see withoutDevice()
+    explicit SdlAudio(int sample_rate);
+
+    static void callback(void *userdata, Uint8 *stream, int len);
+    // Pattern position advance per output sample, in 1/2^25 of a pattern sample (the phase wraps at 2^32)
+    uint32_t phaseStep(float rate) const;
+
+    SDL_AudioDeviceID device_;
+    int sample_rate_;
+    // Written by the CPU thread, read by the callback
+    std::atomic<bool> on_;
+    /*
+     * Seqlock over the tone: odd while setPattern() writes it, the callback reads the pattern and the step again
+     * until it sees the same even sequence before and after, so it never plays half of one tone with the rest
+     * of another. The writer never waits.
+     */
+    std::atomic<uint32_t> sequence_;
+    std::atomic<uint64_t> pattern_[2];
+    std::atomic<uint32_t> phase_step_;
+    // Callback only: position in the pattern, the top 7 bits index the sample
+    uint32_t phase_;
+};
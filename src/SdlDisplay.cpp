@@ -3,6 +3,9 @@
 #include <memory>
 
 SdlDisplay::SdlDisplay(uint32_t display_width, uint32_t display_height) : 
+    window_(nullptr),
+    renderer_(nullptr),
+    texture_(nullptr),
     display_width_(display_width), 
     display_height_(display_height) {
     
@@ -22,20 +25,46 @@ SdlDisplay::SdlDisplay(uint32_t display_width, uint32_t display_height) :
     }
 
     renderer_ = SDL_CreateRenderer(window_, -1, SDL_RENDERER_ACCELERATED);
+    if (!renderer_) {
+        // No GPU (or the dummy video driver): render in software
+        renderer_ = SDL_CreateRenderer(window_, -1, SDL_RENDERER_SOFTWARE);
+    }
     if (!renderer_) {
         throw SdlDisplayException("Failed to create SDL renderer: " + std::string(SDL_GetError()));
     }
+
+    // Nearest neighbour scaling keeps the pixels sharp
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0");
+    resize(display_width_, display_height_);
+}
+
+void SdlDisplay::resize(uint32_t width, uint32_t height) {
+    if (texture_) {
+        SDL_DestroyTexture(texture_);
+    }
+    texture_ = SDL_CreateTexture(renderer_, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, width, height);
+    if (!texture_) {
+        throw SdlDisplayException("Failed to create SDL texture: " + std::string(SDL_GetError()));
+    }
+
+    display_width_ = width;
+    display_height_ = height;
+    pixels_.assign(display_width_ * display_height_, kPixelOff);
 }
 
 SdlDisplay::~SdlDisplay() {
-    if (window_) {
-        SDL_DestroyWindow(window_);
+    if (texture_) {
+        SDL_DestroyTexture(texture_);
     }
 
     if (renderer_) {
         SDL_DestroyRenderer(renderer_);
     }
 
+    if (window_) {
+        SDL_DestroyWindow(window_);
+    }
+
     SDL_Quit();
 }
 
@@ -50,11 +79,74 @@ void SdlDisplay::draw(uint32_t x_pos, uint32_t y_pos) {
 }
 
 void SdlDisplay::render(uint8_t *screen_buffer) {
+    checkRenderer();
+
+    auto display_size = display_width_ * display_height_;
+    for (uint32_t i = 0; i < display_size; ++i) {
+        pixels_[i] = screen_buffer[i] ? kPixelOn : kPixelOff;
+    }
+
+    uploadRows(0, display_height_);
+    present();
+}
+
+void SdlDisplay::renderPacked(const uint64_t *screen_rows, uint32_t width, uint32_t height, uint64_t dirty_rows) {
+    renderPlanes(screen_rows, width, height, 1, dirty_rows);
+}
+
+void SdlDisplay::renderPlanes(const uint64_t *screen_rows, uint32_t width, uint32_t height, uint32_t planes,
+                              uint64_t dirty_rows) {
+    checkRenderer();
+
+    if (!width || width % 64 || !height || height > 64 || !planes || planes > kMaxPlanes) {
+        throw SdlDisplayException("Failed to render: invalid frame " + std::to_string(width) + ", " +
+                                  std::to_string(height) + ", " + std::to_string(planes) + " planes");
+    }
+
+    // New resolution: the window stays, the texture follows the frame
+    if (width != display_width_ || height != display_height_) {
+        resize(width, height);
+        dirty_rows = ~0ULL;
+    }
+
+    // Identical frame: nothing to upload nor to present
+    if (!dirty_rows) {
+        return;
+    }
+
+    auto words_per_row = width / 64;
+    auto plane_words = words_per_row * height;
+    uint32_t y = 0;
+    while (y < height) {
+        if (!((dirty_rows >> y) & 0x01)) {
+            ++y;
+            continue;
+        }
+
+        // Expand a run of consecutive dirty rows and upload it in one go
+        auto first_row = y;
+        for (; y < height && ((dirty_rows >> y) & 0x01); ++y) {
+            auto *pixel = &pixels_[y * width];
+            for (uint32_t word = 0; word < words_per_row; ++word) {
+                auto plane1 = screen_rows[y * words_per_row + word];
+                auto plane2 = planes > 1 ? screen_rows[plane_words + y * words_per_row + word] : 0;
+                for (uint32_t bit = 0; bit < 64; ++bit, plane1 <<= 1, plane2 <<= 1) {
+                    *pixel++ = kPalette[((plane2 >> 62) & 0x02) | (plane1 >> 63)];
+                }
+            }
+        }
+        uploadRows(first_row, y - first_row);
+    }
+
+    present();
+}
+
+void SdlDisplay::checkRenderer(void) {
     if (!window_) { 
         throw SdlDisplayException("Failed to render: window not initialized");
     }
 
-    if (!renderer_) { 
+    if (!renderer_ || !texture_) { 
         throw SdlDisplayException("Failed to render: renderer not initialized");
     }
 
@@ -62,24 +154,20 @@ void SdlDisplay::render(uint8_t *screen_buffer) {
         throw SdlDisplayException("Failed to render: screen size invalid -> " + std::to_string(display_width_) + ", " +
                                   std::to_string(display_height_));
     }
+}
 
-    auto display_size = display_width_ * display_height_;
-    SDL_Rect rectangle = {.x = 0, .y = 0, .w = kScaleFactor, .h = kScaleFactor};
-
-    for (uint32_t i = 0; i < display_size; ++i) {
-        // Create a rectangle to represent a scaled pixel
-        rectangle.x = (i % display_width_) * kScaleFactor;
-        rectangle.y = (i / display_width_) * kScaleFactor;
-
-        if (screen_buffer[i]) {
-            SDL_SetRenderDrawColor(renderer_, 255, 255, 255, SDL_ALPHA_OPAQUE);
-            SDL_RenderFillRect(renderer_, &rectangle);
-        } else {
-            SDL_SetRenderDrawColor(renderer_, 0, 0, 0, SDL_ALPHA_OPAQUE);
-            SDL_RenderFillRect(renderer_, &rectangle);
-        }
+void SdlDisplay::uploadRows(uint32_t first_row, uint32_t rows) {
+    SDL_Rect rectangle = {.x = 0, .y = static_cast<int>(first_row), .w = static_cast<int>(display_width_),
+                          .h = static_cast<int>(rows)};
+    auto pitch = display_width_ * sizeof(uint32_t);
+    if (SDL_UpdateTexture(texture_, &rectangle, &pixels_[first_row * display_width_], pitch) < 0) {
+        throw SdlDisplayException("Failed to update texture: " + std::string(SDL_GetError()));
     }
+}
 
+void SdlDisplay::present(void) {
+    // The GPU scales the native texture to the whole window
+    SDL_RenderCopy(renderer_, texture_, nullptr, nullptr);
     SDL_RenderPresent(renderer_);
 }
 
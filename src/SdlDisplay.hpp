@@ -4,6 +4,7 @@
 
 #include <exception>
 #include <string>
+#include <vector>
 #include <SDL2/SDL.h>
 
 class SdlDisplay : public IDisplay {
@@ -21,15 +22,33 @@ public:
 
     void draw(uint32_t x_pos, uint32_t y_pos) override;
     void render(uint8_t *screen_buffer) override;
+    void renderPacked(const uint64_t *screen_rows, uint32_t width, uint32_t height, uint64_t dirty_rows) override;
+    // Up to 2 planes (XO-CHIP). A frame of another size (SUPER-CHIP hi-res) is scaled to the same window.
+    void renderPlanes(const uint64_t *screen_rows, uint32_t width, uint32_t height, uint32_t planes,
+                      uint64_t dirty_rows) override;
     void clear(void) override;
 
 private:
     static constexpr uint32_t kScaleFactor = 20;
+    static constexpr uint32_t kPixelOn = 0xFFFFFFFF;
+    static constexpr uint32_t kPixelOff = 0xFF000000;
+    static constexpr uint32_t kMaxPlanes = 2;
+    // Color of a pixel, indexed by its bit in plane 1 (LSB) and plane 2: off, plane 1, plane 2, both
+    static constexpr uint32_t kPalette[1 << kMaxPlanes] = {kPixelOff, kPixelOn, 0xFFAAAAAA, 0xFF555555};
+
+    // Recreates the texture for frames of another resolution
+    void resize(uint32_t width, uint32_t height);
+    void checkRenderer(void);
+    void uploadRows(uint32_t first_row, uint32_t rows);
+    void present(void);
 
     SDL_Window *window_;
     SDL_Renderer *renderer_;
+    // Native resolution (ARGB8888) streaming texture, scaled to the window by SDL_RenderCopy()
     SDL_Texture* texture_;
     uint32_t display_width_;
     uint32_t display_height_;
+    // CPU copy of the texture pixels
+    std::vector<uint32_t> pixels_;
 };
 
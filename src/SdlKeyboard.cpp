@@ -4,31 +4,65 @@
 SdlKeyboard::SdlKeyboard() : 
     runProccessEventsThread_(true), 
     quitClicked_(false),
+    eventsSequence_(0),
+    seenSequence_(0),
+    wakeEventType_(SDL_RegisterEvents(1)),
+    pressedKeys_(0),
+    rewindHeld_(false),
     eventsThread_(std::thread(&SdlKeyboard::processEvents, this)) {}
 
 SdlKeyboard::~SdlKeyboard() {
+    runProccessEventsThread_ = false;
+    // Wake the events thread up from SDL_WaitEventTimeout()
+    if (wakeEventType_ != static_cast<uint32_t>(-1)) {
+        SDL_Event event = {};
+        event.type = wakeEventType_;
+        SDL_PushEvent(&event);
+    }
+
     if (eventsThread_.joinable()) {
         eventsThread_.join();
     }
 }
 
-IKeyboard::Key SdlKeyboard::getKey(void) {
-    if (!keysQueue_.empty()) {
-        auto key = keysQueue_.front();
-        keysQueue_.pop();
-        return key;
-    }
+uint16_t SdlKeyboard::pressedKeys(void) {
+    return pressedKeys_.load(std::memory_order_relaxed);
+}
 
-    auto defaultKey = IKeyboard::Key();
-    defaultKey.state = Key::State::kReleased;
-    
-    return defaultKey;
+bool SdlKeyboard::getKeyEvent(IKeyboard::Key *key) {
+    return keyEvents_.pop(key);
 }
 
 bool SdlKeyboard::quitClicked(void) {
     return quitClicked_;
 }
 
+bool SdlKeyboard::rewindHeld(void) {
+    return rewindHeld_.load(std::memory_order_relaxed);
+}
+
+bool SdlKeyboard::waitForEvent(std::chrono::steady_clock::time_point deadline) {
+    std::unique_lock<std::mutex> lock(wakeMutex_);
+    auto woken = wake_.wait_until(lock, deadline, [this]() {
+        return eventsSequence_ != seenSequence_ || quitClicked_;
+    });
+    seenSequence_ = eventsSequence_;
+    return woken;
+}
+
+void SdlKeyboard::requestQuit(void) {
+    quitClicked_ = true;
+    notifyEvent();
+}
+
+void SdlKeyboard::notifyEvent(void) {
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex_);
+        ++eventsSequence_;
+    }
+    wake_.notify_all();
+}
+
 // This is a naive implementation and it assumes the SDL library has already 
 // been initialized somewhere else.
 void SdlKeyboard::processEvents(void) {
@@ -38,57 +72,64 @@ void SdlKeyboard::processEvents(void) {
         auto key = IKeyboard::Key();
         key.state = Key::State::kReleased;
 
-        while (SDL_PollEvent(&event)) {
-            if (event.type == SDL_KEYDOWN) {
-                auto scancode = event.key.keysym.scancode;
-                key.state = Key::State::kPressed;
-                key.value = convertScanCodeToCharValue(scancode);
-                keysQueue_.push(key);
+        // Sleeps until an event arrives (the timeout only bounds the shutdown check)
+        if (!SDL_WaitEventTimeout(&event, kWaitEventTimeoutMs)) {
+            continue;
+        }
+
+        do {
+            if ((event.type == SDL_KEYDOWN || event.type == SDL_KEYUP) &&
+                event.key.keysym.scancode == SDL_SCANCODE_BACKSPACE) {
+                // Not a CHIP-8 key: held to play the session backwards
+                rewindHeld_.store(event.type == SDL_KEYDOWN, std::memory_order_relaxed);
+            } else if (event.type == SDL_KEYDOWN || event.type == SDL_KEYUP) {
+                // Keys are mapped once here, so the CPU side only reads the bitmap
+                auto chip8Key = convertScanCodeToChip8Key(event.key.keysym.scancode);
+                if (chip8Key == kNoKey || event.key.repeat) {
+                    continue;
+                }
+
+                uint16_t mask = static_cast<uint16_t>(1 << chip8Key);
+                if (event.type == SDL_KEYDOWN) {
+                    key.state = Key::State::kPressed;
+                    pressedKeys_.fetch_or(mask, std::memory_order_relaxed);
+                } else {
+                    key.state = Key::State::kReleased;
+                    pressedKeys_.fetch_and(static_cast<uint16_t>(~mask), std::memory_order_relaxed);
+                }
+                key.value = chip8Key;
+                keyEvents_.push(key);
+                notifyEvent();
             } else if (event.type == SDL_QUIT) {
-                quitClicked_ = true;
+                requestQuit();
             }
-        }
+        } while (SDL_PollEvent(&event));
     }
 }
 
-char SdlKeyboard::convertScanCodeToCharValue(SDL_Scancode scancode) {
+// CHIP-8 hex keypad mapped on the left side of a QWERTY keyboard:
+// 1 2 3 C      1 2 3 4
+// 4 5 6 D  ->  Q W E R
+// 7 8 9 E      A S D F
+// A 0 B F      Z X C V
+uint8_t SdlKeyboard::convertScanCodeToChip8Key(SDL_Scancode scancode) {
     switch (scancode) {
-        case SDL_SCANCODE_A: return 'a';
-        case SDL_SCANCODE_B: return 'b';
-        case SDL_SCANCODE_C: return 'c';
-        case SDL_SCANCODE_D: return 'd';
-        case SDL_SCANCODE_E: return 'e';
-        case SDL_SCANCODE_F: return 'f';
-        case SDL_SCANCODE_G: return 'g';
-        case SDL_SCANCODE_H: return 'h';
-        case SDL_SCANCODE_I: return 'i';
-        case SDL_SCANCODE_J: return 'j';
-        case SDL_SCANCODE_K: return 'k';
-        case SDL_SCANCODE_L: return 'l';
-        case SDL_SCANCODE_M: return 'm';
-        case SDL_SCANCODE_N: return 'n';
-        case SDL_SCANCODE_O: return 'o';
-        case SDL_SCANCODE_P: return 'p';
-        case SDL_SCANCODE_Q: return 'q';
-        case SDL_SCANCODE_R: return 'r';
-        case SDL_SCANCODE_S: return 's';
-        case SDL_SCANCODE_T: return 't';
-        case SDL_SCANCODE_U: return 'u';
-        case SDL_SCANCODE_V: return 'v';
-        case SDL_SCANCODE_W: return 'w';
-        case SDL_SCANCODE_X: return 'x';
-        case SDL_SCANCODE_Y: return 'y';
-        case SDL_SCANCODE_Z: return 'z';
-        case SDL_SCANCODE_0: return '0';
-        case SDL_SCANCODE_1: return '1';
-        case SDL_SCANCODE_2: return '2';
-        case SDL_SCANCODE_3: return '3';
-        case SDL_SCANCODE_4: return '4';
-        case SDL_SCANCODE_5: return '5';
-        case SDL_SCANCODE_6: return '6';
-        case SDL_SCANCODE_7: return '7';
-        case SDL_SCANCODE_8: return '8';
-        case SDL_SCANCODE_9: return '9';
-        default: return '\0';
+        case SDL_SCANCODE_1: return 0x01;
+        case SDL_SCANCODE_2: return 0x02;
+        case SDL_SCANCODE_3: return 0x03;
+        case SDL_SCANCODE_4: return 0x0C;
+        case SDL_SCANCODE_Q: return 0x04;
+        case SDL_SCANCODE_W: return 0x05;
+        case SDL_SCANCODE_E: return 0x06;
+        case SDL_SCANCODE_R: return 0x0D;
+        case SDL_SCANCODE_A: return 0x07;
+        case SDL_SCANCODE_S: return 0x08;
+        case SDL_SCANCODE_D: return 0x09;
+        case SDL_SCANCODE_F: return 0x0E;
+        case SDL_SCANCODE_Z: return 0x0A;
+        case SDL_SCANCODE_X: return 0x00;
+        case SDL_SCANCODE_C: return 0x0B;
+        case SDL_SCANCODE_V: return 0x0F;
+        default: return kNoKey;
     }
 }
@@ -1,10 +1,13 @@
 #pragma once
 
 #include "IKeyboard.hpp"
+#include "SpscRing.hpp"
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <thread>
 #include <memory>
-#include <queue>
 #include <SDL2/SDL.h>
 
 
@@ -13,15 +16,37 @@ public:
     SdlKeyboard();
     virtual ~SdlKeyboard();
 
-    IKeyboard::Key getKey(void) override;
+    uint16_t pressedKeys(void) override;
+    bool getKeyEvent(IKeyboard::Key *key) override;
     bool quitClicked(void) override;
+    // Held with Backspace
+    bool rewindHeld(void) override;
+    bool waitForEvent(std::chrono::steady_clock::time_point deadline) override;
+    // Asks the session to end and wakes up whoever waits on this keyboard
+    void requestQuit(void);
 
 private:
-    char convertScanCodeToCharValue(SDL_Scancode scancode);
+    // Pending key edges kept for Fx0A, older edges win when it is full
+    static constexpr size_t kKeyEventsSize = 64;
+    static constexpr uint8_t kNoKey = 0xFF;
+    // Upper bound of a single SDL_WaitEventTimeout() (the destructor also wakes it up)
+    static constexpr int kWaitEventTimeoutMs = 250;
+
+    uint8_t convertScanCodeToChip8Key(SDL_Scancode scancode);
     void processEvents(void);
+    void notifyEvent(void);
     
-    bool runProccessEventsThread_;
-    bool quitClicked_;
+    std::atomic<bool> runProccessEventsThread_;
+    std::atomic<bool> quitClicked_;
+    // Wakes waitForEvent() up: eventsSequence_ moves on each key edge, seenSequence_ on each wait
+    std::mutex wakeMutex_;
+    std::condition_variable wake_;
+    uint64_t eventsSequence_;
+    uint64_t seenSequence_;
+    uint32_t wakeEventType_;
+    // Bit N set while the CHIP-8 key N is held, written by the events thread only
+    std::atomic<uint16_t> pressedKeys_;
+    std::atomic<bool> rewindHeld_;
+    SpscRing<IKeyboard::Key, kKeyEventsSize> keyEvents_;
     std::thread eventsThread_;
-    std::queue<IKeyboard::Key> keysQueue_;
 };
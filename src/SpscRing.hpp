@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+/*
+ * Bounded lock-free single producer / single consumer ring.
+ * kSize must be a power of 2. push() fails (the item is dropped) when the ring is full.
+ */
+template <typename T, size_t kSize>
+class SpscRing {
+    static_assert(kSize && !(kSize & (kSize - 1)), "SpscRing size must be a power of 2");
+
+public:
+    SpscRing() : head_(0), tail_(0) {}
+
+    // Producer side
+    bool push(const T &item) {
+        auto tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) == kSize) {
+            return false;
+        }
+
+        slots_[tail & (kSize - 1)] = item;
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side
+    bool pop(T *item) {
+        auto head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        *item = slots_[head & (kSize - 1)];
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    // Consumer and producer indexes live on separate cache lines
+    alignas(64) std::atomic<size_t> head_;
+    alignas(64) std::atomic<size_t> tail_;
+    T slots_[kSize];
+};
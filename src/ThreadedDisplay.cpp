@@ -0,0 +1,126 @@
+#include "ThreadedDisplay.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+ThreadedDisplay::ThreadedDisplay(uint32_t max_width, uint32_t max_height, uint32_t max_planes,
+                                 const Factory &factory) :
+    max_words_(static_cast<size_t>(max_width / 64) * max_height * max_planes),
+    frames_(Frame{std::vector<uint64_t>(max_words_, 0), max_width, max_height, 1}),
+    running_(true),
+    produced_(0),
+    presented_(0),
+    dropped_(0) {
+    std::promise<void> ready;
+    auto ready_future = ready.get_future();
+    thread_ = std::thread(&ThreadedDisplay::renderLoop, this, factory, std::move(ready));
+
+    try {
+        ready_future.get();
+    } catch (...) {
+        thread_.join();
+        throw;
+    }
+}
+
+ThreadedDisplay::~ThreadedDisplay() {
+    running_ = false;
+    wake_.notify_one();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void ThreadedDisplay::renderPacked(const uint64_t *screen_rows, uint32_t width, uint32_t height, uint64_t dirty_rows) {
+    renderPlanes(screen_rows, width, height, 1, dirty_rows);
+}
+
+void ThreadedDisplay::renderPlanes(const uint64_t *screen_rows, uint32_t width, uint32_t height, uint32_t planes,
+                                   uint64_t dirty_rows) {
+    // dirty_rows is not forwarded: frames can be dropped, so the render thread diffs against what it showed
+    auto words = static_cast<size_t>(width / 64) * height * planes;
+    if (words > max_words_) {
+        return;
+    }
+
+    auto &frame = frames_.back();
+    std::memcpy(frame.rows.data(), screen_rows, words * sizeof(uint64_t));
+    frame.width = width;
+    frame.height = height;
+    frame.planes = planes;
+
+    if (frames_.publish()) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+    produced_.fetch_add(1, std::memory_order_relaxed);
+    wake_.notify_one();
+}
+
+ThreadedDisplay::Stats ThreadedDisplay::stats(void) const {
+    return Stats{produced_.load(std::memory_order_relaxed), presented_.load(std::memory_order_relaxed),
+                 dropped_.load(std::memory_order_relaxed)};
+}
+
+void ThreadedDisplay::renderLoop(Factory factory, std::promise<void> ready) {
+    std::shared_ptr<IDisplay> display;
+    try {
+        display = factory();
+    } catch (...) {
+        ready.set_exception(std::current_exception());
+        return;
+    }
+    ready.set_value();
+
+    // Last frame shown, to compute the dirty rows of the next one
+    std::vector<uint64_t> shown(max_words_, 0);
+    uint32_t shown_width = 0;
+    uint32_t shown_height = 0;
+    uint32_t shown_planes = 0;
+
+    try {
+        while (running_) {
+            if (!frames_.consume()) {
+                // The producer notifies without locking: a wakeup racing with this wait only delays
+                // the frame to the end of the timeout
+                std::unique_lock<std::mutex> lock(wake_mutex_);
+                wake_.wait_for(lock, std::chrono::microseconds(kIdleWaitUs));
+                continue;
+            }
+
+            const auto &frame = frames_.front();
+            auto words_per_row = frame.width / 64;
+            auto plane_words = words_per_row * frame.height;
+            uint64_t dirty_rows = 0;
+            if (frame.width != shown_width || frame.height != shown_height || frame.planes != shown_planes) {
+                dirty_rows = ~0ULL;
+            } else {
+                for (uint32_t plane = 0; plane < frame.planes; ++plane) {
+                    for (uint32_t y = 0; y < frame.height; ++y) {
+                        auto first = plane * plane_words + y * words_per_row;
+                        if (!std::equal(&frame.rows[first], &frame.rows[first + words_per_row], &shown[first])) {
+                            dirty_rows |= 1ULL << y;
+                        }
+                    }
+                }
+            }
+
+            if (frame.planes > 1) {
+                display->renderPlanes(frame.rows.data(), frame.width, frame.height, frame.planes, dirty_rows);
+            } else {
+                display->renderPacked(frame.rows.data(), frame.width, frame.height, dirty_rows);
+            }
+            std::copy(frame.rows.begin(), frame.rows.begin() + plane_words * frame.planes, shown.begin());
+            shown_width = frame.width;
+            shown_height = frame.height;
+            shown_planes = frame.planes;
+            presented_.fetch_add(1, std::memory_order_relaxed);
+        }
+    } catch (const std::exception &err) {
+        std::cerr << "ERROR: render thread stopped: " << err.what() << std::endl;
+    }
+
+    // The wrapped display is released on the thread that created it
+    display.reset();
+}
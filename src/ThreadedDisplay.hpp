@@ -0,0 +1,78 @@
+#pragma once
+
+#include "IDisplay.hpp"
+#include "TripleBuffer.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Display that renders on its own thread.
+ *
+ * The wrapped display is created, used and destroyed by the render thread. renderPacked() only copies
+ * the frame into a lock-free triple buffer, so the CPU loop never waits for a present or a vsync, and
+ * the render thread always shows the latest complete frame.
+ */
+class ThreadedDisplay : public IDisplay {
+public:
+    using Factory = std::function<std::shared_ptr<IDisplay>(void)>;
+
+    struct Stats {
+        // Frames handed over by the core
+        uint64_t produced;
+        // Frames rendered by the wrapped display
+        uint64_t presented;
+        // Frames replaced by a newer one before being rendered
+        uint64_t dropped;
+    };
+
+    /** Starts the render thread and creates the wrapped display on it
+     *
+     * @param max_width largest frame width in pixels (multiple of 64)
+     * @param max_height largest frame height in pixels
+     * @param max_planes largest number of planes of a frame
+     * @param factory creates the wrapped display
+     *
+     * Rethrows any exception thrown by factory
+     */
+    ThreadedDisplay(uint32_t max_width, uint32_t max_height, uint32_t max_planes, const Factory &factory);
+    virtual ~ThreadedDisplay();
+
+    void renderPacked(const uint64_t *screen_rows, uint32_t width, uint32_t height, uint64_t dirty_rows) override;
+    void renderPlanes(const uint64_t *screen_rows, uint32_t width, uint32_t height, uint32_t planes,
+                      uint64_t dirty_rows) override;
+    // The next frame already carries the cleared screen
+    void clear(void) override {}
+
+    Stats stats(void) const;
+
+private:
+    // 60 Hz, upper bound of the render thread sleep when no frame comes in
+    static constexpr int64_t kIdleWaitUs = 16667;
+
+    struct Frame {
+        std::vector<uint64_t> rows;
+        uint32_t width;
+        uint32_t height;
+        uint32_t planes;
+    };
+
+    void renderLoop(Factory factory, std::promise<void> ready);
+
+    size_t max_words_;
+    TripleBuffer<Frame> frames_;
+    std::atomic<bool> running_;
+    std::atomic<uint64_t> produced_;
+    std::atomic<uint64_t> presented_;
+    std::atomic<uint64_t> dropped_;
+    // Only used by the render thread to sleep; the producer just notifies
+    std::mutex wake_mutex_;
+    std::condition_variable wake_;
+    std::thread thread_;
+};
@@ -0,0 +1,271 @@
+#include "TraceBuffer.hpp"
+#include "Chip8.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+static const char kTraceMagic[8] = "C8TRACE";
+static constexpr uint32_t kTraceVersion = 2;
+
+// Armed by dumpOnSignals(), read by the signal handler: no allocation there
+static std::atomic<const TraceBuffer *> g_signal_trace(nullptr);
+static char g_signal_path[4096];
+
+static bool writeAll(int fd, const void *data, size_t size) {
+    auto bytes = static_cast<const char *>(data);
+    while (size) {
+        auto written = ::write(fd, bytes, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        bytes += written;
+        size -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+static void onTraceSignal(int signal_number) {
+    auto errno_saved = errno;
+    auto trace = g_signal_trace.load(std::memory_order_acquire);
+    if (trace) {
+        trace->dump(g_signal_path);
+    }
+    errno = errno_saved;
+
+    // The crash signals were armed with SA_RESETHAND: once this returns, the default action runs
+    if (signal_number != SIGUSR1) {
+        raise(signal_number);
+    }
+}
+
+TraceBuffer::TraceBuffer(size_t capacity) :
+    head_(0),
+    address_mask_(0x0FFF) {
+    size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    records_ = std::make_unique<Record[]>(size);
+    mask_ = size - 1;
+}
+
+size_t TraceBuffer::capacity(void) const {
+    return mask_ + 1;
+}
+
+uint64_t TraceBuffer::total(void) const {
+    return head_.load(std::memory_order_acquire);
+}
+
+void TraceBuffer::setAddressMask(uint16_t mask) {
+    address_mask_ = mask;
+}
+
+bool TraceBuffer::dump(int fd) const {
+    auto head = head_.load(std::memory_order_acquire);
+    uint64_t count = head < capacity() ? head : capacity();
+
+    Header header = {};
+    std::memcpy(header.magic, kTraceMagic, sizeof(header.magic));
+    header.version = kTraceVersion;
+    header.record_size = sizeof(Record);
+    header.total = head;
+    header.count = count;
+    header.address_mask = address_mask_;
+    if (!writeAll(fd, &header, sizeof(header))) {
+        return false;
+    }
+
+    // Oldest first: from the oldest slot to the end of the array, then from its start
+    size_t first = (head - count) & mask_;
+    size_t tail_count = std::min<size_t>(count, capacity() - first);
+    return writeAll(fd, &records_[first], tail_count * sizeof(Record)) &&
+           writeAll(fd, &records_[0], (count - tail_count) * sizeof(Record));
+}
+
+bool TraceBuffer::dump(const char *path) const {
+    int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    bool written = dump(fd);
+    return ::close(fd) == 0 && written;
+}
+
+void TraceBuffer::dumpOnSignals(const TraceBuffer *trace, const std::string &path) {
+    if (path.size() >= sizeof(g_signal_path)) {
+        throw std::runtime_error("Trace path too long: " + path);
+    }
+    g_signal_trace.store(nullptr, std::memory_order_release);
+    std::strcpy(g_signal_path, path.c_str());
+    g_signal_trace.store(trace, std::memory_order_release);
+
+    struct sigaction on_demand = {};
+    on_demand.sa_handler = trace ? onTraceSignal : SIG_DFL;
+    on_demand.sa_flags = SA_RESTART;
+    sigemptyset(&on_demand.sa_mask);
+    sigaction(SIGUSR1, &on_demand, nullptr);
+
+    struct sigaction on_crash = on_demand;
+    on_crash.sa_flags = SA_RESETHAND;
+    for (auto signal_number : {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT}) {
+        sigaction(signal_number, &on_crash, nullptr);
+    }
+}
+
+TraceBuffer::Dump TraceBuffer::load(const std::string &path) {
+    std::ifstream f(path.c_str(), std::ios::in | std::ios::binary);
+    if (!f.good()) {
+        throw std::runtime_error("Failed to read trace " + path);
+    }
+
+    Header header;
+    f.read(reinterpret_cast<char *>(&header), sizeof(header));
+    if (!f.good() || std::memcmp(header.magic, kTraceMagic, sizeof(header.magic)) ||
+        header.version != kTraceVersion || header.record_size != sizeof(Record) || header.count > header.total) {
+        throw std::runtime_error("Not a trace dump: " + path);
+    }
+
+    Dump dump;
+    dump.first = header.total - header.count;
+    dump.address_mask = header.address_mask;
+    dump.records.resize(header.count);
+    f.read(reinterpret_cast<char *>(dump.records.data()), header.count * sizeof(Record));
+    if (static_cast<uint64_t>(f.gcount()) != header.count * sizeof(Record)) {
+        throw std::runtime_error("Truncated trace: " + path);
+    }
+    return dump;
+}
+
+const char *TraceBuffer::opcodeName(uint16_t opcode) {
+    if (opcode == Chip8::kClearScreen) {
+        return "kClearScreen";
+    }
+    if (opcode == Chip8::kReturn) {
+        return "kReturn";
+    }
+    // SUPER-CHIP / XO-CHIP
+    switch (opcode) {
+        case Chip8::kScrollRight: return "kScrollRight";
+        case Chip8::kScrollLeft: return "kScrollLeft";
+        case Chip8::kExit: return "kExit";
+        case Chip8::kLowRes: return "kLowRes";
+        case Chip8::kHighRes: return "kHighRes";
+        default: break;
+    }
+    if ((opcode & 0xFFF0) == Chip8::kScrollDown) {
+        return "kScrollDown";
+    }
+    if ((opcode & 0xFFF0) == Chip8::kScrollUp) {
+        return "kScrollUp";
+    }
+
+    switch ((opcode >> 12) & 0x000F) {
+        case Chip8::kJump: return "kJump";
+        case Chip8::kCall: return "kCall";
+        case Chip8::kSkipIfEqual: return "kSkipIfEqual";
+        case Chip8::kSkipIfNotEqual: return "kSkipIfNotEqual";
+        case Chip8::kSkipIfVxVyEqual: return "kSkipIfVxVyEqual";
+        case Chip8::kSetVxReg: return "kSetVxReg";
+        case Chip8::kAddValueToVxReg: return "kAddValueToVxReg";
+        case Chip8::kVRegOperation: return "kVRegOperation";
+        case Chip8::kSkipIfVxVyNotEqual: return "kSkipIfVxVyNotEqual";
+        case Chip8::kSetIndexRegI: return "kSetIndexRegI";
+        case Chip8::kJumpToAddrPlusV0: return "kJumpToAddrPlusV0";
+        case Chip8::kSetRandom: return "kSetRandom";
+        case Chip8::kDisplayDraw: return "kDisplayDraw";
+        case Chip8::kSkipNetIfKey: return "kSkipNetIfKey";
+        case Chip8::kMisc:
+            switch (opcode & 0x00FF) {
+                case Chip8::kMiscDelayTimerValue: return "kMiscDelayTimerValue";
+                case Chip8::kMiscWaitForKey: return "kMiscWaitForKey";
+                case Chip8::kMiscSetDelayTimer: return "kMiscSetDelayTimer";
+                case Chip8::kMiscSetSoundTimer: return "kMiscSetSoundTimer";
+                case Chip8::kMiscAddToIndex: return "kMiscAddToIndex";
+                case Chip8::kMiscFontChar: return "kMiscFontChar";
+                case Chip8::kMiscStoreBcd: return "kMiscStoreBcd";
+                case Chip8::kMiscStoreMemory: return "kMiscStoreMemory";
+                case Chip8::kMiscLoadMemory: return "kMiscLoadMemory";
+                case Chip8::kMiscLongIndex: return "kMiscLongIndex";
+                case Chip8::kMiscSelectPlanes: return "kMiscSelectPlanes";
+                case Chip8::kMiscAudioPattern: return "kMiscAudioPattern";
+                case Chip8::kMiscBigFontChar: return "kMiscBigFontChar";
+                case Chip8::kMiscSetPitch: return "kMiscSetPitch";
+                case Chip8::kMiscStoreFlags: return "kMiscStoreFlags";
+                case Chip8::kMiscLoadFlags: return "kMiscLoadFlags";
+                default: return "unknown";
+            }
+        default:
+            return "unknown";
+    }
+}
+
+void TraceBuffer::disassemble(uint64_t index, const Record &record, uint16_t address_mask, std::ostream &out) {
+    auto flags = out.flags();
+    auto fill = out.fill();
+    uint8_t x = (record.opcode >> 8) & 0x0F;
+    uint8_t kk = record.opcode & 0xFF;
+    int width = address_mask > 0xFFF ? 4 : 3;
+
+    out << std::dec << std::setfill(' ') << std::setw(12) << index << "  " << std::hex << std::uppercase
+        << std::setfill('0') << std::setw(width) << record.pc << "  " << std::setw(4) << record.opcode << "  "
+        << std::left << std::setfill(' ') << std::setw(22) << opcodeName(record.opcode) << std::right
+        << std::setfill('0');
+
+    // The state the instruction changed, from what its opcode writes
+    switch (record.opcode >> 12) {
+        case Chip8::kSetVxReg:
+        case Chip8::kAddValueToVxReg:
+        case Chip8::kVRegOperation:
+        case Chip8::kSetRandom:
+            out << "V" << int(x) << "=" << std::setw(2) << int(record.vx);
+            break;
+        case Chip8::kSetIndexRegI:
+            out << "I=" << std::setw(width) << record.i;
+            break;
+        case Chip8::kMisc:
+            switch (kk) {
+                case Chip8::kMiscDelayTimerValue:
+                case Chip8::kMiscWaitForKey:
+                    out << "V" << int(x) << "=" << std::setw(2) << int(record.vx);
+                    break;
+                case Chip8::kMiscAddToIndex:
+                case Chip8::kMiscFontChar:
+                case Chip8::kMiscBigFontChar:
+                case Chip8::kMiscLongIndex:
+                    out << "I=" << std::setw(width) << record.i;
+                    break;
+                case Chip8::kMiscStoreBcd:
+                    out << "[" << std::setw(width) << record.i << ".." << std::setw(width)
+                        << ((record.i + 2) & address_mask) << "]";
+                    break;
+                case Chip8::kMiscStoreMemory:
+                    out << "[" << std::setw(width) << record.i << ".." << std::setw(width)
+                        << ((record.i + x) & address_mask) << "]";
+                    break;
+                case Chip8::kMiscLoadMemory:
+                    out << "V0..V" << int(x) << ", V" << int(x) << "=" << std::setw(2) << int(record.vx);
+                    break;
+                default:
+                    break;
+            }
+            break;
+        default:
+            break;
+    }
+    out << "\n";
+
+    out.flags(flags);
+    out.fill(fill);
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*
+ * Binary execution trace: the last N instructions executed, as fixed-size records in a ring.
+ *
+ * Chip8 writes one record per instruction while it is attached (Chip8::setTrace()), the oldest records being
+ * overwritten. The ring has a single writer (the CPU thread) and no lock: it can be dumped at any time, from
+ * another thread or from a signal handler, with dump() being async-signal-safe. A dump taken while the CPU
+ * runs may hold a few torn records at its oldest end.
+ *
+ * Dump files are the header below followed by the records, oldest first, in host byte order.
+ */
+class TraceBuffer {
+public:
+    // One executed instruction (8 bytes)
+    struct Record {
+        uint16_t pc;
+        uint16_t opcode;
+        // The address written by Fx33 / Fx55 (I before the instruction, whatever the quirks do to I), else I
+        // after the instruction: the new I of Annn / Fx1E / Fx29
+        uint16_t i;
+        // Vx after the instruction (x being the second opcode nibble), the register an ALU op changes
+        uint8_t vx;
+        uint8_t reserved;
+    };
+    static_assert(sizeof(Record) == 8, "Compact trace record");
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t record_size;
+        // Instructions recorded since the trace was attached, the last one being the newest record
+        uint64_t total;
+        uint64_t count;
+        // Addresses wrap at address_mask + 1 (0xFFF, or 0xFFFF in XO-CHIP mode)
+        uint16_t address_mask;
+        uint16_t reserved[3];
+    };
+
+    struct Dump {
+        // Index of the first record in the whole trace
+        uint64_t first;
+        uint16_t address_mask;
+        std::vector<Record> records;
+    };
+
+    // Default capacity, in records (512 KB)
+    static constexpr size_t kDefaultCapacity = 1 << 16;
+
+    // capacity is rounded up to a power of 2
+    explicit TraceBuffer(size_t capacity = kDefaultCapacity);
+    virtual ~TraceBuffer() {}
+
+    // Writer side, a handful of stores
+    void record(uint16_t pc, uint16_t opcode, uint16_t i, uint8_t vx) {
+        auto head = head_.load(std::memory_order_relaxed);
+        auto &slot = records_[head & mask_];
+        slot.pc = pc;
+        slot.opcode = opcode;
+        slot.i = i;
+        slot.vx = vx;
+        head_.store(head + 1, std::memory_order_release);
+    }
+
+    size_t capacity(void) const;
+    uint64_t total(void) const;
+    // Address space of the traced machine, saved in the dumps (default: 0xFFF). Chip8 sets it.
+    void setAddressMask(uint16_t mask);
+
+    // Async-signal-safe (open / write / close only). Return false on I/O errors.
+    bool dump(int fd) const;
+    bool dump(const char *path) const;
+    /** Dumps trace to path on SIGUSR1 (and keeps running), and on SIGSEGV, SIGBUS, SIGILL, SIGFPE and SIGABRT
+     * before the default action. A single trace can be armed at a time, nullptr disarms it.
+     */
+    static void dumpOnSignals(const TraceBuffer *trace, const std::string &path);
+
+    // Throws std::runtime_error on I/O or format errors
+    static Dump load(const std::string &path);
+    // Name of the Chip8::Opcodes entry the opcode decodes to ("unknown" if none)
+    static const char *opcodeName(uint16_t opcode);
+    // One line: index, PC, opcode, name and the state it changed, addresses wrapped at address_mask
+    static void disassemble(uint64_t index, const Record &record, uint16_t address_mask, std::ostream &out);
+
+private:
+    std::unique_ptr<Record[]> records_;
+    size_t mask_;
+    std::atomic<uint64_t> head_;
+    uint16_t address_mask_;
+};
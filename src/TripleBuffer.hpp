@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/*
+ * Lock-free single producer / single consumer triple buffer.
+ *
+ * The producer fills back() and publish()es it, the consumer takes the latest published slot with
+ * consume() and reads front(). Neither side ever waits: when the producer publishes twice before
+ * the consumer runs, the older frame is dropped and the consumer always gets the newest one.
+ */
+template <typename T>
+class TripleBuffer {
+public:
+    explicit TripleBuffer(const T &initial) :
+        slots_{initial, initial, initial},
+        back_(0),
+        middle_(1),
+        front_(2) {}
+
+    // Producer side
+    T &back(void) { return slots_[back_]; }
+
+    /** Hands back() over to the consumer
+     *
+     * Returns true when the previously published slot was never consumed (dropped)
+     */
+    bool publish(void) {
+        auto previous = middle_.exchange(back_ | kFresh, std::memory_order_acq_rel);
+        back_ = previous & kIndexMask;
+        return previous & kFresh;
+    }
+
+    // Consumer side: returns true when a newer slot is now in front()
+    bool consume(void) {
+        if (!(middle_.load(std::memory_order_relaxed) & kFresh)) {
+            return false;
+        }
+
+        auto previous = middle_.exchange(front_, std::memory_order_acq_rel);
+        front_ = previous & kIndexMask;
+        return true;
+    }
+
+    const T &front(void) const { return slots_[front_]; }
+
+private:
+    static constexpr uint8_t kIndexMask = 0x03;
+    // Set in middle_ when it holds a slot the consumer has not seen yet
+    static constexpr uint8_t kFresh = 0x04;
+
+    T slots_[3];
+    // Only touched by the producer
+    uint8_t back_;
+    std::atomic<uint8_t> middle_;
+    // Only touched by the consumer
+    uint8_t front_;
+};
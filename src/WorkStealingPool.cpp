@@ -0,0 +1,107 @@
+#include "WorkStealingPool.hpp"
+
+WorkStealingPool::WorkStealingPool(size_t threads) :
+    next_queue_(0),
+    queued_(0),
+    pending_(0),
+    stop_(false) {
+    if (threads == 0) {
+        threads = std::thread::hardware_concurrency();
+    }
+    if (threads == 0) {
+        threads = 1;
+    }
+
+    for (size_t i = 0; i < threads; ++i) {
+        queues_.emplace_back(std::make_unique<Queue>());
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        workers_.emplace_back(&WorkStealingPool::workerLoop, this, i);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    work_.notify_all();
+
+    for (auto &worker : workers_) {
+        worker.join();
+    }
+}
+
+void WorkStealingPool::submit(Task task) {
+    auto &queue = *queues_[next_queue_++ % queues_.size()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+    pending_.fetch_add(1);
+    queued_.fetch_add(1);
+
+    // Taking the lock orders the counter update with a worker checking it before going to sleep
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+    }
+    work_.notify_one();
+}
+
+void WorkStealingPool::wait(void) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this]() { return pending_.load() == 0; });
+}
+
+size_t WorkStealingPool::threads(void) const {
+    return workers_.size();
+}
+
+void WorkStealingPool::workerLoop(size_t index) {
+    while (true) {
+        Task task;
+        if (popLocal(index, &task) || steal(index, &task)) {
+            queued_.fetch_sub(1);
+            task();
+            if (pending_.fetch_sub(1) == 1) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                done_.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        work_.wait(lock, [this]() { return stop_ || queued_.load() > 0; });
+        if (stop_ && queued_.load() == 0) {
+            return;
+        }
+    }
+}
+
+bool WorkStealingPool::popLocal(size_t index, Task *task) {
+    auto &queue = *queues_[index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) {
+        return false;
+    }
+
+    *task = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    return true;
+}
+
+bool WorkStealingPool::steal(size_t index, Task *task) {
+    for (size_t i = 1; i < queues_.size(); ++i) {
+        auto &queue = *queues_[(index + i) % queues_.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) {
+            continue;
+        }
+
+        // Oldest task of the victim, the owner keeps working from the other end
+        *task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+        return true;
+    }
+    return false;
+}
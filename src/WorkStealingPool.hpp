@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Fixed-size thread pool with one task queue per worker.
+ *
+ * submit() spreads the tasks round-robin over the queues. A worker takes its own tasks from the back
+ * and, once its queue is empty, steals from the front of the other queues, so long jobs on one worker
+ * do not leave the others idle. Tasks must not throw.
+ * submit() and wait() are called by a single thread (the owner of the pool).
+ */
+class WorkStealingPool {
+public:
+    using Task = std::function<void(void)>;
+
+    // threads = 0 uses one worker per hardware thread
+    explicit WorkStealingPool(size_t threads = 0);
+    // Runs the tasks still queued, then joins the workers
+    virtual ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool &) = delete;
+    WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+    void submit(Task task);
+    // Blocks until every submitted task has finished
+    void wait(void);
+    size_t threads(void) const;
+
+private:
+    // One cache line per queue, the workers lock them concurrently
+    struct alignas(64) Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void workerLoop(size_t index);
+    bool popLocal(size_t index, Task *task);
+    bool steal(size_t index, Task *task);
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> workers_;
+    size_t next_queue_;
+    // Tasks queued and not picked up yet
+    std::atomic<uint64_t> queued_;
+    // Tasks submitted and not finished yet
+    std::atomic<uint64_t> pending_;
+    bool stop_;
+    // Guards stop_ and the sleep / wake up of the workers and of wait()
+    std::mutex mutex_;
+    std::condition_variable work_;
+    std::condition_variable done_;
+};
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+ * xoshiro256** generator (Blackman / Vigna): 32 bytes of state and a handful of instructions per number.
+ * The state is expanded from a 64-bit seed with splitmix64, so every seed (including 0) is usable and the
+ * same seed always gives the same sequence, on every host.
+ */
+class Xoshiro256 {
+public:
+    explicit Xoshiro256(uint64_t seed = 0) { this->seed(seed); }
+
+    void seed(uint64_t value) {
+        for (auto &word : s_) {
+            value += 0x9E3779B97F4A7C15ULL;
+            uint64_t z = value;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            word = z ^ (z >> 31);
+        }
+    }
+
+    uint64_t next(void) {
+        uint64_t result = rotl(s_[1] * 5, 7) * 9;
+        uint64_t t = s_[1] << 17;
+
+        s_[2] ^= s_[0];
+        s_[3] ^= s_[1];
+        s_[1] ^= s_[2];
+        s_[0] ^= s_[3];
+        s_[2] ^= t;
+        s_[3] = rotl(s_[3], 45);
+
+        return result;
+    }
+
+    // Top byte of the next number (the high bits are the best mixed ones)
+    uint8_t nextByte(void) { return static_cast<uint8_t>(next() >> 56); }
+
+private:
+    static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+    uint64_t s_[4];
+};
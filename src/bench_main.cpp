@@ -0,0 +1,338 @@
+#include "Chip8.hpp"
+#include "Chip8Bench.hpp"
+#include "NullDisplay.hpp"
+#include "NullKeyboard.hpp"
+#include "SdlDisplay.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+ * Microbenchmarks of the hot paths (fetch + decode, draw, clear, SDL render) and macro benchmarks of whole roms.
+ *
+ * Each benchmark runs a body of n operations, n being doubled until one run lasts --min-time, then measured
+ * kRepetitions times; the median is reported. Results are printed as JSON (default) or CSV, one entry per
+ * benchmark, so runs can be compared by a script.
+ */
+
+static constexpr int kRepetitions = 5;
+// Synthetic programs: this many instructions, then a jump back to the start
+static constexpr size_t kStreamLength = 1024;
+static constexpr uint16_t kRomStart = 0x200;
+
+struct Result {
+    std::string name;
+    uint64_t iterations;
+    double ns_per_op;
+    double ops_per_s;
+};
+
+struct Options {
+    double min_time_s = 0.1;
+    bool csv = false;
+    std::string filter;
+    std::vector<std::string> roms;
+};
+
+static void printHelp(void) {
+    std::cout << "Help:\n";
+    std::cout << "    ./achip8emu_bench [--format <json|csv>] [--filter <text>] [--min-time <s>] [<rom_path>...]\n";
+    std::cout << "Options:\n";
+    std::cout << "    --format <json|csv>   output format (default: json)\n";
+    std::cout << "    --filter <text>       only runs the benchmarks whose name contains text\n";
+    std::cout << "    --min-time <s>        minimum duration of a measured run (default: 0.1)\n";
+    std::cout << "    <rom_path>            runs the rom headless as a macro benchmark, with each engine\n";
+}
+
+static bool selected(const std::string &name, const Options &options) {
+    return name.find(options.filter) != std::string::npos;
+}
+
+// body(n) runs n operations and returns how many it ran. Benchmarks left out by --filter are not run.
+static void measure(const std::string &name, const Options &options, std::vector<Result> *results,
+                    const std::function<uint64_t(uint64_t)> &body) {
+    if (!selected(name, options)) {
+        return;
+    }
+
+    using Clock = std::chrono::steady_clock;
+    uint64_t iterations = 1;
+    for (;;) {
+        auto start = Clock::now();
+        body(iterations);
+        std::chrono::duration<double> elapsed = Clock::now() - start;
+        if (elapsed.count() >= options.min_time_s || iterations >= (1ULL << 40)) {
+            break;
+        }
+        iterations *= 2;
+    }
+
+    std::vector<double> ns_per_op;
+    uint64_t ops = 0;
+    for (int i = 0; i < kRepetitions; ++i) {
+        auto start = Clock::now();
+        ops = body(iterations);
+        std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+        ns_per_op.push_back(elapsed.count() / std::max<uint64_t>(ops, 1));
+    }
+    std::sort(ns_per_op.begin(), ns_per_op.end());
+    auto median = ns_per_op[ns_per_op.size() / 2];
+    results->push_back({name, ops, median, median > 0.0 ? 1e9 / median : 0.0});
+}
+
+// pattern repeated up to kStreamLength instructions
+static std::vector<uint16_t> repeat(const std::vector<uint16_t> &pattern) {
+    std::vector<uint16_t> stream(kStreamLength);
+    for (size_t i = 0; i < kStreamLength; ++i) {
+        stream[i] = pattern[i % pattern.size()];
+    }
+    return stream;
+}
+
+// Big-endian program: the stream, a jump back to its start, then the tail
+static std::vector<uint8_t> makeRom(const std::vector<uint16_t> &stream, const std::vector<uint16_t> &tail = {}) {
+    std::vector<uint8_t> rom;
+    auto put = [&rom](uint16_t opcode) {
+        rom.push_back(static_cast<uint8_t>(opcode >> 8));
+        rom.push_back(static_cast<uint8_t>(opcode & 0xFF));
+    };
+    for (auto opcode : stream) {
+        put(opcode);
+    }
+    put(0x1000 | kRomStart);
+    for (auto opcode : tail) {
+        put(opcode);
+    }
+    return rom;
+}
+
+static std::unique_ptr<Chip8> makeChip8(const std::vector<uint8_t> &rom) {
+    std::shared_ptr<IDisplay> display = std::make_shared<NullDisplay>();
+    std::shared_ptr<IKeyboard> keyboard = std::make_shared<NullKeyboard>();
+    auto chip8 = std::make_unique<Chip8>(display, keyboard);
+    chip8->seed(0);
+    chip8->loadRom(rom);
+    return chip8;
+}
+
+static void benchFetchDecode(const Options &options, std::vector<Result> *results) {
+    // Taken and not taken skips (V0 and V1 stay 0), a jump to the next instruction and a call to the subroutine
+    // right after the jump back to the start, which returns at once
+    constexpr uint16_t kSubroutine = kRomStart + 2 * (kStreamLength + 1);
+    std::vector<uint16_t> flow;
+    while (flow.size() + 8 <= kStreamLength) {
+        uint16_t next = static_cast<uint16_t>(kRomStart + 2 * (flow.size() + 7));
+        flow.insert(flow.end(), {0x3000, 0x6001, 0x4000, 0x5010, 0x6002, 0x9010, static_cast<uint16_t>(0x1000 | next),
+                                 static_cast<uint16_t>(0x2000 | kSubroutine)});
+    }
+
+    const std::vector<std::pair<std::string, std::vector<uint16_t>>> streams = {
+        // LD, ADD, every 8xyN and RND on varying registers
+        {"alu", repeat({0x6012, 0x7134, 0x8200, 0x8311, 0x8422, 0x8533, 0x8644, 0x8755, 0x8866, 0x8977, 0x8A8E,
+                        0xCB3F})},
+        {"flow", flow},
+        // Index, BCD and register stores / loads, far from the code
+        {"memory", repeat({0xAE00, 0xF21E, 0xF029, 0xF333, 0xAE10, 0xF355, 0xF365, 0xF007})},
+    };
+
+    for (const auto &stream : streams) {
+        auto chip8 = makeChip8(makeRom(stream.second, {Chip8::kReturn}));
+        measure("fetch_decode/" + stream.first, options, results, [&chip8](uint64_t n) {
+            Chip8Bench::fetchDecode(*chip8, n);
+            return n;
+        });
+    }
+}
+
+static void benchDraw(const Options &options, std::vector<Result> *results) {
+    struct Case {
+        const char *name;
+        uint8_t x;
+        uint8_t y;
+        uint8_t n;
+    };
+    // The sprite data is the font (address 0), 15 rows are read across the 0 - 2 glyphs
+    const Case cases[] = {
+        {"draw/h1_aligned", 0, 0, 1},
+        {"draw/h5_aligned", 8, 4, 5},
+        {"draw/h15_aligned", 16, 8, 15},
+        {"draw/h5_unaligned", 3, 4, 5},
+        {"draw/h15_unaligned", 29, 8, 15},
+        {"draw/h15_clip_right", 60, 8, 15},
+        {"draw/h15_clip_bottom", 20, 25, 15},
+        {"draw/h15_wrap", 70, 40, 15},
+    };
+
+    auto chip8 = makeChip8(makeRom({}));
+    for (const auto &draw : cases) {
+        measure(draw.name, options, results, [&chip8, &draw](uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i) {
+                Chip8Bench::draw(*chip8, draw.x, draw.y, draw.n, 0);
+            }
+            return n;
+        });
+    }
+}
+
+static void benchClear(const Options &options, std::vector<Result> *results) {
+    auto chip8 = makeChip8(makeRom({}));
+    measure("clear/blank", options, results, [&chip8](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            Chip8Bench::clearScreen(*chip8);
+        }
+        return n;
+    });
+    // Includes refilling the 32 rows, every row is dirtied by the clear
+    measure("clear/full", options, results, [&chip8](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            Chip8Bench::fillScreen(*chip8);
+            Chip8Bench::clearScreen(*chip8);
+        }
+        return n;
+    });
+}
+
+static void benchRender(const Options &options, std::vector<Result> *results) {
+    const std::pair<const char *, uint64_t> cases[] = {
+        {"render/sdl_full_frame", ~0ULL},
+        {"render/sdl_one_row", 1ULL << 7},
+        {"render/sdl_sprite_rows", 0xFULL << 12},
+        {"render/sdl_identical", 0},
+    };
+    if (std::none_of(std::begin(cases), std::end(cases), [&options](const std::pair<const char *, uint64_t> &render) {
+            return selected(render.first, options);
+        })) {
+        return;
+    }
+
+    // No window needed: the dummy video driver renders in memory, unless the environment asks for another
+    SDL_setenv("SDL_VIDEODRIVER", "dummy", 0);
+
+    std::unique_ptr<SdlDisplay> display;
+    try {
+        display = std::make_unique<SdlDisplay>(Chip8::kDisplayWidth, Chip8::kDisplayHeight);
+    } catch (const std::exception &err) {
+        std::cerr << "render benchmarks skipped: " << err.what() << "\n";
+        return;
+    }
+
+    // Two frames swapped on every render, so the dirty rows really change
+    uint64_t frames[2][Chip8::kDisplayHeight];
+    for (size_t row = 0; row < Chip8::kDisplayHeight; ++row) {
+        frames[0][row] = 0xAAAAAAAAAAAAAAAAULL >> (row & 1);
+        frames[1][row] = ~frames[0][row];
+    }
+    for (const auto &render : cases) {
+        measure(render.first, options, results, [&display, &frames, &render](uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i) {
+                display->renderPacked(frames[i & 1], Chip8::kDisplayWidth, Chip8::kDisplayHeight, render.second);
+            }
+            return n;
+        });
+    }
+}
+
+static void benchRoms(const Options &options, std::vector<Result> *results) {
+    const std::pair<const char *, Chip8::Engine> engines[] = {
+        {"switch", Chip8::Engine::kSwitch},
+        {"predecoded", Chip8::Engine::kPredecoded},
+        {"threaded", Chip8::Engine::kThreaded},
+        {"jit", Chip8::Engine::kJit},
+    };
+
+    for (const auto &path : options.roms) {
+        auto rom = Chip8::readRom(path);
+        auto name = path.substr(path.find_last_of('/') + 1);
+        for (const auto &engine : engines) {
+            auto chip8 = makeChip8(rom);
+            chip8->setEngine(engine.second);
+            // Every instruction counted must have been run
+            chip8->setIdleLoopSkip(false);
+            uint64_t wait_cycles = 0;
+            auto bench_name = "rom/" + name + "/" + engine.first;
+            measure(bench_name, options, results, [&chip8, &wait_cycles](uint64_t n) {
+                auto stats = chip8->runHeadless(n, 0);
+                wait_cycles += stats.wait_cycles;
+                return stats.instructions;
+            });
+            // Parked on Fx0A, a run skips its cycles in no time: its ns/op would mean nothing
+            if (wait_cycles) {
+                results->pop_back();
+                std::cerr << bench_name << " skipped: the rom waits for a key (Fx0A), after "
+                          << chip8->instructionCount() << " instructions\n";
+            }
+        }
+    }
+}
+
+static void printResults(const std::vector<Result> &results, bool csv) {
+    std::cout << std::fixed << std::setprecision(3);
+    if (csv) {
+        std::cout << "name,iterations,ns_per_op,ops_per_s\n";
+        for (const auto &result : results) {
+            std::cout << result.name << "," << result.iterations << "," << result.ns_per_op << ","
+                      << result.ops_per_s << "\n";
+        }
+        return;
+    }
+
+    std::cout << "{\n  \"benchmarks\": [";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const auto &result = results[i];
+        std::cout << (i ? ",\n" : "\n") << "    {\"name\": \"" << result.name << "\", \"iterations\": "
+                  << result.iterations << ", \"ns_per_op\": " << result.ns_per_op << ", \"ops_per_s\": "
+                  << result.ops_per_s << "}";
+    }
+    std::cout << "\n  ]\n}\n";
+}
+
+int main(int argc, char **argv) {
+    Options options;
+
+    try {
+        for (int i = 1; i < argc; ++i) {
+            if (!std::strcmp(argv[i], "--format") && i + 1 < argc) {
+                std::string format = argv[++i];
+                if (format != "json" && format != "csv") {
+                    throw std::invalid_argument(format);
+                }
+                options.csv = format == "csv";
+            } else if (!std::strcmp(argv[i], "--filter") && i + 1 < argc) {
+                options.filter = argv[++i];
+            } else if (!std::strcmp(argv[i], "--min-time") && i + 1 < argc) {
+                options.min_time_s = std::stod(argv[++i]);
+            } else if (!std::strcmp(argv[i], "--help") || !std::strcmp(argv[i], "-h")) {
+                printHelp();
+                return EXIT_SUCCESS;
+            } else if (argv[i][0] != '-') {
+                options.roms.push_back(argv[i]);
+            } else {
+                throw std::invalid_argument(argv[i]);
+            }
+        }
+    } catch (const std::exception &err) {
+        std::cerr << "Failed to run: invalid argument " << err.what() << "\n";
+        printHelp();
+        return EXIT_FAILURE;
+    }
+
+    std::vector<Result> results;
+    try {
+        benchFetchDecode(options, &results);
+        benchDraw(options, &results);
+        benchClear(options, &results);
+        benchRender(options, &results);
+        benchRoms(options, &results);
+    } catch (const std::exception &err) {
+        std::cerr << "ERROR: " << err.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    printResults(results, options.csv);
+    return EXIT_SUCCESS;
+}
@@ -1,26 +1,570 @@
+#include "AllocationCounter.hpp"
+#include "BatchRunner.hpp"
 #include "Chip8.hpp"
+#include "Chip8Lockstep.hpp"
+#include "Movie.hpp"
+#include "Profiler.hpp"
+#include "TraceBuffer.hpp"
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "NullDisplay.hpp"
+#include "NullKeyboard.hpp"
+#include "SdlAudio.hpp"
 #include "SdlDisplay.hpp"
 #include "SdlKeyboard.hpp"
+#include "ThreadedDisplay.hpp"
+
+// About 30 minutes of 60 Hz frames for most roms
+static constexpr size_t kDefaultRewindMb = 4;
+
+// Optional instrumentation of a run: --profile, --trace and --check-allocs
+struct Instrumentation {
+    std::string profile_prefix;
+    std::string trace_path;
+    Profiler profiler;
+    // Only allocated with --trace
+    std::unique_ptr<TraceBuffer> trace;
+    bool check_allocs = false;
+    // Heap allocations made by the run, after load()
+    uint64_t allocations = 0;
+};
+
+static void printHelp(void) {
+    std::cout << "Help:\n";
+    std::cout << "    ./achip8emu [--cpf <n>] [--costs <list>] [--rewind <MB>] [--audio-buffer <samples>] "
+                 "[--record <movie_path>] [--profile <prefix>] [--trace <trace_path>] <file_path>\n";
+    std::cout << "    ./achip8emu --replay <movie_path> [--profile <prefix>] [--trace <trace_path>] <file_path>\n";
+    std::cout << "    ./achip8emu --headless [--instructions <n>] [--frames <n>] [--cpf <n>] [--costs <list>] "
+                 "[--profile <prefix>] [--trace <trace_path>] [--check-allocs] [--benchmark] <file_path>\n";
+    std::cout << "    ./achip8emu --batch [--instructions <n>] [--frames <n>] [--threads <n>] [--seeds <n>] [--lockstep] "
+                 "<file_path>...\n";
+    std::cout << "Options:\n";
+    std::cout << "    --engine <switch|predecoded|threaded|jit>  execution engine (default: switch)\n";
+    std::cout << "    --mode <chip8|schip|xochip>                instruction set and display (default: chip8), schip "
+                 "adds hi-res and scrolling, xochip 64 KB and two bit-planes\n";
+    std::cout << "    --cpf <n>                                  CPU cycles per 60 Hz frame (default: "
+              << Chip8::kInstructionsPerFrame << ", 500 Hz)\n";
+    std::cout << "    --costs <c0,...,cF>                        cycles taken by each instruction, by first opcode nibble "
+                 "(default: all 1)\n";
+    std::cout << "    --no-idle-skip                             executes delay timer busy-waits instead of skipping "
+                 "them\n";
+    std::cout << "    --benchmark                                headless run with every engine, compared to switch\n";
+    std::cout << "    --quirks <modern|vip|schip>                shift, load / store, Bnnn and logic behaviors (default: "
+                 "schip in --mode schip, else modern), vip runs on the switch engine\n";
+    std::cout << "    --threads <n>                              batch workers (default: one per hardware thread)\n";
+    std::cout << "    --seeds <n>                                batch jobs per rom, seeded 0 to n - 1 (default: 1)\n";
+    std::cout << "    --lockstep                                 batch jobs run " << Chip8Lockstep::kLanes
+              << " at a time on SIMD lanes\n";
+    std::cout << "    --rewind <MB>                              rewind history kept, hold Backspace to rewind "
+                 "(default: " << kDefaultRewindMb << ", 0 = off)\n";
+    std::cout << "    --audio-buffer <samples>                   audio device buffer, the sound latency (default: "
+              << SdlAudio::kDefaultBufferSamples << ", 0 = no sound)\n";
+    std::cout << "    --record <movie_path>                      records the seed, ticks and key input of the session\n";
+    std::cout << "    --replay <movie_path>                      replays a recorded session headless, at full speed\n";
+    std::cout << "    --profile <prefix>                         writes an execution profile to <prefix>.json and "
+                 "<prefix>.folded\n";
+    std::cout << "    --trace <trace_path>                       dumps the last " << TraceBuffer::kDefaultCapacity
+              << " instructions executed to trace_path at exit, on SIGUSR1 and on a crash\n";
+    std::cout << "    --check-allocs                             fails the headless run if the emulation allocates "
+                 "heap memory after load\n";
+}
+
+static const std::vector<std::pair<std::string, Chip8::Engine>> kEngines = {
+    {"switch", Chip8::Engine::kSwitch},
+    {"predecoded", Chip8::Engine::kPredecoded},
+    {"threaded", Chip8::Engine::kThreaded},
+    {"jit", Chip8::Engine::kJit}
+};
+
+static const std::vector<std::pair<std::string, Chip8::Quirks>> kQuirks = {
+    {"modern", Chip8::Quirks::kModern},
+    {"vip", Chip8::Quirks::kCosmacVip},
+    {"schip", Chip8::Quirks::kSuperChip}
+};
+
+static const std::vector<std::pair<std::string, Chip8::Mode>> kModes = {
+    {"chip8", Chip8::Mode::kChip8},
+    {"schip", Chip8::Mode::kSuperChip},
+    {"xochip", Chip8::Mode::kXoChip}
+};
+
+static Chip8::Mode parseMode(const std::string &name) {
+    for (const auto &mode : kModes) {
+        if (mode.first == name) {
+            return mode.second;
+        }
+    }
+    throw std::invalid_argument(name);
+}
+
+static Chip8::Quirks parseQuirks(const std::string &name) {
+    for (const auto &quirks : kQuirks) {
+        if (quirks.first == name) {
+            return quirks.second;
+        }
+    }
+    throw std::invalid_argument(name);
+}
+
+static Chip8::Engine parseEngine(const std::string &name) {
+    for (const auto &engine : kEngines) {
+        if (engine.first == name) {
+            return engine.second;
+        }
+    }
+    throw std::invalid_argument(name);
+}
+
+// 16 comma separated costs, one per first opcode nibble
+static std::array<uint8_t, 16> parseCosts(const std::string &list) {
+    std::array<uint8_t, 16> costs;
+    std::istringstream fields(list);
+    std::string field;
+    size_t count = 0;
+    while (std::getline(fields, field, ',')) {
+        auto cost = std::stoul(field);
+        if (count >= costs.size() || !cost || cost > 0xFF) {
+            throw std::invalid_argument(list);
+        }
+        costs[count++] = static_cast<uint8_t>(cost);
+    }
+    if (count != costs.size()) {
+        throw std::invalid_argument(list);
+    }
+    return costs;
+}
+
+// <prefix>.json for the counts, <prefix>.folded for flame graph tools
+static void writeProfile(const Profiler &profiler, const std::string &prefix) {
+    std::ofstream json(prefix + ".json", std::ios::out | std::ios::trunc);
+    profiler.writeJson(json);
+    std::ofstream folded(prefix + ".folded", std::ios::out | std::ios::trunc);
+    profiler.writeCollapsed(folded);
+    // Buffered write errors only show once flushed
+    json.close();
+    folded.close();
+    if (json.fail() || folded.fail()) {
+        throw std::runtime_error("Failed to write profile " + prefix);
+    }
+    std::cout << "profile saved to " << prefix << ".json and " << prefix << ".folded\n";
+}
+
+static void attachInstrumentation(Chip8 *chip8, Instrumentation *instrumentation) {
+    if (!instrumentation->profile_prefix.empty()) {
+        chip8->setProfiler(&instrumentation->profiler);
+    }
+    if (!instrumentation->trace_path.empty()) {
+        instrumentation->trace = std::make_unique<TraceBuffer>();
+        TraceBuffer::dumpOnSignals(instrumentation->trace.get(), instrumentation->trace_path);
+        chip8->setTrace(instrumentation->trace.get());
+    }
+}
+
+// Also called when the run fails: the trace shows how it got there
+static void dumpTrace(Instrumentation *instrumentation) {
+    if (!instrumentation->trace) {
+        return;
+    }
+    TraceBuffer::dumpOnSignals(nullptr, "");
+    if (instrumentation->trace->dump(instrumentation->trace_path.c_str())) {
+        std::cout << "trace saved to " << instrumentation->trace_path << "\n";
+    } else {
+        std::cerr << "ERROR: Failed to write trace " << instrumentation->trace_path << std::endl;
+    }
+}
+
+static void saveInstrumentation(Instrumentation *instrumentation) {
+    dumpTrace(instrumentation);
+    if (!instrumentation->profile_prefix.empty()) {
+        writeProfile(instrumentation->profiler, instrumentation->profile_prefix);
+    }
+}
+
+static Chip8::RunStats runHeadlessOnce(const std::string &path, Chip8::Engine engine, Chip8::Mode mode,
+                                       Chip8::Quirks quirks, uint64_t max_instructions, uint64_t max_frames,
+                                       const Chip8::Timing &timing = Chip8::Timing(),
+                                       Instrumentation *instrumentation = nullptr) {
+    std::shared_ptr<IDisplay> display = std::make_shared<NullDisplay>();
+    std::shared_ptr<IKeyboard> keyboard = std::make_shared<NullKeyboard>();
+    auto chip8 = Chip8(display, keyboard);
+    chip8.setMode(mode);
+    chip8.setQuirks(quirks);
+    chip8.load(path);
+    chip8.setEngine(engine);
+    chip8.setTiming(timing);
+    if (instrumentation) {
+        attachInstrumentation(&chip8, instrumentation);
+    }
+    auto allocations = AllocationCounter::count();
+    auto stats = chip8.runHeadless(max_instructions, max_frames);
+    if (instrumentation) {
+        instrumentation->allocations = AllocationCounter::count() - allocations;
+    }
+    if (stats.wall_time_s <= 0.0) {
+        stats.wall_time_s = 1e-9;
+    }
+    return stats;
+}
+
+static int runHeadless(const std::string &path, Chip8::Engine engine, Chip8::Mode mode, Chip8::Quirks quirks,
+                       uint64_t max_instructions, uint64_t max_frames, const Chip8::Timing &timing,
+                       Instrumentation *instrumentation) {
+    try {
+        auto stats = runHeadlessOnce(path, engine, mode, quirks, max_instructions, max_frames, timing,
+                                     instrumentation);
+        std::cout << "instructions: " << stats.instructions << "\n";
+        std::cout << "wait_cycles: " << stats.wait_cycles << "\n";
+        std::cout << "frames: " << stats.frames << "\n";
+        std::cout << "idle_hits: " << stats.idle_hits << "\n";
+        std::cout << "wall_time_s: " << stats.wall_time_s << "\n";
+        std::cout << "instructions_per_s: " << static_cast<uint64_t>(stats.instructions / stats.wall_time_s) << "\n";
+        std::cout << "frames_per_s: " << static_cast<uint64_t>(stats.frames / stats.wall_time_s) << "\n";
+        saveInstrumentation(instrumentation);
+        if (instrumentation->check_allocs) {
+            std::cout << "heap_allocations: " << instrumentation->allocations << "\n";
+            if (instrumentation->allocations) {
+                std::cerr << "ERROR: the emulation allocated heap memory after load" << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+    } catch (const std::exception &err) {
+        std::cerr << "ERROR: " << err.what() << std::endl;
+        dumpTrace(instrumentation);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static int runReplay(const std::string &path, const std::string &movie_path, Chip8::Engine engine, Chip8::Mode mode,
+                     Chip8::Quirks quirks, Instrumentation *instrumentation) {
+    try {
+        auto movie = Movie::load(movie_path);
+        std::shared_ptr<IDisplay> display = std::make_shared<NullDisplay>();
+        std::shared_ptr<IKeyboard> keyboard = std::make_shared<NullKeyboard>();
+        auto chip8 = Chip8(display, keyboard);
+        chip8.setMode(mode);
+        chip8.setQuirks(quirks);
+        chip8.load(path);
+        chip8.setEngine(engine);
+        attachInstrumentation(&chip8, instrumentation);
+        auto stats = chip8.replay(movie);
+
+        std::cout << "instructions: " << stats.instructions << "\n";
+        std::cout << "frames: " << stats.frames << "\n";
+        std::cout << "wall_time_s: " << stats.wall_time_s << "\n";
+        std::cout << "frame_hash: " << std::hex << std::setfill('0') << std::setw(16) << chip8.frameHash()
+                  << std::dec << "\n";
+        chip8.dumpRegisters(std::cout);
+        std::cout << "\n";
+        saveInstrumentation(instrumentation);
+    } catch (const std::exception &err) {
+        std::cerr << "ERROR: " << err.what() << std::endl;
+        dumpTrace(instrumentation);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static Chip8::RunStats runLockstepOnce(const std::string &path, uint64_t max_instructions, uint64_t max_frames,
+                                       uint64_t cycles_per_frame) {
+    auto lockstep = std::make_unique<Chip8Lockstep>(Chip8Lockstep::kLanes);
+    lockstep->setCyclesPerFrame(cycles_per_frame);
+    lockstep->loadRom(Chip8::readRom(path));
+    for (size_t lane = 0; lane < lockstep->lanes(); ++lane) {
+        lockstep->seed(lane, lane);
+    }
+    auto stats = lockstep->run(max_instructions, max_frames);
+    if (stats.wall_time_s <= 0.0) {
+        stats.wall_time_s = 1e-9;
+    }
+    return stats;
+}
+
+static int runBenchmark(const std::string &path, Chip8::Mode mode, Chip8::Quirks quirks, uint64_t max_instructions,
+                        uint64_t max_frames, Chip8::Timing timing) {
+    double baseline_ips = 0.0;
+
+    try {
+        std::vector<std::pair<std::string, Chip8::RunStats>> results;
+        // The clock asked for, but every instruction counted must have been run by the engine
+        timing.idle_loop_skip = false;
+        for (const auto &engine : kEngines) {
+            results.emplace_back(engine.first,
+                                 runHeadlessOnce(path, engine.second, mode, quirks, max_instructions, max_frames,
+                                                 timing));
+        }
+        // The lockstep core only runs CHIP-8, with the modern quirks and one cycle per instruction
+        if (mode == Chip8::Mode::kChip8 && quirks == Chip8::Quirks::kModern && timing.unitCosts()) {
+            // Aggregate over all the lanes, each lane runs the same budget as a single engine above
+            results.emplace_back("lockstep", runLockstepOnce(path, max_instructions, max_frames,
+                                                             timing.cycles_per_frame));
+        }
+
+        std::cout << std::left << std::setw(12) << "engine" << std::setw(16) << "instructions"
+                  << std::setw(14) << "wall_time_s" << std::setw(22) << "instructions_per_s" << "speedup\n";
+        for (const auto &result : results) {
+            const auto &stats = result.second;
+            auto ips = stats.instructions / stats.wall_time_s;
+            // The first engine (switch) is the baseline
+            if (baseline_ips <= 0.0) {
+                baseline_ips = ips;
+            }
+            std::cout << std::left << std::setw(12) << result.first << std::setw(16) << stats.instructions
+                      << std::setw(14) << stats.wall_time_s << std::setw(22) << static_cast<uint64_t>(ips)
+                      << std::fixed << std::setprecision(2) << ips / baseline_ips << "x\n"
+                      << std::defaultfloat << std::setprecision(6);
+        }
+    } catch (const std::exception &err) {
+        std::cerr << "ERROR: " << err.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static int runBatch(const std::vector<std::string> &paths, Chip8::Engine engine, const Chip8::Timing &timing,
+                    uint64_t max_instructions, uint64_t max_frames, size_t threads, uint32_t seeds, bool lockstep) {
+    try {
+        auto jobs = BatchRunner::makeJobs(paths, seeds);
+        BatchRunner runner(engine, timing, max_instructions, max_frames, threads, lockstep);
+
+        auto start_time = std::chrono::steady_clock::now();
+        auto failed = runner.run(jobs, std::cout);
+        std::chrono::duration<double> wall_time = std::chrono::steady_clock::now() - start_time;
+
+        // Results go to stdout, the summary to stderr so the output can be piped as is
+        std::cerr << std::dec << "jobs: " << jobs.size() << ", failed: " << failed << ", wall_time_s: " << wall_time.count()
+                  << ", jobs_per_s: " << jobs.size() / wall_time.count() << "\n";
+        return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+    } catch (const std::exception &err) {
+        std::cerr << "ERROR: " << err.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+}
 
 int main(int argc, char **argv) {
-    if (argc != 2) {
+    bool headless = false;
+    bool benchmark = false;
+    bool batch = false;
+    bool lockstep = false;
+    uint64_t max_instructions = 0;
+    uint64_t max_frames = 0;
+    size_t threads = 0;
+    uint32_t seeds = 1;
+    size_t rewind_mb = kDefaultRewindMb;
+    uint16_t audio_buffer = SdlAudio::kDefaultBufferSamples;
+    std::string record_path;
+    std::string replay_path;
+    Instrumentation instrumentation;
+    Chip8::Timing timing;
+    auto engine = Chip8::Engine::kSwitch;
+    auto mode = Chip8::Mode::kChip8;
+    // Those of the mode unless --quirks is given
+    bool quirks_set = false;
+    auto quirks = Chip8::Quirks::kModern;
+    std::vector<std::string> paths;
+
+    try {
+        for (int i = 1; i < argc; ++i) {
+            if (!std::strcmp(argv[i], "--headless")) {
+                headless = true;
+            } else if (!std::strcmp(argv[i], "--benchmark")) {
+                benchmark = true;
+            } else if (!std::strcmp(argv[i], "--batch")) {
+                batch = true;
+            } else if (!std::strcmp(argv[i], "--lockstep")) {
+                lockstep = true;
+            } else if (!std::strcmp(argv[i], "--threads") && i + 1 < argc) {
+                threads = std::stoul(argv[++i]);
+            } else if (!std::strcmp(argv[i], "--seeds") && i + 1 < argc) {
+                auto count = std::stoul(argv[++i]);
+                if (!count || count > UINT32_MAX) {
+                    throw std::invalid_argument(argv[i]);
+                }
+                seeds = static_cast<uint32_t>(count);
+            } else if (!std::strcmp(argv[i], "--record") && i + 1 < argc) {
+                record_path = argv[++i];
+            } else if (!std::strcmp(argv[i], "--replay") && i + 1 < argc) {
+                replay_path = argv[++i];
+            } else if (!std::strcmp(argv[i], "--profile") && i + 1 < argc) {
+                instrumentation.profile_prefix = argv[++i];
+            } else if (!std::strcmp(argv[i], "--trace") && i + 1 < argc) {
+                instrumentation.trace_path = argv[++i];
+            } else if (!std::strcmp(argv[i], "--check-allocs")) {
+                instrumentation.check_allocs = true;
+            } else if (!std::strcmp(argv[i], "--rewind") && i + 1 < argc) {
+                rewind_mb = std::stoul(argv[++i]);
+            } else if (!std::strcmp(argv[i], "--audio-buffer") && i + 1 < argc) {
+                auto samples = std::stoul(argv[++i]);
+                if (samples > UINT16_MAX) {
+                    throw std::invalid_argument(argv[i]);
+                }
+                audio_buffer = static_cast<uint16_t>(samples);
+            } else if (!std::strcmp(argv[i], "--instructions") && i + 1 < argc) {
+                max_instructions = std::stoull(argv[++i]);
+            } else if (!std::strcmp(argv[i], "--frames") && i + 1 < argc) {
+                max_frames = std::stoull(argv[++i]);
+            } else if (!std::strcmp(argv[i], "--cpf") && i + 1 < argc) {
+                timing.cycles_per_frame = std::stoull(argv[++i]);
+                if (!timing.cycles_per_frame) {
+                    throw std::invalid_argument(argv[i]);
+                }
+            } else if (!std::strcmp(argv[i], "--no-idle-skip")) {
+                timing.idle_loop_skip = false;
+            } else if (!std::strcmp(argv[i], "--costs") && i + 1 < argc) {
+                timing.costs = parseCosts(argv[++i]);
+            } else if (!std::strcmp(argv[i], "--engine") && i + 1 < argc) {
+                engine = parseEngine(argv[++i]);
+            } else if (!std::strcmp(argv[i], "--mode") && i + 1 < argc) {
+                mode = parseMode(argv[++i]);
+            } else if (!std::strcmp(argv[i], "--quirks") && i + 1 < argc) {
+                quirks = parseQuirks(argv[++i]);
+                quirks_set = true;
+            } else if (argv[i][0] != '-') {
+                paths.push_back(argv[i]);
+            } else {
+                throw std::invalid_argument(argv[i]);
+            }
+        }
+    } catch (const std::exception &err) {
+        std::cerr << "Failed to run: invalid argument " << err.what() << "\n";
+        printHelp();
+        return EXIT_FAILURE;
+    }
+
+    if (paths.empty() || (!batch && paths.size() > 1)) {
         std::cerr << "Failed to run: 2 arguments needed.\n";
-        std::cout << "Help:\n";
-        std::cout << "    ./achip8emu <file_path>\n";
+        printHelp();
         return EXIT_FAILURE;
     }
-    
-    std::shared_ptr<IDisplay> sdl_display = std::make_shared<SdlDisplay>(Chip8::kDisplayWidth, Chip8::kDisplayHeight);
+    const auto &path = paths.front();
+    if (!quirks_set) {
+        quirks = Chip8::defaultQuirks(mode);
+    }
+
+    if (batch) {
+        if (mode != Chip8::Mode::kChip8 || quirks != Chip8::Quirks::kModern) {
+            std::cerr << "Failed to run: batch mode only runs CHIP-8 roms, with the modern quirks.\n";
+            printHelp();
+            return EXIT_FAILURE;
+        }
+        if (!max_instructions && !max_frames) {
+            std::cerr << "Failed to run: batch mode needs an instruction or frame budget.\n";
+            printHelp();
+            return EXIT_FAILURE;
+        }
+        if (lockstep && !timing.unitCosts()) {
+            std::cerr << "Failed to run: --lockstep runs every instruction in one cycle, --costs does not apply.\n";
+            printHelp();
+            return EXIT_FAILURE;
+        }
+        return runBatch(paths, engine, timing, max_instructions, max_frames, threads, seeds, lockstep);
+    }
+
+    if (!replay_path.empty()) {
+        return runReplay(path, replay_path, engine, mode, quirks, &instrumentation);
+    }
+
+    if (quirks == Chip8::Quirks::kCosmacVip && benchmark) {
+        std::cerr << "Failed to run: --benchmark compares the engines, --quirks vip only runs on the switch engine.\n";
+        printHelp();
+        return EXIT_FAILURE;
+    }
+
+    if (instrumentation.check_allocs &&
+        (!headless || benchmark || !instrumentation.profile_prefix.empty() || !instrumentation.trace_path.empty())) {
+        std::cerr << "Failed to run: --check-allocs only checks plain headless runs, without --benchmark, "
+                     "--profile nor --trace.\n";
+        printHelp();
+        return EXIT_FAILURE;
+    }
+
+    if (headless) {
+        if (!max_instructions && !max_frames) {
+            std::cerr << "Failed to run: headless mode needs an instruction or frame budget.\n";
+            printHelp();
+            return EXIT_FAILURE;
+        }
+        if (benchmark) {
+            return runBenchmark(path, mode, quirks, max_instructions, max_frames, timing);
+        }
+        return runHeadless(path, engine, mode, quirks, max_instructions, max_frames, timing, &instrumentation);
+    }
+
+    // SDL rendering runs on its own thread, fed with the frames produced by the CPU loop. The window is sized for
+    // 64 x 32, hi-res frames are scaled to it.
+    auto threaded_display = std::make_shared<ThreadedDisplay>(Chip8::kHiresWidth, Chip8::kHiresHeight, Chip8::kPlanes,
+                                                              []() {
+        return std::make_shared<SdlDisplay>(Chip8::kDisplayWidth, Chip8::kDisplayHeight);
+    });
+    std::shared_ptr<IDisplay> sdl_display = threaded_display;
     std::shared_ptr<IKeyboard> keyboard = std::make_shared<SdlKeyboard>();
     auto chip8 = Chip8(sdl_display, keyboard);
     try {
-        chip8.load(argv[1]);
+        chip8.setMode(mode);
+        chip8.setQuirks(quirks);
+        chip8.load(path);
     } catch (const std::exception &err) {
         std::cerr << "ERROR: " << err.what() << std::endl;
         return EXIT_FAILURE;
     }
-    chip8.run();
+    chip8.setEngine(engine);
+    chip8.setTiming(timing);
+    if (audio_buffer) {
+        // The emulation still runs without an audio device, silent
+        try {
+            chip8.setAudio(std::make_shared<SdlAudio>(audio_buffer));
+        } catch (const std::exception &err) {
+            std::cerr << "WARNING: " << err.what() << ", no sound\n";
+        }
+    }
+    if (rewind_mb) {
+        chip8.enableRewind(rewind_mb << 20);
+    }
+    Movie movie;
+    if (!record_path.empty()) {
+        chip8.record(&movie);
+    }
+    try {
+        attachInstrumentation(&chip8, &instrumentation);
+    } catch (const std::exception &err) {
+        std::cerr << "ERROR: " << err.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    auto run_stats = chip8.run();
+
+    if (!record_path.empty()) {
+        chip8.stopRecording();
+        try {
+            movie.save(record_path);
+            std::cout << "movie saved to " << record_path << "\n";
+        } catch (const std::exception &err) {
+            std::cerr << "ERROR: " << err.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    try {
+        saveInstrumentation(&instrumentation);
+    } catch (const std::exception &err) {
+        std::cerr << "ERROR: " << err.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    auto stats = threaded_display->stats();
+    std::cout << "frames produced: " << stats.produced << ", presented: " << stats.presented
+              << ", dropped: " << stats.dropped << "\n";
+    std::cout << "frames emulated: " << run_stats.frames << ", skipped: " << run_stats.skipped_frames << "\n";
 
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,308 @@
+#include "Chip8.hpp"
+#include "HashingDisplay.hpp"
+#include "ScriptedKeyboard.hpp"
+#include "WorkStealingPool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*
+ * Expected run of a rom, in <rom_dir>/golden/<rom name>.golden. Plain text, one entry per line:
+ *     achip8emu-golden 1
+ *     mode <chip8|schip|xochip>            instruction set (default: chip8)
+ *     frames <n>                           60 Hz frames run (default: 300)
+ *     k <instruction> <+K|-K>              hex key K pressed (+) or released (-), in instruction order
+ *     f <frame> <16 hex digits>            hash of a frame that differs from the previous one
+ * Runs are seeded with 0 and use the default clock (Chip8::kInstructionsPerFrame).
+ */
+struct Golden {
+    Chip8::Mode mode = Chip8::Mode::kChip8;
+    uint64_t frames = 300;
+    std::vector<ScriptedKeyboard::Event> script;
+    std::vector<HashingDisplay::Change> changes;
+};
+
+static constexpr const char *kGoldenMagic = "achip8emu-golden";
+static constexpr int kGoldenVersion = 1;
+
+static const std::vector<std::pair<std::string, Chip8::Engine>> kEngines = {
+    {"switch", Chip8::Engine::kSwitch},
+    {"predecoded", Chip8::Engine::kPredecoded},
+    {"threaded", Chip8::Engine::kThreaded},
+    {"jit", Chip8::Engine::kJit}
+};
+
+static const std::vector<std::pair<std::string, Chip8::Mode>> kModes = {
+    {"chip8", Chip8::Mode::kChip8},
+    {"schip", Chip8::Mode::kSuperChip},
+    {"xochip", Chip8::Mode::kXoChip}
+};
+
+static void printHelp(void) {
+    std::cout << "Help:\n";
+    std::cout << "    ./achip8emu_regress [--update] [--threads <n>] <rom_dir>\n";
+    std::cout << "Options:\n";
+    std::cout << "    --update        rewrites the frame hashes of the goldens from the switch engine\n";
+    std::cout << "    --threads <n>   workers (default: one per hardware thread)\n";
+}
+
+static Golden loadGolden(const std::string &path) {
+    std::ifstream f(path.c_str(), std::ios::in);
+    if (!f.good()) {
+        throw std::runtime_error("Failed to load golden " + path);
+    }
+
+    Golden golden;
+    std::string line;
+    std::string magic;
+    int version = 0;
+    if (!std::getline(f, line) || !(std::istringstream(line) >> magic >> version) || magic != kGoldenMagic ||
+        version != kGoldenVersion) {
+        throw std::runtime_error("Not a golden: " + path);
+    }
+
+    for (size_t number = 2; std::getline(f, line); ++number) {
+        std::istringstream fields(line);
+        std::string tag;
+        if (!(fields >> tag)) {
+            continue;
+        }
+
+        bool ok = true;
+        if (tag == "mode") {
+            std::string name;
+            auto mode = kModes.end();
+            if (fields >> name) {
+                mode = std::find_if(kModes.begin(), kModes.end(), [&name](const auto &m) { return m.first == name; });
+            }
+            ok = mode != kModes.end();
+            if (ok) {
+                golden.mode = mode->second;
+            }
+        } else if (tag == "frames") {
+            ok = static_cast<bool>(fields >> golden.frames) && golden.frames;
+        } else if (tag == "k") {
+            // Edge: '+' or '-' and the key in hex
+            ScriptedKeyboard::Event event = {};
+            std::string edge;
+            unsigned value = 0;
+            ok = static_cast<bool>(fields >> event.instruction >> edge) && edge.size() > 1 &&
+                 (edge[0] == '+' || edge[0] == '-') && (std::istringstream(edge.substr(1)) >> std::hex >> value) &&
+                 value <= 0x0F;
+            event.key.state = edge[0] == '+' ? IKeyboard::Key::State::kPressed : IKeyboard::Key::State::kReleased;
+            event.key.value = static_cast<uint8_t>(value);
+            ok = ok && (golden.script.empty() || golden.script.back().instruction <= event.instruction);
+            golden.script.push_back(event);
+        } else if (tag == "f") {
+            HashingDisplay::Change change = {};
+            ok = static_cast<bool>(fields >> change.frame >> std::hex >> change.hash);
+            golden.changes.push_back(change);
+        } else {
+            ok = false;
+        }
+
+        if (!ok) {
+            throw std::runtime_error(path + ":" + std::to_string(number) + ": invalid golden line \"" + line + "\"");
+        }
+    }
+
+    return golden;
+}
+
+static void saveGolden(const std::string &path, const Golden &golden) {
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path());
+    std::ofstream f(path.c_str(), std::ios::out | std::ios::trunc);
+    if (!f.good()) {
+        throw std::runtime_error("Failed to save golden " + path);
+    }
+
+    f << kGoldenMagic << " " << kGoldenVersion << "\n";
+    for (const auto &mode : kModes) {
+        if (mode.second == golden.mode) {
+            f << "mode " << mode.first << "\n";
+        }
+    }
+    f << "frames " << golden.frames << "\n";
+    for (const auto &event : golden.script) {
+        f << "k " << event.instruction << " " << (event.key.state == IKeyboard::Key::State::kPressed ? '+' : '-')
+          << std::hex << int(event.key.value) << std::dec << "\n";
+    }
+    for (const auto &change : golden.changes) {
+        f << "f " << change.frame << " " << std::hex << std::setw(16) << std::setfill('0') << change.hash << std::dec
+          << "\n";
+    }
+
+    if (!f.good()) {
+        throw std::runtime_error("Failed to save golden " + path);
+    }
+}
+
+// Frame hash changes of a headless run, unthrottled
+static std::vector<HashingDisplay::Change> runRom(const std::vector<uint8_t> &rom, const Golden &golden,
+                                                  Chip8::Engine engine) {
+    auto display = std::make_shared<HashingDisplay>();
+    auto keyboard = std::make_shared<ScriptedKeyboard>(golden.script);
+    Chip8 chip8(display, keyboard);
+    keyboard->setClock([&chip8]() { return chip8.instructionCount(); });
+    chip8.seed(0);
+    chip8.setMode(golden.mode);
+    chip8.loadRom(rom);
+    chip8.setEngine(engine);
+    chip8.runHeadless(0, golden.frames);
+    return display->changes();
+}
+
+// Empty when both sequences match, else the first difference
+static std::string compare(const std::vector<HashingDisplay::Change> &expected,
+                           const std::vector<HashingDisplay::Change> &actual) {
+    auto diff = std::mismatch(expected.begin(), expected.end(), actual.begin(), actual.end());
+    if (diff.first == expected.end() && diff.second == actual.end()) {
+        return "";
+    }
+
+    std::ostringstream out;
+    out << std::hex << std::setfill('0');
+    if (diff.first == expected.end()) {
+        out << "unexpected frame " << std::dec << diff.second->frame << std::hex << " " << std::setw(16)
+            << diff.second->hash;
+    } else if (diff.second == actual.end()) {
+        out << "missing frame " << std::dec << diff.first->frame << std::hex << " " << std::setw(16)
+            << diff.first->hash;
+    } else {
+        out << "expected frame " << std::dec << diff.first->frame << std::hex << " " << std::setw(16)
+            << diff.first->hash << ", got frame " << std::dec << diff.second->frame << std::hex << " "
+            << std::setw(16) << diff.second->hash;
+    }
+    return out.str();
+}
+
+/*
+ * Runs every rom of a directory on every engine, in parallel, and checks the hash of each new frame against
+ * the golden of the rom. Registered with CTest (ctest --test-dir build).
+ */
+int main(int argc, char **argv) {
+    bool update = false;
+    size_t threads = 0;
+    std::string rom_dir;
+
+    try {
+        for (int i = 1; i < argc; ++i) {
+            if (!std::strcmp(argv[i], "--update")) {
+                update = true;
+            } else if (!std::strcmp(argv[i], "--threads") && i + 1 < argc) {
+                threads = std::stoul(argv[++i]);
+            } else if (!std::strcmp(argv[i], "--help") || !std::strcmp(argv[i], "-h")) {
+                printHelp();
+                return EXIT_SUCCESS;
+            } else if (argv[i][0] != '-') {
+                rom_dir = argv[i];
+            } else {
+                throw std::invalid_argument(argv[i]);
+            }
+        }
+    } catch (const std::exception &err) {
+        std::cerr << "ERROR: invalid argument (" << err.what() << ")\n";
+        printHelp();
+        return EXIT_FAILURE;
+    }
+
+    if (rom_dir.empty()) {
+        printHelp();
+        return EXIT_FAILURE;
+    }
+
+    struct Rom {
+        std::string name;
+        std::string golden_path;
+        std::vector<uint8_t> data;
+        Golden golden;
+        // One per engine
+        std::vector<std::vector<HashingDisplay::Change>> results;
+    };
+    std::vector<Rom> roms;
+    try {
+        for (const auto &entry : std::filesystem::directory_iterator(rom_dir)) {
+            if (entry.path().extension() != ".ch8") {
+                continue;
+            }
+            Rom rom;
+            rom.name = entry.path().filename().string();
+            rom.golden_path = (entry.path().parent_path() / "golden" / entry.path().stem()).string() + ".golden";
+            rom.data = Chip8::readRom(entry.path().string());
+            // Without --update a missing golden is an error, with it a new one is written with the defaults
+            if (!update || std::filesystem::exists(rom.golden_path)) {
+                rom.golden = loadGolden(rom.golden_path);
+            }
+            rom.results.resize(kEngines.size());
+            roms.push_back(std::move(rom));
+        }
+    } catch (const std::exception &err) {
+        std::cerr << "ERROR: " << err.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::sort(roms.begin(), roms.end(), [](const Rom &a, const Rom &b) { return a.name < b.name; });
+    if (roms.empty()) {
+        std::cerr << "ERROR: no .ch8 rom in " << rom_dir << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    auto start_time = std::chrono::steady_clock::now();
+    {
+        WorkStealingPool pool(threads);
+        for (auto &rom : roms) {
+            for (size_t engine = 0; engine < kEngines.size(); ++engine) {
+                // Tasks must not throw: a failed run leaves no change, which never matches a golden
+                pool.submit([&rom, engine]() {
+                    try {
+                        rom.results[engine] = runRom(rom.data, rom.golden, kEngines[engine].second);
+                    } catch (const std::exception &err) {
+                        std::cerr << "ERROR: " << rom.name << " " << kEngines[engine].first << ": " << err.what()
+                                  << std::endl;
+                    }
+                });
+            }
+        }
+        pool.wait();
+    }
+    std::chrono::duration<double> wall_time = std::chrono::steady_clock::now() - start_time;
+
+    size_t failed = 0;
+    for (auto &rom : roms) {
+        // With --update, the switch engine is the reference the others are checked against
+        if (update) {
+            rom.golden.changes = rom.results.front();
+        }
+        for (size_t engine = 0; engine < kEngines.size(); ++engine) {
+            auto diff = compare(rom.golden.changes, rom.results[engine]);
+            bool ok = diff.empty() && !rom.results[engine].empty();
+            failed += ok ? 0 : 1;
+            std::cout << (ok ? "PASS " : "FAIL ") << rom.name << " " << kEngines[engine].first;
+            if (!diff.empty()) {
+                std::cout << ": " << diff;
+            }
+            std::cout << "\n";
+        }
+        if (update) {
+            try {
+                saveGolden(rom.golden_path, rom.golden);
+                std::cout << "golden saved to " << rom.golden_path << "\n";
+            } catch (const std::exception &err) {
+                std::cerr << "ERROR: " << err.what() << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    std::cerr << "roms: " << roms.size() << ", runs: " << roms.size() * kEngines.size() << ", failed: " << failed
+              << ", wall_time_s: " << wall_time.count() << "\n";
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
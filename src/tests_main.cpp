@@ -0,0 +1,475 @@
+#include "AllocationCounter.hpp"
+#include "Chip8.hpp"
+#include "Movie.hpp"
+#include "NullDisplay.hpp"
+#include "NullKeyboard.hpp"
+#include "ScriptedKeyboard.hpp"
+#include "SdlAudio.hpp"
+#include "TraceBuffer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const std::vector<std::pair<std::string, Chip8::Engine>> kEngines = {
+    {"switch", Chip8::Engine::kSwitch},
+    {"predecoded", Chip8::Engine::kPredecoded},
+    {"threaded", Chip8::Engine::kThreaded},
+    {"jit", Chip8::Engine::kJit}
+};
+
+/*
+ * Waits for a key (F50A), then draws the 0 glyph at a random column (C30F) on the rows below each other while
+ * the key of that column is held (E39E)
+ */
+static const std::vector<uint8_t> kKeysRom = {
+    0xF5, 0x0A, 0xC3, 0x0F, 0xE3, 0x9E, 0x12, 0x0C, 0xA0, 0x00, 0xD3, 0x45, 0x74, 0x01, 0x12, 0x02
+};
+
+static const std::vector<ScriptedKeyboard::Event> kKeysScript = {
+    {0, {IKeyboard::Key::State::kPressed, 0x1}},
+    {0, {IKeyboard::Key::State::kReleased, 0x1}},
+    {100, {IKeyboard::Key::State::kPressed, 0x3}},
+    {400, {IKeyboard::Key::State::kPressed, 0x7}},
+    {900, {IKeyboard::Key::State::kReleased, 0x3}},
+    {1500, {IKeyboard::Key::State::kReleased, 0x7}}
+};
+
+/*
+ * One instruction per quirk: Bnnn (V0 = 4, V2 = 6) lands on 6A01 except as SUPER-CHIP Bxnn, 8211 leaves VF = 7
+ * unless the logic ops clear it, 8316 shifts V3 = 5 or V1 = 2, and F155 moves I on from 300 or not
+ */
+static const std::vector<uint8_t> kQuirksRom = {
+    0x60, 0x04, 0x62, 0x06, 0xB2, 0x0A, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x6A, 0x01, 0x6B, 0x01,
+    0x61, 0x02, 0x6F, 0x07, 0x82, 0x11, 0x63, 0x05, 0x83, 0x16, 0xA3, 0x00, 0xF1, 0x55, 0x12, 0x20
+};
+
+// Sets V0 = 1 and exits (00FD), V0 = 2 would show that the program went on
+static const std::vector<uint8_t> kExitRom = {0x60, 0x01, 0x00, 0xFD, 0x60, 0x02, 0x12, 0x04};
+
+/*
+ * XO-CHIP: loads the pattern at 20E (F002), sets the pitch from V0 (Fx3A, the second byte of the rom, patched per
+ * check) and starts the sound timer, then loops
+ */
+static const std::vector<uint8_t> kAudioRom = {
+    0x60, 0x40, 0xA2, 0x0E, 0xF0, 0x02, 0xF0, 0x3A, 0x61, 0x10, 0xF1, 0x18, 0x12, 0x0C, 0xF0, 0x0F,
+    0xCC, 0x33, 0xAA, 0x55, 0xFF, 0x00, 0x81, 0x42, 0x24, 0x18, 0x01, 0x80, 0x7E, 0xE7
+};
+static constexpr size_t kAudioPatternOffset = 14;
+static constexpr int16_t kAudioAmplitude = 4096;
+
+// Allocation audit: instructions run per rom, at a clock fast enough to keep the number of frames low
+static constexpr uint64_t kAllocationsInstructions = 5000000;
+static constexpr uint64_t kAllocationsCyclesPerFrame = 1000;
+
+// Stores V0 - V2 (F255) then the BCD of V3 (F333) from I = 300: the COSMAC VIP quirk moves I to 303 in between
+static const std::vector<uint8_t> kTraceRom = {
+    0x60, 0x01, 0x61, 0x02, 0x62, 0x03, 0x63, 0xFF, 0xA3, 0x00, 0xF2, 0x55, 0xF3, 0x33, 0x12, 0x0E
+};
+
+// Memory written by the stores of kTraceRom, as the trace disassembles them
+struct TraceResult {
+    const char *name;
+    Chip8::Quirks quirks;
+    const char *store_registers;
+    const char *store_bcd;
+};
+static const TraceResult kTraceResults[] = {
+    {"modern", Chip8::Quirks::kModern, "[300..302]", "[300..302]"},
+    {"vip", Chip8::Quirks::kCosmacVip, "[300..302]", "[303..305]"}
+};
+
+// Registers left by kQuirksRom, as dumpRegisters() writes them
+struct QuirksResult {
+    const char *name;
+    Chip8::Quirks quirks;
+    const char *registers;
+};
+static const QuirksResult kQuirksResults[] = {
+    {"modern", Chip8::Quirks::kModern, "V=04020602000000000000010100000001 I=300 PC=220 DT=00 ST=00"},
+    {"vip", Chip8::Quirks::kCosmacVip, "V=04020601000000000000010100000000 I=302 PC=220 DT=00 ST=00"},
+    {"schip", Chip8::Quirks::kSuperChip, "V=04020602000000000000000100000001 I=300 PC=220 DT=00 ST=00"}
+};
+
+static void printHelp(void) {
+    std::cout << "Help:\n";
+    std::cout << "    ./achip8emu_tests movie_replay <rom_dir>\n";
+    std::cout << "    ./achip8emu_tests quirks\n";
+    std::cout << "    ./achip8emu_tests exit\n";
+    std::cout << "    ./achip8emu_tests trace\n";
+    std::cout << "    ./achip8emu_tests audio\n";
+    std::cout << "    ./achip8emu_tests allocs <switch|predecoded|threaded|jit> <rom_dir>\n";
+    std::cout << "Tests:\n";
+    std::cout << "    movie_replay    records each rom of rom_dir (and a keyboard rom) with scripted keys, then replays "
+                 "the movie on every engine: same frame hash and instruction count\n";
+    std::cout << "    quirks          runs a rom of the ambiguous opcodes with each quirks policy on every engine: "
+                 "registers of the policy\n";
+    std::cout << "    exit            runs a SUPER-CHIP rom that exits (00FD) on every engine: the run ends on the "
+                 "00FD, after one frame\n";
+    std::cout << "    trace           traces the memory stores of a rom with each quirks policy, through a dump file: "
+                 "the ranges written\n";
+    std::cout << "    audio           synthesizes the buzzer without a device: silence when off, a 440 Hz square when "
+                 "on, the XO-CHIP pattern at its pitch, no torn pattern change\n";
+    std::cout << "    allocs          runs 5M instructions of each rom of rom_dir (and a keyboard rom) on the engine: "
+                 "no heap allocation once loaded\n";
+}
+
+// Records frames of rom on the switch engine, saves and loads the movie, and replays it on every engine
+static bool checkMovieReplay(const std::string &name, const std::vector<uint8_t> &rom, uint64_t frames) {
+    auto keyboard = std::make_shared<ScriptedKeyboard>(kKeysScript);
+    Chip8 recorder(std::make_shared<NullDisplay>(), keyboard);
+    keyboard->setClock([&recorder]() { return recorder.instructionCount(); });
+    recorder.seed(7);
+    recorder.loadRom(rom);
+    Movie recorded;
+    recorder.record(&recorded);
+    recorder.runHeadless(0, frames);
+    recorder.stopRecording();
+
+    auto path = (std::filesystem::temp_directory_path() / ("achip8emu_tests_" + name + ".movie")).string();
+    recorded.save(path);
+    auto movie = Movie::load(path);
+    std::filesystem::remove(path);
+
+    bool ok = true;
+    for (const auto &engine : kEngines) {
+        Chip8 player(std::make_shared<NullDisplay>(), std::make_shared<NullKeyboard>());
+        player.loadRom(rom);
+        player.setEngine(engine.second);
+        player.replay(movie);
+
+        bool same = player.frameHash() == recorder.frameHash() &&
+                    player.instructionCount() == recorder.instructionCount();
+        ok = ok && same;
+        std::cout << (same ? "PASS " : "FAIL ") << name << " " << engine.first << ": " << std::hex
+                  << player.frameHash() << std::dec << " after " << player.instructionCount() << " instructions";
+        if (!same) {
+            std::cout << ", recorded " << std::hex << recorder.frameHash() << std::dec << " after "
+                      << recorder.instructionCount();
+        }
+        std::cout << "\n";
+    }
+    return ok;
+}
+
+// Replays a movie of kKeysRom recorded in the default machine on a machine set up by setup: must throw
+static bool checkMovieMismatch(const std::string &name, const std::function<void(Chip8 *)> &setup) {
+    Chip8 recorder(std::make_shared<NullDisplay>(), std::make_shared<NullKeyboard>());
+    recorder.loadRom(kKeysRom);
+    Movie movie;
+    recorder.record(&movie);
+    recorder.runHeadless(0, 10);
+    recorder.stopRecording();
+
+    Chip8 player(std::make_shared<NullDisplay>(), std::make_shared<NullKeyboard>());
+    setup(&player);
+    player.loadRom(kKeysRom);
+    std::string error;
+    try {
+        player.replay(movie);
+    } catch (const Chip8::Chip8Exception &err) {
+        error = err.what();
+    }
+    std::cout << (error.empty() ? "FAIL " : "PASS ") << name << ": "
+              << (error.empty() ? "replayed on another machine" : error) << "\n";
+    return !error.empty();
+}
+
+static bool testMovieReplay(const std::string &rom_dir) {
+    bool ok = checkMovieReplay("keys", kKeysRom, 300);
+    ok = checkMovieMismatch("other mode", [](Chip8 *chip8) { chip8->setMode(Chip8::Mode::kSuperChip); }) && ok;
+    ok = checkMovieMismatch("other quirks", [](Chip8 *chip8) { chip8->setQuirks(Chip8::Quirks::kCosmacVip); }) && ok;
+    for (const auto &entry : std::filesystem::directory_iterator(rom_dir)) {
+        if (entry.path().extension() == ".ch8") {
+            ok = checkMovieReplay(entry.path().stem().string(), Chip8::readRom(entry.path().string()), 300) && ok;
+        }
+    }
+    return ok;
+}
+
+// Runs kQuirksRom on chip8 (mode and quirks set) and compares its registers
+static bool checkQuirks(const std::string &name, Chip8 *chip8, const char *expected) {
+    chip8->loadRom(kQuirksRom);
+    chip8->runHeadless(0, 10);
+
+    std::ostringstream registers;
+    chip8->dumpRegisters(registers);
+    bool same = registers.str() == expected;
+    std::cout << (same ? "PASS " : "FAIL ") << name << ": " << registers.str();
+    if (!same) {
+        std::cout << ", expected " << expected;
+    }
+    std::cout << "\n";
+    return same;
+}
+
+static bool testQuirks(void) {
+    bool ok = true;
+    for (const auto &engine : kEngines) {
+        for (const auto &expected : kQuirksResults) {
+            Chip8 chip8(std::make_shared<NullDisplay>(), std::make_shared<NullKeyboard>());
+            chip8.setEngine(engine.second);
+            chip8.setQuirks(expected.quirks);
+            ok = checkQuirks(std::string(expected.name) + " " + engine.first, &chip8, expected.registers) && ok;
+        }
+
+        // SUPER-CHIP mode brings its quirks
+        Chip8 chip8(std::make_shared<NullDisplay>(), std::make_shared<NullKeyboard>());
+        chip8.setEngine(engine.second);
+        chip8.setMode(Chip8::Mode::kSuperChip);
+        ok = checkQuirks("schip mode " + engine.first, &chip8, kQuirksResults[2].registers) && ok;
+    }
+    return ok;
+}
+
+static bool testExit(void) {
+    static const char *kExpected = "V=01000000000000000000000000000000 I=000 PC=202 DT=00 ST=00";
+    bool ok = true;
+    for (const auto &engine : kEngines) {
+        Chip8 chip8(std::make_shared<NullDisplay>(), std::make_shared<NullKeyboard>());
+        chip8.setEngine(engine.second);
+        chip8.setMode(Chip8::Mode::kSuperChip);
+        chip8.loadRom(kExitRom);
+        auto stats = chip8.runHeadless(0, 100);
+
+        std::ostringstream registers;
+        chip8.dumpRegisters(registers);
+        bool same = chip8.halted() && registers.str() == kExpected && stats.instructions == 2 && stats.frames == 1;
+        ok = ok && same;
+        std::cout << (same ? "PASS " : "FAIL ") << engine.first << ": " << registers.str() << " after "
+                  << stats.instructions << " instructions and " << stats.frames << " frames"
+                  << (chip8.halted() ? "" : ", not halted") << "\n";
+    }
+    return ok;
+}
+
+// Last line of the disassembly of record index of dump
+static std::string disassembly(const TraceBuffer::Dump &dump, size_t index) {
+    std::ostringstream line;
+    TraceBuffer::disassemble(dump.first + index, dump.records[index], dump.address_mask, line);
+    return line.str();
+}
+
+static bool testTrace(void) {
+    bool ok = true;
+    for (const auto &expected : kTraceResults) {
+        TraceBuffer trace;
+        Chip8 chip8(std::make_shared<NullDisplay>(), std::make_shared<NullKeyboard>());
+        chip8.setQuirks(expected.quirks);
+        chip8.setTrace(&trace);
+        chip8.loadRom(kTraceRom);
+        chip8.runHeadless(7, 0);
+
+        auto path = (std::filesystem::temp_directory_path() / ("achip8emu_tests_" + std::string(expected.name) +
+                                                               ".trace")).string();
+        if (!trace.dump(path.c_str())) {
+            throw std::runtime_error("Failed to dump the trace to " + path);
+        }
+        auto dump = TraceBuffer::load(path);
+        std::filesystem::remove(path);
+
+        // F255 and F333 are the 6th and 7th instructions
+        auto store_registers = dump.records.size() == 7 ? disassembly(dump, 5) : "";
+        auto store_bcd = dump.records.size() == 7 ? disassembly(dump, 6) : "";
+        bool same = store_registers.find(expected.store_registers) != std::string::npos &&
+                    store_bcd.find(expected.store_bcd) != std::string::npos;
+        ok = ok && same;
+        std::cout << (same ? "PASS " : "FAIL ") << expected.name << ":\n" << store_registers << store_bcd;
+        if (!same) {
+            std::cout << "expected " << expected.store_registers << " and " << expected.store_bcd << "\n";
+        }
+    }
+    return ok;
+}
+
+static bool report(const std::string &name, bool ok, const std::string &detail) {
+    std::cout << (ok ? "PASS " : "FAIL ") << name << ": " << detail << "\n";
+    return ok;
+}
+
+// Rising edges of 1 s of the default tone, and silence once the buzzer is off
+static bool checkBuzzer(void) {
+    constexpr int kRate = 48000;
+    auto audio = SdlAudio::withoutDevice(kRate);
+    std::vector<int16_t> samples(kRate);
+    audio->buzzerOn();
+    audio->mix(samples.data(), samples.size());
+    size_t edges = 0;
+    bool square = true;
+    for (size_t i = 0; i < samples.size(); ++i) {
+        square = square && (samples[i] == kAudioAmplitude || samples[i] == -kAudioAmplitude);
+        edges += i && samples[i] > samples[i - 1];
+    }
+    bool ok = report("buzzer on", square && edges >= 439 && edges <= 441,
+                     std::to_string(edges) + " rising edges in 1 s" + (square ? "" : ", not a square wave"));
+
+    audio->buzzerOff();
+    audio->mix(samples.data(), samples.size());
+    bool silent = std::all_of(samples.begin(), samples.end(), [](int16_t sample) { return !sample; });
+    return report("buzzer off", silent, silent ? "silence" : "not silent") && ok;
+}
+
+/*
+ * Runs kAudioRom with the given pitch (the rate is 4000 * 2^((pitch - 64) / 48) pattern samples per second) into a
+ * device-less SdlAudio at 4000 Hz, so each output sample steps over a whole number of pattern samples
+ */
+static bool checkPattern(uint8_t pitch, uint32_t step) {
+    auto audio = std::shared_ptr<SdlAudio>(SdlAudio::withoutDevice(4000));
+    auto rom = kAudioRom;
+    rom[1] = pitch;
+    Chip8 chip8(std::make_shared<NullDisplay>(), std::make_shared<NullKeyboard>());
+    chip8.setMode(Chip8::Mode::kXoChip);
+    chip8.setAudio(audio);
+    chip8.loadRom(rom);
+    // The first tick sounds the buzzer
+    chip8.runHeadless(0, 1);
+
+    int16_t samples[256];
+    audio->mix(samples, 256);
+    size_t mismatches = 0;
+    for (size_t i = 0; i < 256; ++i) {
+        size_t bit = (i * step) % 128;
+        bool on = (rom[kAudioPatternOffset + bit / 8] >> (7 - bit % 8)) & 0x01;
+        mismatches += samples[i] != (on ? kAudioAmplitude : -kAudioAmplitude);
+    }
+    return report("pattern at pitch " + std::to_string(pitch), !mismatches,
+                  std::to_string(mismatches) + " samples off the pattern");
+}
+
+/*
+ * One thread keeps switching between an all-on and an all-off tone while the other mixes: every buffer must be
+ * all of one, a buffer with both played one half of a pattern with the other
+ */
+static bool checkTornPattern(void) {
+    static const uint8_t kOn[16] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+                                    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    static const uint8_t kOff[16] = {};
+    auto audio = SdlAudio::withoutDevice(4000);
+    audio->setPattern(kOn, 4000.0f);
+    audio->buzzerOn();
+
+    std::atomic<bool> done(false);
+    std::thread writer([&audio, &done]() {
+        for (uint64_t i = 0; !done.load(std::memory_order_relaxed); ++i) {
+            audio->setPattern(i & 1 ? kOff : kOn, 4000.0f);
+        }
+    });
+    size_t torn = 0;
+    int16_t samples[128];
+    for (size_t i = 0; i < 200000; ++i) {
+        audio->mix(samples, 128);
+        torn += !std::all_of(std::begin(samples), std::end(samples), [&samples](int16_t s) { return s == samples[0]; });
+    }
+    done = true;
+    writer.join();
+    return report("pattern change", !torn, std::to_string(torn) + " torn buffers out of 200000");
+}
+
+static bool testAudio(void) {
+    bool ok = checkBuzzer();
+    // Pitch 64: 4000 Hz, one pattern sample per output sample. Pitch 112: 8000 Hz, two.
+    ok = checkPattern(64, 1) && ok;
+    ok = checkPattern(112, 2) && ok;
+    return checkTornPattern() && ok;
+}
+
+/*
+ * Key edges for the allocation audit, one press and release every few polls of the keyboard. They are timed in
+ * polls (once per frame) rather than instructions, so a rom parked on Fx0A still gets its next key.
+ */
+static std::vector<ScriptedKeyboard::Event> allocationsScript(uint64_t polls) {
+    std::vector<ScriptedKeyboard::Event> script;
+    for (uint64_t poll = 0; poll + 5 < polls; poll += 10) {
+        auto key = static_cast<uint8_t>((poll / 10) % 16);
+        script.push_back({poll, {IKeyboard::Key::State::kPressed, key}});
+        script.push_back({poll + 5, {IKeyboard::Key::State::kReleased, key}});
+    }
+    return script;
+}
+
+/*
+ * Executes instructions of rom on engine with scripted keys and counts the heap allocations made once it is set
+ * up. Idle loops are executed, and a run that stops short of the budget (parked on Fx0A, halted) fails.
+ */
+static bool checkAllocations(const std::string &name, const std::vector<uint8_t> &rom, Chip8::Engine engine,
+                             uint64_t instructions) {
+    auto keyboard = std::make_shared<ScriptedKeyboard>(allocationsScript(instructions / kAllocationsCyclesPerFrame));
+    Chip8 chip8(std::make_shared<NullDisplay>(), keyboard);
+    uint64_t polls = 0;
+    keyboard->setClock([&polls]() { return polls++; });
+    chip8.seed(7);
+    chip8.loadRom(rom);
+    chip8.setEngine(engine);
+    chip8.setCyclesPerFrame(kAllocationsCyclesPerFrame);
+    chip8.setIdleLoopSkip(false);
+
+    auto start = AllocationCounter::count();
+    chip8.runHeadless(instructions, 0);
+    auto allocations = AllocationCounter::count() - start;
+    bool ok = !allocations && chip8.instructionCount() >= instructions;
+    std::cout << (ok ? "PASS " : "FAIL ") << name << ": " << allocations << " allocations after "
+              << chip8.instructionCount() << " instructions";
+    if (chip8.instructionCount() < instructions) {
+        std::cout << ", expected " << instructions;
+    }
+    std::cout << "\n";
+    return ok;
+}
+
+static bool testAllocations(const std::string &engine_name, const std::string &rom_dir) {
+    auto engine = std::find_if(kEngines.begin(), kEngines.end(),
+                               [&engine_name](const auto &e) { return e.first == engine_name; });
+    if (engine == kEngines.end()) {
+        throw std::invalid_argument("unknown engine " + engine_name);
+    }
+
+    bool ok = checkAllocations("keys", kKeysRom, engine->second, kAllocationsInstructions);
+    for (const auto &entry : std::filesystem::directory_iterator(rom_dir)) {
+        if (entry.path().extension() == ".ch8") {
+            ok = checkAllocations(entry.path().stem().string(), Chip8::readRom(entry.path().string()),
+                                  engine->second, kAllocationsInstructions) && ok;
+        }
+    }
+    return ok;
+}
+
+// Self-checking tests, registered with CTest (ctest --test-dir build)
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printHelp();
+        return EXIT_FAILURE;
+    }
+
+    bool ok = false;
+    try {
+        if (!std::strcmp(argv[1], "movie_replay") && argc == 3) {
+            ok = testMovieReplay(argv[2]);
+        } else if (!std::strcmp(argv[1], "quirks") && argc == 2) {
+            ok = testQuirks();
+        } else if (!std::strcmp(argv[1], "exit") && argc == 2) {
+            ok = testExit();
+        } else if (!std::strcmp(argv[1], "trace") && argc == 2) {
+            ok = testTrace();
+        } else if (!std::strcmp(argv[1], "audio") && argc == 2) {
+            ok = testAudio();
+        } else if (!std::strcmp(argv[1], "allocs") && argc == 4) {
+            ok = testAllocations(argv[2], argv[3]);
+        } else {
+            printHelp();
+            return EXIT_FAILURE;
+        }
+    } catch (const std::exception &err) {
+        std::cerr << "ERROR: " << err.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,57 @@
+#include "TraceBuffer.hpp"
+#include <cstring>
+#include <iostream>
+#include <string>
+
+static void printHelp(void) {
+    std::cout << "Help:\n";
+    std::cout << "    ./achip8emu_trace [--last <n>] <trace_path>\n";
+    std::cout << "Options:\n";
+    std::cout << "    --last <n>      only prints the n newest instructions of the dump\n";
+}
+
+// Prints a trace dumped by achip8emu --trace as one disassembled instruction per line, oldest first
+int main(int argc, char **argv) {
+    uint64_t last = 0;
+    std::string path;
+
+    try {
+        for (int i = 1; i < argc; ++i) {
+            if (!std::strcmp(argv[i], "--last") && i + 1 < argc) {
+                last = std::stoull(argv[++i]);
+            } else if (!std::strcmp(argv[i], "--help") || !std::strcmp(argv[i], "-h")) {
+                printHelp();
+                return EXIT_SUCCESS;
+            } else {
+                path = argv[i];
+            }
+        }
+    } catch (const std::exception &err) {
+        std::cerr << "ERROR: invalid argument (" << err.what() << ")\n";
+        printHelp();
+        return EXIT_FAILURE;
+    }
+
+    if (path.empty()) {
+        printHelp();
+        return EXIT_FAILURE;
+    }
+
+    try {
+        auto dump = TraceBuffer::load(path);
+        size_t first = 0;
+        if (last && last < dump.records.size()) {
+            first = dump.records.size() - last;
+        }
+        std::cout << "instructions traced: " << dump.first + dump.records.size() << ", in dump: "
+                  << dump.records.size() << "\n";
+        for (size_t i = first; i < dump.records.size(); ++i) {
+            TraceBuffer::disassemble(dump.first + i, dump.records[i], dump.address_mask, std::cout);
+        }
+    } catch (const std::exception &err) {
+        std::cerr << "ERROR: " << err.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}